@@ -0,0 +1,346 @@
+// HTTP load generator for make bench, talks to loopback addresses only.
+// every thread keeps one connection busy in a closed loop
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Options {
+  std::string name;
+  std::string host;
+  int port;
+  int threads;
+  int seconds;
+  std::string method;
+  std::string uri;
+  size_t bodySize;
+  bool isChunked;
+  bool isKeepAlive;
+  int pipeline;  // requests written before reading the responses
+  std::string output;
+};
+
+struct Worker {
+  const Options *opt;
+  pthread_t tid;
+  std::vector<unsigned long> latencies;  // usec
+  size_t statusClass[6];
+  size_t errors;
+  size_t bytes;
+  size_t connects;
+};
+
+static unsigned long nowUsec() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void usage() {
+  std::cerr << "usage: loadgen -n name [-h 127.0.0.1] [-p port] [-t threads] "
+               "[-d seconds] [-m method] [-u uri] [-b body bytes] [-C] "
+               "[-k 0|1] [-P pipeline] [-o results.jsonl]\n"
+               "  -C sends the body chunked, -k 0 opens a connection per "
+               "request"
+            << std::endl;
+  exit(1);
+}
+
+static Options parseOptions(int ac, char **av) {
+  Options opt;
+
+  opt.host = "127.0.0.1";
+  opt.port = 8180;
+  opt.threads = 4;
+  opt.seconds = 5;
+  opt.method = "GET";
+  opt.uri = "/";
+  opt.bodySize = 0;
+  opt.isChunked = false;
+  opt.isKeepAlive = true;
+  opt.pipeline = 1;
+  for (int i = 1; i < ac; i++) {
+    std::string arg = av[i];
+    if (arg == "-C") {
+      opt.isChunked = true;
+      continue;
+    }
+    if (i + 1 >= ac) usage();
+    std::string value = av[++i];
+    if (arg == "-n")
+      opt.name = value;
+    else if (arg == "-h")
+      opt.host = value;
+    else if (arg == "-p")
+      opt.port = atoi(value.c_str());
+    else if (arg == "-t")
+      opt.threads = atoi(value.c_str());
+    else if (arg == "-d")
+      opt.seconds = atoi(value.c_str());
+    else if (arg == "-m")
+      opt.method = value;
+    else if (arg == "-u")
+      opt.uri = value;
+    else if (arg == "-b")
+      opt.bodySize = atoi(value.c_str());
+    else if (arg == "-k")
+      opt.isKeepAlive = value != "0";
+    else if (arg == "-P")
+      opt.pipeline = atoi(value.c_str());
+    else if (arg == "-o")
+      opt.output = value;
+    else
+      usage();
+  }
+  if (opt.name.empty() || opt.threads < 1 || opt.seconds < 1 ||
+      opt.pipeline < 1)
+    usage();
+  if (opt.isKeepAlive == false) opt.pipeline = 1;
+  return opt;
+}
+
+static std::string makeRequest(const Options &opt) {
+  std::stringstream ss;
+
+  ss << opt.method << " " << opt.uri << " HTTP/1.1\r\nHost: localhost\r\n";
+  if (opt.isKeepAlive == false) ss << "Connection: close\r\n";
+  if (opt.bodySize == 0 && opt.method != "POST") {
+    ss << "\r\n";
+    return ss.str();
+  }
+  std::string body = "a=1&b=";
+  if (opt.bodySize > body.size()) body.append(opt.bodySize - body.size(), 'x');
+  ss << "Content-Type: application/x-www-form-urlencoded\r\n";
+  if (opt.isChunked == false) {
+    ss << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+    return ss.str();
+  }
+  size_t half = body.size() / 2;  // two chunks and the last one
+  ss << "Transfer-Encoding: chunked\r\n\r\n";
+  ss << std::hex << half << "\r\n" << body.substr(0, half) << "\r\n";
+  ss << std::hex << body.size() - half << "\r\n" << body.substr(half)
+     << "\r\n0\r\n\r\n";
+  return ss.str();
+}
+
+static int connectServer(const Options &opt) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+
+  if (fd == -1) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(opt.port);
+  inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ==
+      -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool readMore(int fd, std::string &buf) {
+  char tmp[65536];
+  ssize_t n = read(fd, tmp, sizeof(tmp));
+
+  if (n <= 0) return false;
+  buf.append(tmp, n);
+  return true;
+}
+
+static std::string findHeader(const std::string &head, const char *key) {
+  size_t pos = head.find(key);
+
+  if (pos == std::string::npos) return "";
+  pos += strlen(key);
+  return head.substr(pos, head.find("\r\n", pos) - pos);
+}
+
+// consumes one response from buf, false on a broken connection
+static bool readResponse(int fd, std::string &buf, int &status,
+                         bool &isClosed, size_t &bytes) {
+  size_t headEnd;
+
+  while ((headEnd = buf.find("\r\n\r\n")) == std::string::npos)
+    if (readMore(fd, buf) == false) return false;
+  std::string head = buf.substr(0, headEnd + 2);
+  size_t bodyStart = headEnd + 4;
+  status = atoi(head.c_str() + 9);
+  isClosed = findHeader(head, "\r\nConnection: ") == "close";
+
+  std::string length = findHeader(head, "\r\nContent-Length: ");
+  if (length.empty() == false) {
+    size_t total = bodyStart + strtoul(length.c_str(), NULL, 10);
+    while (buf.size() < total)
+      if (readMore(fd, buf) == false) return false;
+    bytes += total;
+    buf.erase(0, total);
+    return true;
+  }
+  if (findHeader(head, "\r\nTransfer-Encoding: ") == "chunked") {
+    size_t pos = bodyStart;
+    while (true) {
+      size_t lineEnd;
+      while ((lineEnd = buf.find("\r\n", pos)) == std::string::npos)
+        if (readMore(fd, buf) == false) return false;
+      size_t size = strtoul(buf.c_str() + pos, NULL, 16);
+      size_t next = lineEnd + 2 + size + 2;
+      while (buf.size() < next)
+        if (readMore(fd, buf) == false) return false;
+      pos = next;
+      if (size == 0) break;
+    }
+    bytes += pos;
+    buf.erase(0, pos);
+    return true;
+  }
+  if (status == 304 || status == 204 || (status >= 100 && status < 200)) {
+    bytes += bodyStart;
+    buf.erase(0, bodyStart);
+    return true;
+  }
+  while (readMore(fd, buf))  // the body ends with the connection
+    ;
+  bytes += buf.size();
+  buf.clear();
+  isClosed = true;
+  return true;
+}
+
+static void *runWorker(void *arg) {
+  Worker &w = *static_cast<Worker *>(arg);
+  const Options &opt = *w.opt;
+  std::string request = makeRequest(opt);
+  std::string batch;
+  std::string buf;
+  unsigned long deadline = nowUsec() + opt.seconds * 1000000UL;
+  int fd = -1;
+
+  for (int i = 0; i < opt.pipeline; i++) batch += request;
+  while (nowUsec() < deadline) {
+    if (fd == -1) {
+      if ((fd = connectServer(opt)) == -1) {
+        w.errors++;
+        usleep(1000);
+        continue;
+      }
+      w.connects++;
+      buf.clear();
+    }
+    unsigned long start = nowUsec();
+    if (write(fd, batch.c_str(), batch.size()) !=
+        static_cast<ssize_t>(batch.size())) {
+      w.errors++;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    bool isClosed = false;
+    for (int i = 0; i < opt.pipeline && isClosed == false; i++) {
+      int status = 0;
+      if (readResponse(fd, buf, status, isClosed, w.bytes) == false) {
+        w.errors++;
+        isClosed = true;
+        break;
+      }
+      w.latencies.push_back(nowUsec() - start);
+      w.statusClass[status >= 100 && status < 600 ? status / 100 : 0]++;
+    }
+    if (isClosed || opt.isKeepAlive == false) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd != -1) close(fd);
+  return NULL;
+}
+
+static unsigned long percentile(const std::vector<unsigned long> &sorted,
+                                double percent) {
+  if (sorted.empty()) return 0;
+  size_t idx = static_cast<size_t>(percent / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+static bool isLoopback(const std::string &host) {
+  struct in_addr addr;
+
+  if (inet_pton(AF_INET, host.c_str(), &addr) != 1) return false;
+  return (ntohl(addr.s_addr) >> 24) == 127;
+}
+
+int main(int ac, char **av) {
+  Options opt = parseOptions(ac, av);
+
+  if (isLoopback(opt.host) == false) {
+    std::cerr << "loadgen: only loopback addresses are allowed" << std::endl;
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  std::vector<Worker> workers(opt.threads);
+  unsigned long start = nowUsec();
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].opt = &opt;
+    workers[i].errors = 0;
+    workers[i].bytes = 0;
+    workers[i].connects = 0;
+    for (int j = 0; j < 6; j++) workers[i].statusClass[j] = 0;
+    pthread_create(&workers[i].tid, NULL, runWorker, &workers[i]);
+  }
+
+  std::vector<unsigned long> all;
+  size_t statusClass[6] = {0, 0, 0, 0, 0, 0};
+  size_t errors = 0;
+  size_t bytes = 0;
+  size_t connects = 0;
+  for (size_t i = 0; i < workers.size(); i++) {
+    pthread_join(workers[i].tid, NULL);
+    all.insert(all.end(), workers[i].latencies.begin(),
+               workers[i].latencies.end());
+    for (int j = 0; j < 6; j++) statusClass[j] += workers[i].statusClass[j];
+    errors += workers[i].errors;
+    bytes += workers[i].bytes;
+    connects += workers[i].connects;
+  }
+  double elapsed = (nowUsec() - start) / 1e6;
+  std::sort(all.begin(), all.end());
+
+  std::stringstream json;
+  json << "{\"scenario\":\"" << opt.name << "\",\"threads\":" << opt.threads
+       << ",\"pipeline\":" << opt.pipeline << ",\"seconds\":" << elapsed
+       << ",\"requests\":" << all.size() << ",\"errors\":" << errors
+       << ",\"connects\":" << connects << ",\"bytes\":" << bytes
+       << ",\"rps\":" << static_cast<size_t>(all.size() / elapsed)
+       << ",\"p50_us\":" << percentile(all, 50)
+       << ",\"p90_us\":" << percentile(all, 90)
+       << ",\"p99_us\":" << percentile(all, 99)
+       << ",\"p999_us\":" << percentile(all, 99.9)
+       << ",\"max_us\":" << (all.empty() ? 0 : all.back());
+  for (int j = 2; j < 6; j++) json << ",\"" << j << "xx\":" << statusClass[j];
+  json << "}";
+
+  std::cout << json.str() << std::endl;
+  if (opt.output.empty() == false) {
+    std::ofstream file(opt.output.c_str(), std::ios::app);
+    file << json.str() << "\n";
+  }
+  return errors > 0 && all.empty() ? 1 : 0;
+}
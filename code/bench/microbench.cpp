@@ -0,0 +1,332 @@
+// microbenchmarks of the parser, router and serializer hot paths
+// reports ns/op and allocations/op, -c compares against a saved run
+#include <stdlib.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../includes/ConfigParser.hpp"
+#include "../includes/Limiter.hpp"
+#include "../includes/Request.hpp"
+#include "../includes/Response.hpp"
+#include "../includes/RootBlock.hpp"
+#include "../includes/Utils.hpp"
+
+#define MIN_RUN_USEC 100000  // a measured run takes at least this long
+#define RUN_CNT 5            // the fastest run is reported
+
+static size_t g_allocs = 0;
+
+void *operator new(size_t size) throw(std::bad_alloc) {
+  void *p = malloc(size == 0 ? 1 : size);
+
+  if (p == NULL) throw std::bad_alloc();
+  g_allocs++;
+  return p;
+}
+
+void operator delete(void *p) throw() { free(p); }
+
+static volatile size_t g_sink;  // keeps results from being optimized away
+static SPSBList *g_sbList;
+static LocationMap *g_locMap;
+static Limiter g_limiter;
+
+static const char g_simpleGet[] =
+    "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+    "User-Agent: microbench\r\nAccept: */*\r\n\r\n";
+
+static std::string makeLargeHeaders() {
+  std::string req = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n";
+
+  for (int i = 0; i < 40; i++)
+    req += "X-Header-" + ftItos(i) + ": " + std::string(48, 'v') + "\r\n";
+  return req + "\r\n";
+}
+
+static std::string makeChunked() {
+  std::string req =
+      "POST /upload/sink HTTP/1.1\r\nHost: localhost\r\n"
+      "Transfer-Encoding: chunked\r\n\r\n";
+
+  for (int i = 0; i < 8; i++) req += "200\r\n" + std::string(512, 'x') + "\r\n";
+  return req + "0\r\n\r\n";
+}
+
+static void benchParseSimple(size_t iters) {
+  for (size_t i = 0; i < iters; i++) {
+    Request req;
+    req.addRawContents(g_simpleGet, sizeof(g_simpleGet) - 1);
+    req.parsing(g_sbList, *g_locMap, g_limiter);
+    g_sink += req.isFullReq();
+  }
+}
+
+// the head arrives in three reads
+static void benchParseSplit(size_t iters) {
+  static const size_t cuts[] = {0, 17, 41, sizeof(g_simpleGet) - 1};
+
+  for (size_t i = 0; i < iters; i++) {
+    Request req;
+    for (size_t j = 0; j < 3; j++) {
+      req.addRawContents(g_simpleGet + cuts[j], cuts[j + 1] - cuts[j]);
+      req.parsing(g_sbList, *g_locMap, g_limiter);
+    }
+    g_sink += req.isFullReq();
+  }
+}
+
+static void benchParseChunked(size_t iters) {
+  static const std::string raw = makeChunked();
+
+  for (size_t i = 0; i < iters; i++) {
+    Request req;
+    req.addRawContents(raw.c_str(), raw.size());
+    req.parsing(g_sbList, *g_locMap, g_limiter);
+    g_sink += req.getBody().size();
+  }
+}
+
+static void benchParseLargeHeaders(size_t iters) {
+  static const std::string raw = makeLargeHeaders();
+
+  for (size_t i = 0; i < iters; i++) {
+    Request req;
+    req.addRawContents(raw.c_str(), raw.size());
+    req.parsing(g_sbList, *g_locMap, g_limiter);
+    g_sink += req.isFullReq();
+  }
+}
+
+static void benchSetLocBlock(size_t iters) {
+  Request req;
+
+  req.addRawContents(g_simpleGet, sizeof(g_simpleGet) - 1);
+  req.setHeader();
+  for (size_t i = 0; i < iters; i++) {
+    req.setLocBlock(g_sbList, *g_locMap);
+    g_sink += reinterpret_cast<size_t>(req.getLocBlock());
+  }
+}
+
+// a limit_req bucket and a limit_conn slot of one of 1000 keys
+static void benchLimiter(size_t iters) {
+  static Limiter limiter;
+  static std::vector<uint64_t> hashes;
+  uint64_t wait;
+
+  if (hashes.empty()) {
+    limiter.setSize(65536);
+    for (int i = 0; i < 1000; i++)
+      hashes.push_back(Limiter::makeHash(1, "10.0.0." + ftItos(i)));
+  }
+  for (size_t i = 0; i < iters; i++) {
+    uint64_t hash = hashes[i % hashes.size()];
+    g_sink += limiter.take(hash, 1000000, 10, true, i, wait);
+    g_sink += limiter.acquire(hash, 8);
+    limiter.release(hash);
+  }
+}
+
+static void benchSetResult(size_t iters) {
+  Response res;
+  std::string body(1024, 'b');
+
+  res.setStatusLine(200);
+  res.setHeaders("Content-Type", "text/html");
+  res.setHeaders("Content-Length", "1024");
+  res.setHeaders("Last-Modified", "Mon, 19 Oct 2026 13:00:00 GMT");
+  res.setHeaders("ETag", "\"6523a1b0-400\"");
+  res.setHeaders("Accept-Ranges", "bytes");
+  res.setConnection("keep-alive");
+  res.setBody(body);
+  for (size_t i = 0; i < iters; i++) {
+    res.setResult();
+    g_sink += res.getRemainSize();
+  }
+}
+
+static void benchConvertCgi(size_t iters) {
+  const std::string out =
+      "Content-Type: text/html\r\nStatus: 200 OK\r\n"
+      "Set-Cookie: session=abcdef\r\n\r\n" +
+      std::string(512, 'c');
+  Response res;
+
+  for (size_t i = 0; i < iters; i++) {
+    res.convertCGI(out);
+    g_sink += res.getRemainSize();
+  }
+}
+
+static void benchFtItos(size_t iters) {
+  for (size_t i = 0; i < iters; i++)
+    g_sink += ftItos(static_cast<int>(i * 7919)).size();
+}
+
+static void benchHexToDecimal(size_t iters) {
+  const std::string hex[] = {"0", "1f", "200", "8000", "7fffffff"};
+
+  for (size_t i = 0; i < iters; i++) g_sink += hexToDecimal(hex[i % 5]);
+}
+
+static void benchGetCurrentTime(size_t iters) {
+  for (size_t i = 0; i < iters; i++) g_sink += getCurrentTime().size();
+}
+
+struct Bench {
+  const char *name;
+  void (*fn)(size_t iters);
+};
+
+static const Bench g_benches[] = {
+    {"request_parse_simple", benchParseSimple},
+    {"request_parse_split", benchParseSplit},
+    {"request_parse_chunked", benchParseChunked},
+    {"request_parse_large_headers", benchParseLargeHeaders},
+    {"request_set_loc_block", benchSetLocBlock},
+    {"limiter_take_acquire", benchLimiter},
+    {"response_set_result", benchSetResult},
+    {"response_convert_cgi", benchConvertCgi},
+    {"utils_ft_itos", benchFtItos},
+    {"utils_hex_to_decimal", benchHexToDecimal},
+    {"utils_get_current_time", benchGetCurrentTime}};
+
+struct Result {
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+static Result runBench(const Bench &bench) {
+  size_t iters = 1;
+  unsigned long elapsed = 0;
+  Result best = {0, 0};
+
+  // grows the loop until one run is long enough to time
+  while (true) {
+    unsigned long start = getMonotonicUsec();
+    bench.fn(iters);
+    elapsed = getMonotonicUsec() - start;
+    if (elapsed >= MIN_RUN_USEC) break;
+    iters *= elapsed == 0 ? 16 : MIN_RUN_USEC * 2 / elapsed + 1;
+  }
+  for (int run = 0; run < RUN_CNT; run++) {
+    size_t allocs = g_allocs;
+    unsigned long start = getMonotonicUsec();
+    bench.fn(iters);
+    elapsed = getMonotonicUsec() - start;
+    double ns = elapsed * 1000.0 / iters;
+    if (run == 0 || ns < best.nsPerOp) best.nsPerOp = ns;
+    best.allocsPerOp = static_cast<double>(g_allocs - allocs) / iters;
+  }
+  return best;
+}
+
+// name ns/op allocs/op per line, as written by -o
+static std::map<std::string, Result> loadBaseline(const std::string &path) {
+  std::map<std::string, Result> baseline;
+  std::ifstream file(path.c_str());
+  std::string name;
+  Result result;
+
+  if (file.is_open() == false)
+    throw std::runtime_error("cannot open baseline " + path);
+  while (file >> name >> result.nsPerOp >> result.allocsPerOp)
+    baseline[name] = result;
+  return baseline;
+}
+
+static void usage() {
+  std::cerr << "usage: microbench [-f filter] [-o out.txt] [-c baseline.txt] "
+               "[-t tolerance%]\n"
+               "  run from the code directory, bench/bench.conf routes the "
+               "requests"
+            << std::endl;
+  exit(1);
+}
+
+int main(int ac, char **av) {
+  std::string filter;
+  std::string output;
+  std::string baselinePath;
+  double tolerance = 10;
+
+  for (int i = 1; i < ac; i++) {
+    std::string arg = av[i];
+    if (i + 1 >= ac) usage();
+    if (arg == "-f")
+      filter = av[++i];
+    else if (arg == "-o")
+      output = av[++i];
+    else if (arg == "-c")
+      baselinePath = av[++i];
+    else if (arg == "-t")
+      tolerance = atof(av[++i]);
+    else
+      usage();
+  }
+  try {
+    RootBlock root;
+    ConfigParser parser("bench/bench.conf");
+    parser.parseBlocks(&root, ROOT);
+    g_sbList = parser.getServerBlockMap().begin()->second;
+    g_locMap = &parser.getSortedLocationMap();
+    updateCachedTime();
+
+    std::map<std::string, Result> baseline;
+    if (baselinePath.empty() == false) baseline = loadBaseline(baselinePath);
+    std::stringstream saved;
+    int regressions = 0;
+
+    std::cout << std::left << std::setw(30) << "benchmark" << std::right
+              << std::setw(12) << "ns/op" << std::setw(12) << "allocs/op"
+              << (baseline.empty() ? "" : "    vs baseline") << std::endl;
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++) {
+      const Bench &bench = g_benches[i];
+      if (std::string(bench.name).find(filter) == std::string::npos) continue;
+      Result result = runBench(bench);
+      saved << bench.name << " " << std::fixed << std::setprecision(1)
+            << result.nsPerOp << " " << std::setprecision(2)
+            << result.allocsPerOp << "\n";
+      std::cout << std::left << std::setw(30) << bench.name << std::right
+                << std::fixed << std::setprecision(1) << std::setw(12)
+                << result.nsPerOp << std::setprecision(2) << std::setw(12)
+                << result.allocsPerOp;
+      std::map<std::string, Result>::iterator base =
+          baseline.find(bench.name);
+      if (base != baseline.end()) {
+        double change =
+            (result.nsPerOp / base->second.nsPerOp - 1) * 100;
+        bool isSlower = change > tolerance;
+        bool hasMoreAllocs =
+            result.allocsPerOp > base->second.allocsPerOp + 0.005;
+        std::cout << std::showpos << std::setw(10) << change << "%"
+                  << std::noshowpos;
+        if (isSlower || hasMoreAllocs) {
+          std::cout << "  REGRESSION" << (hasMoreAllocs ? " (allocs)" : "");
+          regressions++;
+        }
+      }
+      std::cout << std::endl;
+    }
+    if (output.empty() == false) {
+      std::ofstream file(output.c_str());
+      file << saved.str();
+    }
+    if (regressions > 0) {
+      std::cout << regressions << " regression(s) over " << tolerance << "%"
+                << std::endl;
+      return 1;
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# make pgo: builds the release binary and an instrumented one, trains the
+# instrumented one with the bench scenarios on loopback, rebuilds with the
+# profile and compares the requests per second of both builds
+# PGO_TRAIN_SECONDS and PGO_COMPARE_SECONDS set the length of a scenario
+set -e
+cd "$(dirname "$0")/.."
+
+MAKE=${MAKE:-make}
+PGO_DIR=.pgo
+TRAIN_SECONDS=${PGO_TRAIN_SECONDS:-3}
+COMPARE_SECONDS=${PGO_COMPARE_SECONDS:-5}
+
+$MAKE release
+cp WebServ bench/WebServ.release
+
+echo "pgo: instrumented build"
+rm -rf $PGO_DIR .obj/pgo .dep/pgo WebServ
+mkdir -p $PGO_DIR
+$MAKE PGO=generate all
+echo "pgo: training"
+BENCH_SECONDS=$TRAIN_SECONDS BENCH_OUT=$PGO_DIR/train.jsonl ./bench/run.sh \
+  > /dev/null
+if ls $PGO_DIR/*.profraw > /dev/null 2>&1; then
+  PROFDATA=$(xcrun -f llvm-profdata 2>/dev/null || command -v llvm-profdata)
+  $PROFDATA merge -o $PGO_DIR/default.profdata $PGO_DIR/*.profraw
+fi
+
+echo "pgo: optimized build"
+rm -rf .obj/pgo .dep/pgo WebServ
+$MAKE PGO=use all
+
+echo "pgo: comparing with release"
+BENCH_SERVER=bench/WebServ.release BENCH_SECONDS=$COMPARE_SECONDS \
+  BENCH_OUT=$PGO_DIR/release.jsonl ./bench/run.sh > /dev/null
+BENCH_SECONDS=$COMPARE_SECONDS BENCH_OUT=$PGO_DIR/pgo.jsonl ./bench/run.sh \
+  > /dev/null
+rm -f bench/WebServ.release
+cat $PGO_DIR/release.jsonl $PGO_DIR/pgo.jsonl |
+  sed 's/.*"scenario":"\([^"]*\)".*"rps":\([0-9]*\).*/\1 \2/' |
+  awk '{ if ($1 in base) printf "%-22s release %7d rps  pgo %7d rps  %+6.1f%%\n",
+           $1, base[$1], $2, base[$1] ? ($2 / base[$1] - 1) * 100 : 0;
+         else base[$1] = $2 }'
@@ -0,0 +1,331 @@
+// replays a capture_file against a local server, see includes/Capture.hpp
+// every recorded read is sent as its own write, in the recorded order
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../includes/Capture.hpp"
+
+#define CLOSE_IDLE_USEC 50000  // at speed 0 a close waits for the responses
+
+struct Record {
+  unsigned int id;
+  int type;
+  unsigned long usec;
+  std::string data;
+  size_t seq;  // position in the file, breaks ties between connections
+};
+
+struct Conn {
+  int fd;
+  int port;
+  std::deque<Record> pending;
+  unsigned long lastSend;  // usec since the replay started
+  unsigned long lastRecv;
+  bool isShut;
+};
+
+struct Options {
+  std::string path;
+  std::string host;
+  int port;        // 0 keeps the recorded listen ports
+  double speed;    // 1 is the recorded pace, 0 sends as fast as possible
+  unsigned long gap;  // usec between two writes of a connection at speed 0
+  int loops;
+};
+
+static unsigned long nowUsec() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static unsigned long getUint(const unsigned char *p, int bytes) {
+  unsigned long value = 0;
+
+  for (int i = 0; i < bytes; i++) value = value << 8 | p[i];
+  return value;
+}
+
+static void usage() {
+  std::cerr << "usage: replay [-h 127.0.0.1] [-p port] [-s speed] [-g usec] "
+               "[-l loops] capture_file\n"
+               "  -s 1 keeps the recorded timing, -s 0 sends as fast as "
+               "possible with -g usec between the reads of a connection"
+            << std::endl;
+  exit(1);
+}
+
+static Options parseOptions(int ac, char **av) {
+  Options opt;
+
+  opt.host = "127.0.0.1";
+  opt.port = 0;
+  opt.speed = 1;
+  opt.gap = 1000;
+  opt.loops = 1;
+  for (int i = 1; i < ac; i++) {
+    std::string arg = av[i];
+    if (arg[0] != '-') {
+      opt.path = arg;
+      continue;
+    }
+    if (i + 1 >= ac) usage();
+    std::string value = av[++i];
+    if (arg == "-h")
+      opt.host = value;
+    else if (arg == "-p")
+      opt.port = atoi(value.c_str());
+    else if (arg == "-s")
+      opt.speed = atof(value.c_str());
+    else if (arg == "-g")
+      opt.gap = strtoul(value.c_str(), NULL, 10);
+    else if (arg == "-l")
+      opt.loops = atoi(value.c_str());
+    else
+      usage();
+  }
+  if (opt.path.empty() || opt.speed < 0 || opt.loops < 1) usage();
+  return opt;
+}
+
+static std::vector<Record> loadCapture(const std::string &path) {
+  std::ifstream file(path.c_str(), std::ios::binary);
+  std::vector<Record> records;
+  char magic[sizeof(CAPTURE_MAGIC)];
+  unsigned char head[CAPTURE_RECORD_HEAD];
+
+  if (file.read(magic, sizeof(magic)).good() == false ||
+      memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0)
+    throw std::runtime_error(path + ": not a capture file");
+  while (file.read(reinterpret_cast<char *>(head), sizeof(head)).good()) {
+    Record record;
+    record.id = getUint(head, 4);
+    record.type = head[4];
+    record.usec = getUint(head + 5, 8);
+    record.data.resize(getUint(head + 13, 4));
+    record.seq = records.size();
+    if (record.data.empty() == false &&
+        file.read(&record.data[0], record.data.size()).good() == false)
+      break;  // cut off while the server was writing it
+    records.push_back(record);
+  }
+  return records;
+}
+
+static int connectServer(const Options &opt, int port) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+
+  if (fd == -1) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ==
+      -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+struct Totals {
+  size_t conns;
+  size_t errors;
+  size_t writes;
+  size_t sent;
+  size_t received;
+};
+
+// reads the responses of every open connection until timeout msec pass
+static void drain(std::map<unsigned int, Conn> &conns, int timeout,
+                  unsigned long loopStart, Totals &totals) {
+  std::vector<struct pollfd> fds;
+  std::vector<unsigned int> ids;
+  char buf[65536];
+
+  for (std::map<unsigned int, Conn>::iterator it = conns.begin();
+       it != conns.end(); it++) {
+    if (it->second.fd == -1) continue;
+    struct pollfd pfd = {it->second.fd, POLLIN, 0};
+    fds.push_back(pfd);
+    ids.push_back(it->first);
+  }
+  if (fds.empty()) {
+    if (timeout > 0) usleep(timeout * 1000);
+    return;
+  }
+  if (poll(&fds[0], fds.size(), timeout) <= 0) return;
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (fds[i].revents == 0) continue;
+    Conn &conn = conns[ids[i]];
+    ssize_t n = read(conn.fd, buf, sizeof(buf));
+    if (n > 0) {
+      totals.received += n;
+      conn.lastRecv = nowUsec() - loopStart;
+    } else {
+      close(conn.fd);
+      conn.fd = -1;
+    }
+  }
+}
+
+// the next record to send: the first one in file order that is due, or the
+// one that gets due first. due is usec since the replay started
+static Conn *nextConn(std::map<unsigned int, Conn> &conns, const Options &opt,
+                      unsigned long now, unsigned long &due) {
+  Conn *next = NULL;
+  size_t nextSeq = 0;
+
+  for (std::map<unsigned int, Conn>::iterator it = conns.begin();
+       it != conns.end(); it++) {
+    Conn &conn = it->second;
+    if (conn.pending.empty()) continue;
+    const Record &record = conn.pending.front();
+    unsigned long at = 0;
+    if (opt.speed > 0)
+      at = static_cast<unsigned long>(record.usec / opt.speed);
+    else if (record.type == CAPTURE_DATA && conn.lastSend > 0)
+      at = conn.lastSend + opt.gap;
+    else if (record.type == CAPTURE_CLOSE)
+      at = std::max(conn.lastSend, conn.lastRecv) + CLOSE_IDLE_USEC;
+    bool isBetter;
+    if (next == NULL)
+      isBetter = true;
+    else if (at <= now)
+      isBetter = due > now || record.seq < nextSeq;
+    else
+      isBetter = due > now && at < due;
+    if (isBetter) {
+      next = &conn;
+      due = at;
+      nextSeq = record.seq;
+    }
+  }
+  return next;
+}
+
+static void sendRecord(Conn &conn, const Options &opt, unsigned long now,
+                       Totals &totals) {
+  Record record = conn.pending.front();
+
+  conn.pending.pop_front();
+  if (record.type == CAPTURE_OPEN) {
+    conn.port = opt.port ? opt.port
+                         : static_cast<int>(getUint(
+                               reinterpret_cast<const unsigned char *>(
+                                   record.data.c_str()),
+                               2));
+    conn.fd = connectServer(opt, conn.port);
+    totals.conns++;
+    if (conn.fd == -1) totals.errors++;
+  } else if (conn.fd == -1) {
+    return;  // the server closed it earlier than in the capture
+  } else if (record.type == CAPTURE_DATA) {
+    ssize_t n = write(conn.fd, record.data.c_str(), record.data.size());
+    if (n != static_cast<ssize_t>(record.data.size())) {
+      totals.errors++;
+      return;
+    }
+    totals.writes++;
+    totals.sent += n;
+  } else if (conn.isShut == false) {
+    shutdown(conn.fd, SHUT_WR);  // responses are still read
+    conn.isShut = true;
+  }
+  conn.lastSend = now;
+}
+
+static bool isLoopback(const std::string &host) {
+  struct in_addr addr;
+
+  if (inet_pton(AF_INET, host.c_str(), &addr) != 1) return false;
+  return (ntohl(addr.s_addr) >> 24) == 127;
+}
+
+int main(int ac, char **av) {
+  Options opt = parseOptions(ac, av);
+
+  if (isLoopback(opt.host) == false) {
+    std::cerr << "replay: only loopback addresses are allowed" << std::endl;
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  try {
+    std::vector<Record> records = loadCapture(opt.path);
+    Totals totals = {0, 0, 0, 0, 0};
+    unsigned long start = nowUsec();
+
+    for (int loop = 0; loop < opt.loops; loop++) {
+      std::map<unsigned int, Conn> conns;
+      for (size_t i = 0; i < records.size(); i++) {
+        if (conns.find(records[i].id) == conns.end()) {
+          Conn conn;
+          conn.fd = -1;
+          conn.port = 0;
+          conn.lastSend = 0;
+          conn.lastRecv = 0;
+          conn.isShut = false;
+          conns[records[i].id] = conn;
+        }
+        conns[records[i].id].pending.push_back(records[i]);
+      }
+      unsigned long loopStart = nowUsec();
+      unsigned long due = 0;
+      unsigned long now = 1;  // lastSend 0 means nothing was sent yet
+      Conn *conn;
+      while ((conn = nextConn(conns, opt, now, due)) != NULL) {
+        if (due > now) {
+          drain(conns, (due - now) / 1000, loopStart, totals);
+          now = nowUsec() - loopStart + 1;
+          continue;
+        }
+        sendRecord(*conn, opt, now, totals);
+        drain(conns, 0, loopStart, totals);
+        now = nowUsec() - loopStart + 1;
+      }
+      // the last responses, a connection that stays silent for 1s is done
+      for (int idle = 0; idle < 10; idle++) {
+        size_t received = totals.received;
+        drain(conns, 100, loopStart, totals);
+        if (received != totals.received) idle = 0;
+      }
+      for (std::map<unsigned int, Conn>::iterator it = conns.begin();
+           it != conns.end(); it++)
+        if (it->second.fd != -1) close(it->second.fd);
+    }
+    double elapsed = (nowUsec() - start) / 1e6;
+    std::cout << "{\"capture\":\"" << opt.path << "\",\"speed\":" << opt.speed
+              << ",\"loops\":" << opt.loops << ",\"records\":"
+              << records.size() << ",\"connections\":" << totals.conns
+              << ",\"writes\":" << totals.writes
+              << ",\"bytes_sent\":" << totals.sent
+              << ",\"bytes_received\":" << totals.received
+              << ",\"errors\":" << totals.errors << ",\"seconds\":" << elapsed
+              << "}" << std::endl;
+    return totals.errors > 0 ? 1 : 0;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
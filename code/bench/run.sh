@@ -0,0 +1,46 @@
+#!/bin/sh
+# runs every scenario against bench/bench.conf on loopback and appends one
+# json line per scenario to $BENCH_OUT (bench/results.jsonl)
+# BENCH_THREADS and BENCH_SECONDS change the load of each scenario,
+# BENCH_SERVER runs another binary than ./WebServ
+cd "$(dirname "$0")/.." || exit 1
+
+PORT=8180
+THREADS=${BENCH_THREADS:-4}
+SECONDS_EACH=${BENCH_SECONDS:-5}
+OUT=${BENCH_OUT:-bench/results.jsonl}
+SERVER_BIN=${BENCH_SERVER:-./WebServ}
+LOADGEN="./bench/loadgen -p $PORT -t $THREADS -d $SECONDS_EACH -o $OUT"
+
+mkdir -p bench/www/upload
+cp www/index.html bench/www/index.html
+dd if=/dev/zero of=bench/www/large.bin bs=1048576 count=8 2>/dev/null
+: > bench/www/upload/sink
+: > "$OUT"
+
+$SERVER_BIN bench/bench.conf > bench/server.log 2>&1 &
+SERVER=$!
+# SIGTERM lets the server exit on its own, an instrumented build writes its
+# profile then
+trap 'kill $SERVER 2>/dev/null; wait $SERVER; rm -rf bench/www' EXIT INT TERM
+
+tries=0
+until ./bench/loadgen -p $PORT -t 1 -d 1 -n warmup > /dev/null 2>&1; do
+  tries=$((tries + 1))
+  if [ $tries -ge 50 ] || ! kill -0 $SERVER 2>/dev/null; then
+    echo "bench: server did not start, see bench/server.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+$LOADGEN -n small_get_keepalive -u /index.html
+$LOADGEN -n small_get_close -u /index.html -k 0
+$LOADGEN -n large_file -u /large.bin
+$LOADGEN -n pipelined -u /index.html -P 16
+$LOADGEN -n chunked_post -m POST -u /upload/sink -b 4096 -C
+: > bench/www/upload/sink
+$LOADGEN -n cgi_post -m POST -u /python-cgi/calculator.py -b 64 -t 2
+$LOADGEN -n not_found_storm -u /does/not/exist.html
+
+echo "bench: results in $OUT"
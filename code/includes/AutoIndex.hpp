@@ -0,0 +1,62 @@
+#ifndef AUTOINDEX_HPP
+#define AUTOINDEX_HPP
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Utils.hpp"
+
+#define AUTOINDEX_CACHE_SIZE 64  // directories kept in the listing cache
+#define AUTOINDEX_CHUNK 32768    // listing bytes generated per chunk
+
+struct DirEntry {
+  std::string name;
+  bool isDir;
+  off_t size;
+  std::time_t mtime;
+};
+
+// sorted entries of a directory, cached until the directory's mtime changes.
+// a listing in use by a response is kept alive until it is released
+class AutoIndex {
+ private:
+  std::string _path;
+  std::time_t _mtime;
+  std::time_t _readTime;
+  std::vector<DirEntry> _entries;
+  int _refCnt;
+  bool _isCached;
+  static std::map<std::string, AutoIndex *> _cache;  // key: directory path
+  static std::list<std::string> _lru;                // least recent first
+
+  AutoIndex(const std::string &path, std::time_t mtime);
+  bool readEntries();
+  bool isCurrent(std::time_t mtime) const;
+  static void uncache(const std::string &path);
+  static std::string escapeHtml(const std::string &str);
+  static std::string escapeUri(const std::string &str);
+  static std::string escapeJson(const std::string &str);
+
+ public:
+  ~AutoIndex();
+
+  static AutoIndex *acquire(const std::string &path);
+  static void release(AutoIndex *index);
+
+  std::string makeHead(const std::string &uri, bool isJson) const;
+  size_t makeEntries(std::string &out, size_t pos, bool isJson) const;
+  std::string makeTail(bool isJson) const;
+  size_t size() const;
+};
+
+#endif
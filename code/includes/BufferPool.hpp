@@ -0,0 +1,26 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <string>
+#include <vector>
+
+#define BUFFER_CHUNK 16384     // bytes asked from one read()
+#define BUFFER_POOL_MAX 64     // free buffers kept, more are freed
+#define READ_BUDGET 262144     // bytes read for one event before others run
+
+// read buffers of the clients and cgi pipes. the bytes are read straight
+// into the buffer the parser works on, an idle keep-alive client gives it
+// back so it only keeps its empty Request
+class BufferPool {
+ private:
+  std::vector<std::string> _free;  // empty, capacity of one chunk
+
+ public:
+  BufferPool();
+  ~BufferPool();
+
+  void acquire(std::string &buf);
+  void release(std::string &buf);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ctime>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#define CAPTURE_MAGIC "WSCAP1\n"     // 8 bytes with the terminating NUL
+#define CAPTURE_RECORD_HEAD 17       // id 4, type 1, usec 8, length 4
+#define CAPTURE_BUFFER_SIZE 262144   // written out when it gets this big
+#define CAPTURE_FLUSH_INTERVAL 1     // seconds a record may wait in memory
+
+enum e_captureType {
+  CAPTURE_OPEN,   // data: listen port, 2 bytes
+  CAPTURE_DATA,   // data: bytes of one read() of the client socket
+  CAPTURE_CLOSE
+};
+
+// capture_file writes the inbound bytes of every client, one record per
+// read, so bench/replay can send them again with the same read boundaries.
+// numbers are big endian, usec counts from the start of the capture:
+//   record: conn id u32, type u8, usec u64, length u32, data
+class Capture {
+ private:
+  int _fd;
+  std::string _buffer;
+  unsigned long _start;
+  std::time_t _lastFlush;
+  unsigned int _nextId;
+  std::map<int, unsigned int> _connIds;  // key: client socket
+
+  void addRecord(unsigned int id, e_captureType type, const char *data,
+                 size_t size);
+
+ public:
+  Capture(const std::string &path);
+  ~Capture();
+
+  void open(int clientSock, int port);
+  void data(int clientSock, const char *data, size_t size);
+  void close(int clientSock);
+  void flush(bool force);
+  bool hasPending() const;
+};
+
+#endif
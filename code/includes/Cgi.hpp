@@ -14,6 +14,7 @@
 #include "ErrorException.hpp"
 #include "Utils.hpp"
 #include "Kqueue.hpp"
+#include "Response.hpp"
 #include <netdb.h>
 #include <sys/types.h>
 #include <cstring>
@@ -34,7 +35,7 @@ class Cgi {
   // client's request를 받아서 execve에 사용할 _envp를 생성
   void reqToEnvp(std::map<std::string, std::string> param, int &clientFd);
   // _envp, body(parsing)를 받아서 cgi를 실행
-  int execute(const std::string& body, Kqueue &kq, int &clientFd);
+  int execute(Request &req, Response &res, Kqueue &kq, int &clientFd);
 };
 
 #endif
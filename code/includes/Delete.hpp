@@ -10,6 +10,7 @@ class Delete : public Method {
   ~Delete();
 
   void process(Request &request, Response &response);
+  bool isFileWork(Request &request);
   void makeStatusLine(Request &request, Response &response);
 };
 
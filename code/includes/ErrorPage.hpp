@@ -0,0 +1,34 @@
+#ifndef ERRORPAGE_HPP
+#define ERRORPAGE_HPP
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// status line + fixed headers + body, serialized once at startup.
+// only Date, Content-Length (and Location for redirects) are added per response
+class ErrorPage {
+ private:
+  std::string _head;
+  std::string _body;
+  static std::map<int, ErrorPage> _defaults;
+
+  static std::string makeDefaultBody(int statusCode);
+
+ public:
+  ErrorPage();
+  ErrorPage(int statusCode, const std::string &type, const std::string &body);
+  ~ErrorPage();
+
+  static ErrorPage load(int statusCode, const std::string &path);
+  static void loadDefaults();
+  static const ErrorPage &getDefault(int statusCode);
+
+  const std::string &getHead() const;
+  const std::string &getBody() const;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef EVENT_HPP
+#define EVENT_HPP
+
+// the loop speaks kevent. linux has no kqueue, there Kqueue runs on a
+// Poller (io_uring or epoll) that takes and returns the same structs
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/types.h>
+
+struct kevent {
+  uintptr_t ident;
+  int16_t filter;
+  uint16_t flags;
+  uint32_t fflags;
+  intptr_t data;
+  void *udata;
+};
+
+#define EV_SET(kevp, a, b, c, d, e, f) \
+  do {                                 \
+    struct kevent *ev_ = (kevp);       \
+    ev_->ident = (a);                  \
+    ev_->filter = (b);                 \
+    ev_->flags = (c);                  \
+    ev_->fflags = (d);                 \
+    ev_->data = (e);                   \
+    ev_->udata = (f);                  \
+  } while (0)
+
+// the filters and flags the loop uses, with their values on the BSDs
+#define EVFILT_READ (-1)
+#define EVFILT_WRITE (-2)
+#define EVFILT_SIGNAL (-6)
+#define EVFILT_TIMER (-7)
+#define EV_ADD 0x0001
+#define EV_DELETE 0x0002
+#define EV_ENABLE 0x0004
+#define EV_DISABLE 0x0008
+#define EV_ERROR 0x4000
+#else
+#include <sys/event.h>
+#endif
+
+#endif
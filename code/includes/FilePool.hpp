@@ -0,0 +1,49 @@
+#ifndef FILEPOOL_HPP
+#define FILEPOOL_HPP
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <deque>
+#include <vector>
+
+#define FILE_TASK_MAX 1024  // tasks in flight, more run on the event loop
+
+// blocking work handed to a file thread. run() may only touch what the
+// task owns, the loop leaves it alone until the task comes back
+class FileTask {
+ public:
+  virtual ~FileTask() {}
+  virtual void run() = 0;
+};
+
+// file_threads threads for the open/stat/read/write/unlink/readdir calls of
+// the handlers. a finished task is written to a pipe whose read end the
+// loop watches as FD_TASK, so completions come in as ordinary read events
+class FilePool {
+ private:
+  std::vector<pthread_t> _threads;
+  std::deque<FileTask *> _queue;  // waiting for a thread
+  pthread_mutex_t _lock;
+  pthread_cond_t _cond;
+  bool _isStopping;
+  int _pipe[2];        // a pointer per finished task, [0] is the loop's
+  size_t _inFlight;    // pushed and not popped yet, only the loop counts
+
+  static void *work(void *arg);
+
+ public:
+  FilePool();
+  ~FilePool();
+
+  bool start(size_t threadCnt);
+  bool push(FileTask *task);
+  void popFinished(std::vector<FileTask *> &tasks);
+  int getFd() const;
+  size_t getThreadCount() const;
+  size_t getInFlight() const;
+};
+
+#endif
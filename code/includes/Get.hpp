@@ -1,13 +1,34 @@
 #ifndef GET_HPP
 #define GET_HPP
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
 #include "ErrorException.hpp"
 #include "Method.hpp"
 
+#define MAX_RANGES 16  // more ranges than this and the whole file is sent
+
 class Get : public Method {
  private:
-  void makeBody(Response &response, std::ifstream &file);
-  void makeHeader(Request &request, Response &response);
+  std::string _etag;
+  std::string _lastModified;
+
+  void makeGzipResponse(Request &request, Response &response);
+  bool isAcceptGzip(Request &request);
+  std::string setGzipBody(Request &request, Response &response,
+                          std::ifstream &file);
+  std::string getContentType(Request &request);
+  void setCacheHeaders(Request &request, Response &response,
+                       struct stat &info);
+  bool isNotModified(Request &request);
+  bool isIfRangeMatch(Request &request);
+  int makeRangeParts(const std::string &range, off_t size,
+                     const std::string &contentType,
+                     std::vector<FilePart> &parts, Response &response);
+  void makeFileResponse(Request &request, Response &response,
+                        const std::string &filePath);
   void makeResponse(Request &request, Response &response, std::ifstream &file);
 
  public:
@@ -15,6 +36,7 @@ class Get : public Method {
   ~Get();
 
   void process(Request &request, Response &response);
+  bool isFileWork(Request &request);
 };
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstddef>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_CNT (1 << HIST_SUB_BITS)  // linear buckets per power of two
+#define HIST_BUCKETS (40 * HIST_SUB_CNT)   // values up to 2^43 usec
+
+// log-linear (HDR style) histogram of microseconds, 1/16 relative precision
+class Histogram {
+ private:
+  size_t _counts[HIST_BUCKETS];
+  size_t _total;
+  unsigned long _max;
+
+  static size_t bucketOf(unsigned long value);
+  static unsigned long valueOf(size_t bucket);
+
+ public:
+  Histogram();
+  ~Histogram();
+
+  void record(unsigned long value);
+  unsigned long percentile(double percent) const;
+  size_t getCount() const;
+  unsigned long getMax() const;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef HPACK_HPP
+#define HPACK_HPP
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define HPACK_TABLE_SIZE 4096  // SETTINGS_HEADER_TABLE_SIZE default
+
+// name and value, the same pair as the HeaderList of a Response
+typedef std::pair<std::string, std::string> HeaderField;
+
+// a node of the huffman decoding tree, sym is -1 for inner nodes
+struct HuffmanNode {
+  int child[2];
+  int sym;
+};
+
+// header compression of http2 (RFC 7541). one direction of a connection,
+// the decoder and the encoder each keep their own dynamic table
+class Hpack {
+ private:
+  std::deque<HeaderField> _table;  // dynamic table, newest first
+  size_t _size;      // entry sizes, 32 bytes more than name and value
+  size_t _maxSize;   // current max, lowered by a size update
+  size_t _limit;     // SETTINGS_HEADER_TABLE_SIZE, the max of the max
+  bool _isResized;   // encoder: the next block starts with a size update
+  static std::vector<HuffmanNode> _huffmanTree;
+
+  static std::vector<HuffmanNode> initHuffmanTree();
+  void evict(size_t room);
+  void insert(const HeaderField &field);
+  const HeaderField *getField(size_t index) const;
+  size_t findField(const HeaderField &field, bool &isFullMatch) const;
+  static bool isIndexable(const std::string &name);
+  static bool decodeInt(const std::string &block, size_t &pos, int prefix,
+                        size_t &value);
+  static bool decodeString(const std::string &block, size_t &pos,
+                           std::string &str);
+  static bool decodeHuffman(const char *data, size_t size, std::string &str);
+  static void encodeInt(std::string &block, uint8_t flags, int prefix,
+                        size_t value);
+  static void encodeString(std::string &block, const std::string &str);
+
+ public:
+  Hpack();
+
+  bool decode(const std::string &block, std::vector<HeaderField> &fields);
+  void encode(const std::vector<HeaderField> &fields, std::string &block);
+  void setLimit(size_t limit);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef HTTP2_HPP
+#define HTTP2_HPP
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Hpack.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_SIZE 24
+#define H2_HEAD_SIZE 9        // of every frame
+#define H2_FRAME_MAX 16384    // SETTINGS_MAX_FRAME_SIZE we accept
+#define H2_MAX_STREAMS 128    // SETTINGS_MAX_CONCURRENT_STREAMS we allow
+#define H2_WINDOW 1048576     // receive window of the connection and streams
+#define H2_BLOCK_MAX 65536    // a header block with its CONTINUATIONs
+#define H2_OUT_MAX 131072     // frames queued before the socket takes them
+
+enum e_h2Frame {
+  H2_DATA,
+  H2_HEADERS,
+  H2_PRIORITY,
+  H2_RST_STREAM,
+  H2_SETTINGS,
+  H2_PUSH_PROMISE,
+  H2_PING,
+  H2_GOAWAY,
+  H2_WINDOW_UPDATE,
+  H2_CONTINUATION
+};
+
+enum e_h2Error {
+  H2_NO_ERROR,
+  H2_PROTOCOL_ERROR,
+  H2_INTERNAL_ERROR,
+  H2_FLOW_CONTROL_ERROR,
+  H2_SETTINGS_TIMEOUT,
+  H2_STREAM_CLOSED,
+  H2_FRAME_SIZE_ERROR,
+  H2_REFUSED_STREAM,
+  H2_CANCEL,
+  H2_COMPRESSION_ERROR,
+  H2_CONNECT_ERROR,
+  H2_ENHANCE_YOUR_CALM
+};
+
+// a request of an http2 connection. its Request is fed the HTTP/1.1 form of
+// the frames and parsed like one read from a socket, a body as chunks
+struct H2Stream {
+  uint32_t id;
+  Request *req;
+  Response *res;       // NULL while reading, then the queue owns both
+  int64_t sendWindow;
+  size_t recvUnacked;  // DATA bytes not given back with WINDOW_UPDATE yet
+  bool isRemoteEnd;    // END_STREAM came, nothing more is read
+  bool isReady;        // the response can be sent
+  bool isHeadSent;
+  bool isReset;        // reset by the client, the response is dropped
+};
+
+// the frames of one http2 connection (RFC 9113). streams are answered in
+// any order, the loop hands in parsed requests and ready responses and
+// writes out what fill() queues
+class Http2 {
+ private:
+  std::string _clientIp;
+  std::map<uint32_t, H2Stream> _streams;
+  std::vector<uint32_t> _updated;      // streams whose request got bytes
+  std::vector<Response *> _finished;   // sent or dropped, freed by the loop
+  Hpack _decoder;
+  Hpack _encoder;
+  std::string _out;
+  size_t _outSent;
+  int64_t _sendWindow;
+  size_t _recvUnacked;
+  uint32_t _peerWindow;    // SETTINGS_INITIAL_WINDOW_SIZE of the client
+  uint32_t _peerFrameMax;  // SETTINGS_MAX_FRAME_SIZE of the client
+  uint32_t _lastId;        // highest stream the client opened
+  uint32_t _nextId;        // where fill() goes on, round robin
+  uint32_t _blockId;       // stream of the header block being read, 0 if none
+  bool _isBlockEnd;        // its HEADERS had END_STREAM
+  std::string _block;
+  bool _isPrefaceRead;
+  bool _isGoingAway;       // no new streams, after a GOAWAY either way
+  bool _isBroken;          // connection error, closed once GOAWAY is out
+
+  void putFrame(uint8_t type, uint8_t flags, uint32_t id, const char *payload,
+                size_t size);
+  void putPreface();
+  void putWindowUpdate(uint32_t id, size_t increment);
+  void putReset(uint32_t id, e_h2Error code);
+  void readFrame(uint8_t type, uint8_t flags, uint32_t id, const char *data,
+                 size_t size);
+  bool stripPadding(uint8_t flags, const char *&data, size_t &size);
+  void readData(uint8_t flags, uint32_t id, const char *data, size_t size);
+  void readHeaders(uint8_t flags, uint32_t id, const char *data, size_t size);
+  void readContinuation(uint8_t flags, uint32_t id, const char *data,
+                        size_t size);
+  void readBlock();
+  bool applySettings(const char *data, size_t size);
+  void readSettings(uint8_t flags, uint32_t id, const char *data,
+                    size_t size);
+  void readWindowUpdate(uint32_t id, const char *data, size_t size);
+  void readReset(uint32_t id, const char *data, size_t size);
+  H2Stream &addStream(uint32_t id, Request *req);
+  void openStream(uint32_t id, const std::vector<HeaderField> &fields,
+                  bool isEnd);
+  void endBody(H2Stream &stream);
+  void cancel(H2Stream &stream);
+  void finish(H2Stream &stream, e_h2Error code);
+  bool sendHead(H2Stream &stream);
+  bool sendData(H2Stream &stream);
+  bool canSend(const H2Stream &stream) const;
+
+ public:
+  Http2(const std::string &clientIp);
+  ~Http2();
+
+  static int matchPreface(const std::string &raw);
+  void start();
+  bool upgrade(Request *req);
+  size_t receive(const char *data, size_t size);
+  void popUpdated(std::vector<uint32_t> &ids);
+  Request *getRequest(uint32_t id);
+  void setResponse(uint32_t id, Response *res);
+  void setReady(Response *res);
+  void fill();
+  void popFinished(std::vector<Response *> &responses);
+  void goAway(e_h2Error code);
+  const char *getOutData() const;
+  size_t getOutSize() const;
+  void addSent(size_t size);
+  bool wantsWrite() const;
+  bool isDone() const;
+  bool isIdle() const;
+  size_t getMemorySize() const;
+};
+
+#endif
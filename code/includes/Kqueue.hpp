@@ -3,17 +3,21 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
-#include <sys/event.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <list>
 #include <map>
+#include <string>
 #include <vector>
 
+#include "Event.hpp"
+#include "Poller.hpp"
 #include "Server.hpp"
 
 #define MAX_EVENTS 1000
@@ -23,19 +27,64 @@ typedef enum {
     FD_SERVER,
     FD_CLIENT,
     FD_CGI,
+    FD_TASK,  // finished file tasks, see FilePool
+    FD_UPSTREAM,  // proxy_pass connection, in use or idle in the pool
 } e_fdGroup;
 
 class Server;
+class Request;
+class Response;
+class Http2;
+class Tls;
+class Proxy;
+struct MethodTask;
 // key: server socket, value: Server class
 typedef std::map<int, Server *> ServerMap;
+// pipelined requests of a client and their responses, sent in this order
+typedef std::deque<std::pair<Request *, Response *> > ResponseQueue;
+
+// everything the loop keeps for an open fd. the slot of an fd is reused by
+// the next fd with that number and its address is the udata of the events
+struct Connection {
+    int fd;
+    e_fdGroup type;
+    // client
+    Server *server;     // listening socket it was accepted on
+    Request *req;       // request being read
+    ResponseQueue queue;
+    size_t reqCount;
+    unsigned long acceptTime;  // until the first byte is read, then 0
+    bool isIdle;
+    std::list<Connection *>::iterator idlePos;
+    std::vector<int> cgiPipes;  // open pipes of its running cgis
+    std::vector<int> upstreams;  // upstream sockets of its proxied requests
+    size_t memory;      // bytes of its requests and responses
+    bool isPaused;      // reads stopped by memory_budget
+    MethodTask *task;   // handler on a file thread, NULL if none
+    Http2 *h2;          // NULL on HTTP/1.1
+    Tls *tls;           // NULL on plain tcp
+    // cgi pipe
+    int client;         // -1 once the client is gone
+    pid_t pid;
+    size_t written;     // request body bytes written to the cgi
+    Request *cgiReq;    // the request it runs for, owned by the client
+    Response *cgiRes;
+    int peer;           // the other pipe of the cgi, -1 once closed
+    // upstream, client too
+    Proxy *proxy;       // the exchange on it, NULL while idle in the pool
+
+    void reset(int fd, e_fdGroup type);
+};
 
 class Kqueue {
   private:
+#ifdef __linux__
+    Poller *_poller;  // kevent() for linux
+#else
     int _kq;
+#endif
     std::vector<struct kevent> *_checkList;
-    struct fd_set _fdServer;
-    struct fd_set _fdClient;
-    struct fd_set _fdCGI;
+    std::vector<Connection *> _slots;  // index: fd, NULL until first used
     struct kevent
         _eventList[MAX_EVENTS]; // kevent array for saving event infomation
 
@@ -43,15 +92,20 @@ class Kqueue {
     Kqueue();
     ~Kqueue();
 
-    int init(ServerMap serverMap);
+    int init(ServerMap serverMap, const std::string &method);
     void changeEvents(uintptr_t ident, int16_t filter, uint16_t flags,
                       uint32_t fflags, intptr_t data, void *udata);
-    int countEvents();
+    int countEvents(const struct timespec *timeout);
     void clearCheckList();
+    size_t getCheckListSize() const;
     struct kevent *getEventList();
-    void setFdGroup(int fd, e_fdGroup fdGroup);
-    void eraseFdGroup(int fd, e_fdGroup fdGroup);
-    e_fdGroup getFdGroup(int fd);
+    int accept(int fd, sockaddr_in *addr);
+    bool attach(int fd);
+    size_t getHeldSize() const;
+    Connection *openConn(int fd, e_fdGroup type);
+    void closeConn(Connection *conn);
+    Connection *getConn(int fd);
+    size_t getSlotCount() const;
 };
 
 #endif
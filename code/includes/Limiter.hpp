@@ -0,0 +1,61 @@
+#ifndef LIMITER_HPP
+#define LIMITER_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#define LIMIT_TOKEN 1000  // a request, tokens are counted in 1/1000
+
+// the state of one key of a limit_req or limit_conn. the nodes are chained
+// in their hash bucket and listed from the most to the least recently used
+struct LimitNode {
+  uint64_t hash;    // of the zone and the key
+  int64_t tokens;   // limit_req, below 0 the burst is in use
+  uint64_t last;    // usec the tokens were counted at, 0 for a new key
+  uint32_t conns;   // limit_conn, requests in progress
+  int32_t prev;     // more recently used, -1 at the head
+  int32_t next;     // less recently used, -1 at the tail
+  int32_t chain;    // next node of the bucket, -1 at the end
+};
+
+// limit_req and limit_conn of a worker in limit_zone_size bytes, taken on
+// the first use. once every node is used a new key takes the node of the
+// least recently used one, a key evicted with requests in progress starts
+// again from none
+class Limiter {
+ private:
+  size_t _size;  // bytes, limit_zone_size
+  std::vector<LimitNode> _nodes;
+  std::vector<int32_t> _buckets;  // first node of a bucket, -1 if none
+  size_t _used;                   // nodes taken so far
+  int32_t _head;
+  int32_t _tail;
+  size_t _delayCnt;       // requests held back within the burst
+  size_t _reqRejectCnt;   // requests over limit_req
+  size_t _connRejectCnt;  // requests over limit_conn
+  size_t _evictCnt;       // keys dropped to make room
+
+  LimitNode *find(uint64_t hash, bool isAdded);
+  void unlink(int32_t idx);
+  void unchain(int32_t idx);
+
+ public:
+  Limiter();
+  ~Limiter();
+
+  void setSize(size_t size);
+  static uint64_t makeHash(int zone, const std::string &key);
+  bool take(uint64_t hash, size_t rate, size_t burst, bool isNodelay,
+            uint64_t now, uint64_t &wait);
+  bool acquire(uint64_t hash, size_t limit);
+  void release(uint64_t hash);
+  size_t getDelayCnt() const;
+  size_t getReqRejectCnt() const;
+  size_t getConnRejectCnt() const;
+  size_t getEvictCnt() const;
+  size_t getKeyCnt() const;
+};
+
+#endif
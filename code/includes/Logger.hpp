@@ -0,0 +1,92 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <ctime>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Utils.hpp"
+
+#define LOG_BUFFER_SIZE 65536  // a buffer is written out when it gets this big
+#define LOG_FLUSH_INTERVAL 1   // seconds a line may wait in the buffer
+
+enum e_logLevel {
+  LEVEL_DEBUG,
+  LEVEL_INFO,
+  LEVEL_NOTICE,
+  LEVEL_WARN,
+  LEVEL_ERROR,
+  LEVEL_CRIT
+};
+
+// variables of a log_format
+enum e_logVar {
+  VAR_NONE,  // literal text
+  VAR_REMOTE_ADDR,
+  VAR_TIME_LOCAL,
+  VAR_REQUEST,
+  VAR_METHOD,
+  VAR_URI,
+  VAR_HOST,
+  VAR_STATUS,
+  VAR_BYTES_SENT,
+  VAR_REQUEST_TIME,
+  VAR_REFERER,
+  VAR_USER_AGENT
+};
+
+struct LogToken {
+  e_logVar var;
+  std::string text;
+};
+
+typedef std::vector<LogToken> LogFormat;
+
+// lines are kept in memory and written by the event loop, once a buffer is
+// full or LOG_FLUSH_INTERVAL has passed. one file is shared by every user.
+// file threads log too, one lock guards the buffers and the time strings
+class Logger {
+ private:
+  std::string _path;  // empty is stderr
+  int _fd;
+  std::string _buffer;
+  std::time_t _lastFlush;
+  static std::map<std::string, Logger *> _loggers;  // key: path
+  static std::map<std::string, LogFormat> _formats;  // key: format name
+  static Logger *_errorLog;
+  static e_logLevel _errorLevel;
+
+  Logger(const std::string &path);
+  void open();
+  void flush();
+  void push(const std::string &line);
+  static e_logLevel parseLevel(const std::string &level);
+  static LogFormat parseFormat(const std::string &format);
+  static std::map<std::string, LogFormat> initFormats();
+
+ public:
+  ~Logger();
+
+  static Logger *get(const std::string &path);
+  static void setErrorLog(const std::string &value);
+  static void addFormat(const std::string &value);
+  static const LogFormat &getFormat(const std::string &name);
+  static bool isLogged(e_logLevel level);
+  static void log(e_logLevel level, const std::string &msg);
+  static void log(e_logLevel level, const std::string &msg, int value);
+  static void flushAll(bool force);
+  static bool hasPending();
+  static void reopenAll();
+  static std::string getTimeLocal();
+
+  void append(const std::string &line);
+};
+
+#endif
@@ -11,6 +11,7 @@ class Method : public IMethod {
  public:
   virtual ~Method();
   virtual void process(Request &request, Response &response);
+  virtual bool isFileWork(Request &request);
 };
 
 #endif
@@ -0,0 +1,245 @@
+#ifndef POLLER_HPP
+#define POLLER_HPP
+
+#ifdef __linux__
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Event.hpp"
+
+// io_uring needs IORING_ENTER_EXT_ARG (linux 5.11) for its wait timeout
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#ifdef IORING_ENTER_EXT_ARG
+#define HAS_IO_URING
+#endif
+// client sockets by completions: multishot recv (linux 6.0, headers with
+// it have the ring of provided buffers too)
+#if defined(HAS_IO_URING) && defined(IORING_RECV_MULTISHOT)
+#define HAS_RING_IO
+#endif
+
+#define URING_ENTRIES 1024  // submission queue size, the completion queue
+                            // gets twice as many
+#define RING_BUFS 256         // provided buffers the sockets receive into
+#define RING_BUF_SIZE 16384   // bytes of one
+#define RING_FD_BUFS 16       // a socket holding more stops receiving
+#define RING_SEND_MAX 262144  // bytes of a socket queued and in flight
+#define RING_LINGER 10000     // msec a closed socket has to send the rest
+
+// kqueue semantics for Kqueue on linux: level triggered read and write
+// filters with a udata each, periodic msec timers by ident and signals.
+// timers live in memory and signals come through one signalfd, the
+// backends only watch the fds
+class Poller {
+ protected:
+  struct Timer {
+    unsigned long deadline;  // msec, monotonic
+    unsigned long period;
+    void *udata;
+  };
+  struct Filters {
+    bool isOn[2];  // [0] read, [1] write
+    void *udata[2];
+  };
+  std::vector<Filters> _fds;  // index: fd
+  std::map<uintptr_t, Timer> _timers;
+  std::set<std::pair<unsigned long, uintptr_t> > _deadlines;
+  std::vector<struct kevent> _errors;  // of changes, returned first
+  int _signalFd;
+  sigset_t _signals;
+
+  Poller();
+  Filters &getFilters(int fd);
+  void setFilter(const struct kevent &change);
+  void setTimer(const struct kevent &change);
+  void addSignal(int sig);
+  int expireTimers(struct kevent *events, int size);
+  int readSignals(struct kevent *events, int size);
+  int getWaitMsec(const struct timespec *timeout);
+  virtual int update(int fd) = 0;  // errno if the fd cannot be watched
+  virtual int wait(struct kevent *events, int size, int msec) = 0;
+
+ public:
+  virtual ~Poller();
+
+  static Poller *create(const std::string &method);
+  virtual const char *getName() const = 0;
+  int kevent(const struct kevent *changes, int changeCnt,
+             struct kevent *events, int eventCnt,
+             const struct timespec *timeout);
+  void forget(int fd);
+  virtual void listen(int fd);
+  virtual int accept(int fd, struct sockaddr_in *addr);
+  virtual bool attach(int fd);
+  virtual size_t getHeldSize() const;
+};
+
+// one epoll_ctl() per changed fd, then epoll_wait()
+class EpollPoller : public Poller {
+ private:
+  int _epfd;
+  std::vector<uint32_t> _masks;  // index: fd, what epoll watches now
+
+  int update(int fd);
+  int wait(struct kevent *events, int size, int msec);
+
+ public:
+  EpollPoller();
+  ~EpollPoller();
+
+  bool init();
+  const char *getName() const;
+};
+
+#ifdef HAS_IO_URING
+// a oneshot poll per enabled filter, armed again after it fires so the
+// filters stay level triggered. the changes and the re-arms of an
+// iteration go to the kernel with the wait in one io_uring_enter().
+// with HAS_RING_IO the listening sockets take a multishot accept and the
+// attached client sockets a multishot recv and sends instead of polls.
+// their filters fire from what the completions left, sockRead() and
+// sockWrite() of Tls.hpp copy from and to it without a syscall
+class UringPoller : public Poller {
+ private:
+  struct Arm {
+    bool isArmed[2];
+    uint32_t gen[2];  // a completion of an older poll is stale
+  };
+  struct Chunk {
+    uint16_t bid;  // provided buffer
+    uint32_t len;
+    uint32_t offset;  // taken by recv() so far
+  };
+  // bytes to send, or a file range read into data first
+  struct Piece {
+    std::string data;
+    size_t filled;  // of data, the rest comes from the file
+    int fileFd;     // -1 once it is read
+    off_t offset;   // in the file of the rest
+  };
+  // a socket whose accept, recv, send and close are ring operations. on the
+  // heap, the kernel uses its buffers while the table may grow
+  struct Stream {
+    bool isListener;
+    bool isAttached;
+    bool isClosing;       // closed once out is sent
+    uint32_t gen;         // a completion of an older socket is stale
+    bool isArmed;         // its accept or recv runs
+    bool isCancelled;     // and is asked to stop
+    std::deque<int> accepted;  // fds, -errno for a failed accept
+    std::deque<Chunk> in;
+    bool isEof;           // read to the end or failed
+    int error;            // a send or file read failed, the socket is broken
+    std::deque<Piece> out;  // the front one is sent, the first file one read
+    size_t outSize;       // bytes of out
+    size_t sent;          // of the front piece
+    bool isSending;
+    bool isReading;
+    unsigned long lingerEnd;  // msec, a closing socket gives up sending
+  };
+  int _ringFd;
+  void *_sqRing;
+  void *_cqRing;
+  size_t _sqRingSize;
+  size_t _cqRingSize;
+  struct io_uring_sqe *_sqes;
+  size_t _sqesSize;
+  unsigned *_sqHead;
+  unsigned *_sqTail;
+  unsigned _sqMask;
+  unsigned *_sqArray;
+  unsigned *_cqHead;
+  unsigned *_cqTail;
+  unsigned _cqMask;
+  struct io_uring_cqe *_cqes;
+  std::vector<Arm> _arms;     // index: fd
+  std::vector<int> _dirty;    // fds whose polls may not match their filters
+  std::vector<bool> _isDirty;
+#ifdef HAS_RING_IO
+  static UringPoller *_io;  // the ring of the attached sockets, if any
+  void *_bufRing;           // struct io_uring_buf_ring
+  char *_bufs;              // RING_BUFS of RING_BUF_SIZE
+  uint16_t _bufTail;
+  size_t _freeBufs;         // in the ring, the kernel may take them
+  size_t _outBytes;         // of the pieces of all streams
+  std::vector<Stream *> _streams;  // index: fd, NULL until first used
+  std::vector<int> _ready;    // streams whose filters may fire
+  std::vector<bool> _isReady;
+  std::vector<int> _starved;  // recvs that wait for a free buffer
+  std::set<std::pair<unsigned long, int> > _lingers;
+  std::map<int, int> _fileRefs;  // file fd: pieces that read from it
+  std::set<int> _closingFiles;   // closed once no piece reads from them
+  pthread_t _loopThread;
+#endif
+
+  Arm &getArm(int fd);
+  void markDirty(int fd);
+  struct io_uring_sqe *getSqe();
+  void syncPolls();
+  int enter(unsigned minComplete, int msec);
+  int update(int fd);
+  int reapPoll(const struct io_uring_cqe &cqe, struct kevent *event);
+  int wait(struct kevent *events, int size, int msec);
+#ifdef HAS_RING_IO
+  bool initBuffers();
+  bool probeRecv();
+  Stream &getStream(int fd);
+  bool isStream(int fd) const;
+  bool isFiring(int fd, int i) const;
+  bool hasReady() const;
+  void markReady(int fd);
+  void recycle(uint16_t bid);
+  size_t getSpace(const Stream &stream) const;
+  void syncStream(int fd);
+  void shut(int fd);
+  void closeFile(int fileFd);
+  void releaseFile(int fileFd);
+  void reapStream(const struct io_uring_cqe &cqe);
+  void expireLingers();
+  int collectReady(struct kevent *events, int size);
+#endif
+
+ public:
+  UringPoller();
+  ~UringPoller();
+
+  bool init();
+  const char *getName() const;
+#ifdef HAS_RING_IO
+  void listen(int fd);
+  int accept(int fd, struct sockaddr_in *addr);
+  bool attach(int fd);
+  size_t getHeldSize() const;
+  static UringPoller *getRing(int fd);
+  ssize_t recv(int fd, char *buf, size_t size);
+  ssize_t sendv(int fd, const struct iovec *iov, int iovCnt);
+  ssize_t sendFile(int fd, int fileFd, off_t offset, size_t size);
+  void closeSocket(int fd);
+  static bool fileClose(int fileFd);
+#endif
+};
+#endif
+
+#endif
+
+#endif
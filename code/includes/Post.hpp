@@ -15,6 +15,7 @@ class Post : public Method {
     ~Post();
 
     void process(Request &request, Response &response);
+    bool isFileWork(Request &request);
     std::string generateRandomString();
     void createResource(Response &response, std::string &fileName,
                         std::string &fullUri);
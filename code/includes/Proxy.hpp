@@ -0,0 +1,70 @@
+#ifndef PROXY_HPP
+#define PROXY_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "Request.hpp"
+#include "Response.hpp"
+
+#define PROXY_HEAD_MAX 65536     // response head of an upstream
+#define PROXY_LINE_MAX 4096      // chunk size line or trailer
+#define PROXY_BUFFER_MAX 262144  // relayed bytes a client may fall behind
+
+// how the upstream ends the body of its response
+enum e_proxyBody { BODY_NONE, BODY_LENGTH, BODY_CHUNKED, BODY_CLOSE };
+
+// where a chunked body is
+enum e_chunkStep { CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER };
+
+// a request forwarded to a proxy_pass upstream over HTTP/1.1 and the
+// response on its way back. the request goes out once it is complete, the
+// body of the response is relayed as it comes, unframed here and framed
+// again for the client by the Response
+class Proxy {
+ private:
+  Request &_req;
+  Response &_res;
+  std::string _out;  // request head
+  size_t _outSent;   // of the head, then of the body
+  std::string _in;   // response bytes not parsed yet
+  bool _isHeadRead;
+  e_proxyBody _body;
+  e_chunkStep _step;
+  size_t _remain;     // of the Content-Length or the chunk being read
+  bool _isEnd;        // the response is complete
+  bool _isKeepAlive;  // the connection can take another request after it
+  bool _isReused;     // the connection came from the pool
+  bool _hasReply;     // a byte of the response came
+  bool _isPaused;     // not read while the client is behind
+
+  void makeHead(bool isTls);
+  bool parseHead();
+  bool readBody(const char *data, size_t size);
+  void finish();
+
+ public:
+  Proxy(Request &req, Response &res, bool isTls, bool isReused);
+
+  static int connect(const struct sockaddr_in &addr);
+  ssize_t send(int fd);
+  bool isSent() const;
+  bool receive(const char *data, size_t size);
+  bool receiveEnd();
+  bool isEnd() const;
+  bool isKeepAlive() const;
+  bool isRetryable() const;
+  bool isPaused() const;
+  void setPaused(bool isPaused);
+  Request &getRequest();
+  Response &getResponse();
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef REQUEST_HPP
 #define REQUEST_HPP
 
+#include <strings.h>
 #include <sys/stat.h>
 
 #include <cstdlib>
@@ -9,8 +10,10 @@
 #include <sstream>
 #include <string>
 
+#include "BufferPool.hpp"
 #include "ConfigParser.hpp"
 #include "ErrorException.hpp"
+#include "Limiter.hpp"
 #include "LocationBlock.hpp"
 #include "Utils.hpp"
 
@@ -21,7 +24,10 @@ class Request {
  private:
   std::string _rawContents;
   std::map<std::string, std::string> _header;
+  std::string _rawHeader;  // header lines of a proxied request, else empty
   std::string _body;
+  size_t _bodySize;
+  int _bodyFd;  // the body is in this temp file once spilled, -1 if not
   std::string _host;
   std::string _autoindex;
   std::string _mime;
@@ -30,25 +36,47 @@ class Request {
   bool _isChunked;
   size_t _chunkedSize;
   bool _isFullReq;
-  std::map<std::string, std::string> _mimeTypes;
+  bool _isBodyLeft;  // turned away before its body was read
+  static std::map<std::string, std::string> _mimeTypes;
   LocationList *_locList;
   ServerBlock *_locBlock;
+  long _phaseUsec[PHASE_CNT];  // -1 if the phase did not happen
+  unsigned long _phaseStart;
+  unsigned long _arrival;  // first byte of this request, 0 if none yet
+  Limiter *_limiter;       // holds a limit_conn slot of it, else NULL
+  uint64_t _limitHash;     // of the slot
+  unsigned long _delayUntil;  // usec limit_req holds it back to, else 0
 
   void parseUrl();
+  void appendBody(const char *data, size_t size);
+  bool limit(Limiter &limiter);
+  std::string getLimitKey();
+  static std::map<std::string, std::string> initMimeTypes();
 
  public:
   Request();
   ~Request();
-  void parsing(SPSBList *serverBlockList, LocationMap &locationMap);
+  void parsing(SPSBList *serverBlockList, LocationMap &locationMap,
+               Limiter &limiter);
   void setMime();
+  static const std::string &findMime(const std::string &path);
   void setLocBlock(SPSBList *serverBlockList, LocationMap &locationMap);
   void setAutoindex(std::string &value);
   void addRawContents(const char *raw, size_t size);
+  char *prepareRaw(BufferPool &pool);
+  void commitRaw(size_t size);
+  void releaseRaw(BufferPool &pool);
+  size_t getMemorySize() const;
+  bool spillBody();
+  int getBodyFd() const;
+  size_t getBodySize() const;
   void addHeader(std::string key, std::string value);
-  void clear();
+  void moveRawContents(Request &next);
+  void consumeRaw(size_t size);
   const std::string &getHost();
   const std::string &getUri();
   std::string &getBody();
+  const std::string &getRawHeader() const;
   const int &getStatus() const;
   ServerBlock *getLocBlock() const;
   const std::string &getAutoindex() const;
@@ -56,10 +84,20 @@ class Request {
   enum PROCESS getProcess();
   const std::string &getMethod();
   bool isFullReq() const;
+  bool isBodyLeft() const;
+  unsigned long getDelayUntil() const;
+  void clearDelay();
+  bool isEmpty() const;
+  bool isKeepAlive() const;
   const std::string &getRawContents() const;
   const std::string &getHeaderByKey(std::string key);
   std::map<std::string, std::string> getHeaderMap() const;
   void setHeader();
+  void startPhase();
+  void endPhase(e_phase phase);
+  void setPhaseTime(e_phase phase, unsigned long usec);
+  long getPhaseTime(int phase) const;
+  unsigned long getArrival() const;
 };
 
 #endif
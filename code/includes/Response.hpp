@@ -2,33 +2,103 @@
 #define RESPONSE_HPP
 
 #include <string.h>
-#include <sys/dir.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
 
+#include "AutoIndex.hpp"
+#include "ErrorPage.hpp"
 #include "Request.hpp"
+#include "Tls.hpp"
 #include "Utils.hpp"
 
+#define SENDFILE_CHUNK 1048576  // max bytes of a file body per sendfile
+#define SPILL_MIN 65536         // smaller bodies are never spilled to disk
+#define GZIP_CHUNK 32768        // file bytes deflated per piece of the body
+#define GZIP_STATE_SIZE 262144  // what deflate allocates for its window
+
+// headers are written in insertion order
+typedef std::vector<std::pair<std::string, std::string> > HeaderList;
+
+// a byte range of the body file, sent after its head (multipart boundary)
+struct FilePart {
+  std::string head;
+  off_t offset;
+  size_t size;
+};
+
 class Response {
  private:
-  std::map<std::string, std::string> _headers;
+  HeaderList _headers;
   std::string _body;
   std::string _statusLine;
   char *_result;
   size_t _resultSize;
   size_t _sendCnt;
-  std::map<int, std::string> _statusCodes;
+  ServerBlock *_locBlock;
+  std::string _connection;  // value of the Connection header, empty if none
+  int _fileFd;              // body is streamed from this file, -1 if none
+  std::vector<FilePart> _fileParts;
+  size_t _partIdx;
+  size_t _partSent;
+  AutoIndex *_autoIndex;  // body is generated from this listing, NULL if none
+  bool _isJson;
+  bool _isChunked;
+  size_t _indexPos;
+  std::string _chunk;  // listing or relayed bytes being sent
+  size_t _chunkSent;
+  bool _isIndexEnd;
+  bool _isRelay;     // body comes from an upstream with addRelay()
+  bool _isRelayEnd;  // no more of it comes
+  z_stream *_gzip;   // body is the file deflated as it is sent, NULL if none
+  off_t _gzipIn;     // file bytes deflated so far
+  bool _isGzipEnd;
+  size_t _bodySent;  // bytes of the streamed body sent so far
+  static std::map<int, std::string> _statusCodes;
+  static std::map<int, std::string> _statusLines;
+
+  static std::map<int, std::string> initStatusCodes();
+  static std::map<int, std::string> initStatusLines();
+  static char *writeBytes(char *pos, const std::string &str);
+  ssize_t sendFileRange(int clientSocket, Tls *tls, off_t offset,
+                        size_t size);
+  int sendFileBody(int clientSocket, Tls *tls);
+  int sendIndexBody(int clientSocket, Tls *tls);
+  int sendRelayBody(int clientSocket, Tls *tls);
+  int sendGzipBody(int clientSocket, Tls *tls);
+  void makeIndexChunk(std::string data);
+  bool makeGzipChunk();
+  void setChunk(std::string &data, bool isEnd);
+  HeaderList::iterator findHeader(const std::string &key);
+  void setPreparedRes(const ErrorPage &page);
 
  public:
   Response();
+  Response(ServerBlock *locBlock);
   ~Response();
 
-  void directoryListing(std::string path);
+  void directoryListing(const std::string &path, const std::string &uri,
+                        bool isJson, bool isChunked);
   void convertCGI(const std::string &cgiResult);
-  int sendResponse(int clientSocket);
+  void setRelay(const std::string &statusLine, const HeaderList &headers,
+                bool isChunked, bool hasLength);
+  void addRelay(const char *data, size_t size);
+  void endRelay(bool isComplete);
+  size_t getRelaySize() const;
+  bool isStalled() const;
+  int sendResponse(int clientSocket, Tls *tls);
+  int sendStreamBody(int clientSocket, Tls *tls);
+  std::string takeHead();
+  ssize_t readBody(char *buf, size_t size);
+  bool spillBody();
+  size_t getMemorySize() const;
 
   bool isInHeader(const std::string &key);
 
@@ -39,7 +109,22 @@ class Response {
   void setStatusLine(int code);
   void setHeaders(const std::string &key, const std::string &value);
   void setBody(std::stringstream &buffer);
+  void setBody(std::string &body);
   bool isFullWrite() const;
+  bool hasResult() const;
+  void setConnection(const std::string &value);
+  bool isKeepAlive() const;
+  const char *getRemainData() const;
+  size_t getRemainSize() const;
+  size_t addSendCnt(size_t cnt);
+  void setFileBody(int fd, const std::vector<FilePart> &parts);
+  bool setGzipBody(int fd, int level, bool isChunked);
+  bool hasStreamBody() const;
+  int getStatusCode() const;
+  size_t getSentSize() const;
+
+  static const std::string &getStatusMessage(int code);
+  static const std::string &getStatusLine(int code);
 };
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <map>
 #include <vector>
 
+#include "Logger.hpp"
 #include "Utils.hpp"
 
 class RootBlock {
@@ -20,6 +21,14 @@ class RootBlock {
   std::string _include;
   size_t _clientMaxBodySize;
   size_t _keepAliveTime;
+  size_t _keepAliveRequests;
+  std::string _statsFile;
+  size_t _slowHandlerThreshold;  // msec, 0 is off
+  std::string _captureFile;      // empty is off
+  size_t _memoryBudget;          // bytes, 0 is off
+  size_t _fileThreads;           // 0 runs the handlers on the event loop
+  std::string _eventMethod;      // use, empty picks one
+  size_t _limitZoneSize;         // bytes of limit_req and limit_conn keys
 
  public:
   RootBlock();
@@ -34,6 +43,15 @@ class RootBlock {
   void setWorkerConnections(std::string value);
   void setClientMaxBodySize(std::string value);
   void setKeepAliveTime(std::string value);
+  void setKeepAliveRequests(std::string value);
+  void setStatsFile(std::string value);
+  void setLogFormat(std::string value);
+  void setSlowHandlerThreshold(std::string value);
+  void setCaptureFile(std::string value);
+  void setMemoryBudget(std::string value);
+  void setFileThreads(std::string value);
+  void setEventMethod(std::string value);
+  void setLimitZoneSize(std::string value);
   void setInclude(std::string value);
   virtual void setKeyVal(std::string key, std::string value);
 
@@ -47,6 +65,14 @@ class RootBlock {
   int getWorkerProcesses() const;
   const size_t &getClientMaxBodySize() const;
   const size_t &getKeepAliveTime() const;
+  const size_t &getKeepAliveRequests() const;
+  const std::string &getStatsFile() const;
+  size_t getSlowHandlerThreshold() const;
+  const std::string &getCaptureFile() const;
+  size_t getMemoryBudget() const;
+  size_t getFileThreads() const;
+  const std::string &getEventMethod() const;
+  size_t getLimitZoneSize() const;
 };
 
 #endif
@@ -3,7 +3,6 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
-#include <sys/event.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -17,11 +16,13 @@
 #include <vector>
 
 #include "ConfigParser.hpp"
+#include "Event.hpp"
 #include "Kqueue.hpp"
 #include "Request.hpp"
 #include "Response.hpp"
 #include "RootBlock.hpp"
 #include "ServerBlock.hpp"
+#include "Tls.hpp"
 
 class Server {
  private:
@@ -29,6 +30,10 @@ class Server {
   int _listenPort;
   size_t _keepAliveTime;
   SPSBList *_sbList;
+  SSL_CTX *_sslCtx;  // of the first server, NULL if the port is not ssl
+  std::map<std::string, SSL_CTX *> _sslCtxs;  // key: server_name, for SNI
+
+  int initSsl();
 
  public:
   Server(const int port, SPSBList *sbList);
@@ -39,6 +44,8 @@ class Server {
   int getListenPort() const;
   size_t getkeepAliveTime() const;
   SPSBList *getSPSBList() const;
+  SSL_CTX *getSslCtx() const;
+  SSL_CTX *findSslCtx(const std::string &serverName) const;
 };
 
 #endif
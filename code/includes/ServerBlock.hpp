@@ -1,13 +1,45 @@
 #ifndef SERVERBLOCK_HPP
 #define SERVERBLOCK_HPP
 
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+
 #include <iostream>
 #include <list>
 #include <map>
 #include <vector>
 
+#include "ErrorPage.hpp"
+#include "Histogram.hpp"
 #include "RootBlock.hpp"
 
+#define LIMIT_RATE_MAX 1000000  // limit_req rate and burst
+
+// phases of a request, each is timed on its own
+enum e_phase {
+  PHASE_FIRST_BYTE,  // accept to the first byte, first request only
+  PHASE_PARSE,       // request line and headers
+  PHASE_ROUTE,       // server, location and mime lookup
+  PHASE_HANDLER,     // Method::process
+  PHASE_CGI,         // cgi started to its output read
+  PHASE_UPSTREAM,    // proxied request sent to the response head read
+  PHASE_FLUSH,       // response ready to fully written
+  PHASE_CNT
+};
+
+// counters of a server or location, read when the status page is scraped
+struct BlockStats {
+  size_t requests;
+  size_t bytes;
+  size_t statusClass[6];  // index: status code / 100
+  Histogram phases[PHASE_CNT];
+
+  BlockStats();
+  void addResponse(int statusCode, size_t size);
+  static const char *getPhaseName(int phase);
+};
+
 class ServerBlock : public RootBlock {
  protected:
   int _listenPort;
@@ -16,9 +48,42 @@ class ServerBlock : public RootBlock {
   std::string _index;
   std::string _serverName;
   std::string _autoindex;
+  std::string _autoindexFormat;
   std::string _limitExcept;
   std::string _cgi;
   std::string _cgiRedir;
+  std::map<int, ErrorPage> _errorPages;  // key: status code
+  std::string _gzip;
+  std::string _gzipStatic;
+  int _gzipCompLevel;
+  size_t _gzipMinLength;
+  std::string _gzipTypes;
+  bool _isExpires;
+  long _expires;  // seconds, negative is no-cache
+  std::string _stubStatus;
+  Logger *_accessLog;  // NULL if off
+  std::string _accessLogFormat;
+  std::string _http2;  // cleartext http2 on the listen port, on | off
+  bool _isSsl;         // listen ... ssl
+  std::string _sslCertificate;
+  std::string _sslCertificateKey;
+  size_t _sslSessionCache;  // sessions kept for resumption, 0 is off
+  std::string _sslSessionTickets;
+  std::string _sslSessionTicketKey;  // empty: a random key per start
+  std::string _sslKtls;
+  std::string _proxyPass;      // upstream url, empty if off
+  std::string _proxyUpstream;  // ip:port, the key of its connection pool
+  std::string _proxyUri;       // replaces the location path, empty if none
+  struct sockaddr_in _proxyAddr;
+  size_t _proxyKeepalive;      // idle connections kept per upstream
+  size_t _limitRate;     // limit_req, 1/1000 requests a second, 0 is off
+  size_t _limitBurst;    // requests over the rate let in
+  bool _isLimitNodelay;  // the burst is not held back to the rate
+  size_t _limitConn;     // requests in progress per key, 0 is off
+  std::string _limitKey;  // header name, empty is the client address
+  int _limitReqZone;   // the limit_req the rate comes from, its buckets
+  int _limitConnZone;  // the limit_conn the limit comes from
+  BlockStats _stats;  // not inherited, every block counts its own requests
 
  public:
   ServerBlock(RootBlock &rootBlock);
@@ -30,9 +95,31 @@ class ServerBlock : public RootBlock {
   void setIndex(std::string value);
   void setServerName(std::string value);
   void setAutoindex(std::string value);
+  void setAutoindexFormat(std::string value);
   void setLimitExcept(std::string value);
   void setCgi(std::string value);
   void setCgiRedir(std::string value);
+  void setErrorPage(std::string value);
+  void setGzip(std::string value);
+  void setGzipStatic(std::string value);
+  void setGzipCompLevel(std::string value);
+  void setGzipMinLength(std::string value);
+  void setGzipTypes(std::string value);
+  void setExpires(std::string value);
+  void setStubStatus(std::string value);
+  void setAccessLog(std::string value);
+  void setHttp2(std::string value);
+  void setSslCertificate(std::string value);
+  void setSslCertificateKey(std::string value);
+  void setSslSessionCache(std::string value);
+  void setSslSessionTickets(std::string value);
+  void setSslSessionTicketKey(std::string value);
+  void setSslKtls(std::string value);
+  void setProxyPass(std::string value);
+  void setProxyKeepalive(std::string value);
+  void setLimitReq(std::string value);
+  void setLimitConn(std::string value);
+  void setLimitKey(std::string value);
   virtual void setKeyVal(std::string key, std::string value);
 
   int getListenPort() const;
@@ -41,9 +128,42 @@ class ServerBlock : public RootBlock {
   const std::string &getIndex() const;
   const std::string &getServerName() const;
   const std::string &getAutoindex() const;
+  const std::string &getAutoindexFormat() const;
   const std::string &getLimitExcept() const;
   const std::string &getCgi() const;
   const std::string &getCgiRedir() const;
+  const ErrorPage *getErrorPage(int statusCode) const;
+  const std::string &getGzip() const;
+  const std::string &getGzipStatic() const;
+  int getGzipCompLevel() const;
+  size_t getGzipMinLength() const;
+  bool isGzipType(const std::string &mime) const;
+  bool isExpires() const;
+  long getExpires() const;
+  const std::string &getStubStatus() const;
+  Logger *getAccessLog() const;
+  const std::string &getAccessLogFormat() const;
+  const std::string &getHttp2() const;
+  bool isSsl() const;
+  const std::string &getSslCertificate() const;
+  const std::string &getSslCertificateKey() const;
+  size_t getSslSessionCache() const;
+  const std::string &getSslSessionTickets() const;
+  const std::string &getSslSessionTicketKey() const;
+  const std::string &getSslKtls() const;
+  const std::string &getProxyPass() const;
+  const std::string &getProxyUpstream() const;
+  const std::string &getProxyUri() const;
+  const struct sockaddr_in &getProxyAddr() const;
+  size_t getProxyKeepalive() const;
+  size_t getLimitRate() const;
+  size_t getLimitBurst() const;
+  bool isLimitNodelay() const;
+  size_t getLimitConn() const;
+  const std::string &getLimitKey() const;
+  int getLimitReqZone() const;
+  int getLimitConnZone() const;
+  BlockStats &getStats();
 };
 
 #endif
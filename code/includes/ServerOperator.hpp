@@ -5,41 +5,170 @@
 #include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/event.h>
+#include <sys/resource.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
 #include <list>
 
+#include "Capture.hpp"
 #include "Delete.hpp"
+#include "Event.hpp"
+#include "FilePool.hpp"
 #include "Get.hpp"
+#include "Http2.hpp"
 #include "IMethod.hpp"
 #include "Kqueue.hpp"
+#include "Limiter.hpp"
 #include "Post.hpp"
+#include "Proxy.hpp"
 #include "Request.hpp"
 #include "Server.hpp"
+#include "Tls.hpp"
 #include "Utils.hpp"
 
+#define MAX_IOV 64  // responses combined into one writev
+
+// handler types timed by the event loop
+enum e_handler {
+  HANDLER_ACCEPT,
+  HANDLER_CLIENT_READ,
+  HANDLER_CLIENT_WRITE,
+  HANDLER_CGI_READ,
+  HANDLER_CGI_WRITE,
+  HANDLER_UPSTREAM_READ,
+  HANDLER_UPSTREAM_WRITE,
+  HANDLER_TASK,
+  HANDLER_TIMER,
+  HANDLER_OTHER,  // errors and signals
+  HANDLER_CNT
+};
+
+// health of the event loop itself
+struct LoopStats {
+  Histogram events;      // events returned by a kevent call
+  Histogram changes;     // changelist size passed to a kevent call
+  Histogram iteration;   // usec to handle the events of a kevent call
+  Histogram handlers[HANDLER_CNT];  // usec of a handler call
+};
+
+// a server or location on the status page
+struct StatsRow {
+  std::string server;  // server_name:port
+  std::string location;
+  BlockStats *stats;
+};
+
+// a handler running on a file thread. its request and response stay in the
+// queue of the client, the loop leaves them alone until the task is back
+struct MethodTask : public FileTask {
+  Method *method;
+  Request *req;
+  Response *res;
+  int client;     // -1 once the client is gone, the loop frees it all then
+  size_t memory;  // of req and res when it was pushed
+
+  void run();
+};
+
 class ServerOperator {
  private:
   ServerMap &_serverMap;  // key: server socket, value: Server class
   LocationMap &_locationMap;
-  std::map<int, Request *> _clients;  // key: client socket, value: Request
-  std::map<int, int>
-      _clientToServer;  // key: client socket, value: server socket
-  bool isExistClient(int clientSock);
+  std::list<Connection *> _idleClients;  // keep-alive, least recent first
+  size_t _maxClients;
+  size_t _clientCnt;
+  size_t _acceptCnt;   // connections accepted
+  size_t _handledCnt;  // accepted and not dropped for worker_connections
+  size_t _requestCnt;
+  LoopStats _loopStats;
+  unsigned long _slowThreshold;  // usec, 0 is off
+  Capture *_capture;             // NULL if capture_file is not set
+  bool _isRunning;               // false after SIGTERM or SIGINT
+  BufferPool _bufferPool;
+  size_t _memoryBudget;            // bytes, 0 is off
+  size_t _memoryUsed;              // sum of the memory of the clients
+  size_t _heldMemory;              // sent by them, not out of the poller yet
+  std::deque<int> _pausedClients;  // oldest first, may hold closed ones
+  size_t _rejectCnt;               // connections refused with 503
+  size_t _spillCnt;                // bodies moved to temp files
+  size_t _tlsHandshakeCnt;         // finished, resumed ones too
+  size_t _tlsResumeCnt;            // with a cached session or a ticket
+  size_t _ktlsCnt;                 // sending through kernel tls
+  // key: ip:port of an upstream, its idle connections, newest last
+  std::map<std::string, std::vector<int> > _upstreamPool;
+  size_t _upstreamConnectCnt;      // new upstream connections
+  size_t _upstreamReuseCnt;        // requests on pooled ones
+  FilePool _filePool;              // no threads if file_threads is 0
+  Limiter _limiter;                // limit_req and limit_conn keys
+  // key: usec a request held back by limit_req is due, value: its client,
+  // may hold closed ones
+  std::multimap<unsigned long, int> _delayed;
   ServerBlock *getLocationBlock(Request &req, ServerBlock *sb);
   ServerBlock *findLocationBlock(struct kevent *event);
   // void setKeepAlive(int &fd, Server *server); //TCP 연결 관리
+  void handleEvent(struct kevent *event, Kqueue &kq);
+  e_handler getHandlerType(struct kevent *event);
+  int getEventClient(struct kevent *event);
+  void logSlowHandler(e_handler type, struct kevent *event, int clientSock,
+                      unsigned long usec, Kqueue &kq);
   void handleEventError(struct kevent *event, Kqueue &kq);
   void handleReadEvent(struct kevent *event, Kqueue &kq);
   void handleWriteEvent(struct kevent *event, Kqueue &kq);
-  void handleRequestTimeOut(int clientSock, Kqueue &kq);
-  void disconnectClient(int clientSock, Kqueue &kq);
+  void closeCgiPipe(Connection &pipe, Kqueue &kq);
+  bool startProxy(Connection &client, Request &req, Response &res,
+                  Kqueue &kq);
+  void sendUpstream(Connection &upstream, Kqueue &kq);
+  void readUpstream(Connection &upstream, Kqueue &kq);
+  void relayHead(Connection &client, Response &res, Kqueue &kq);
+  void failUpstream(Connection &upstream, Kqueue &kq);
+  void releaseUpstream(Connection &upstream, Kqueue &kq);
+  void closeUpstream(Connection &upstream, Kqueue &kq);
+  void closeUpstreamOf(Connection &client, Response *res, Kqueue &kq);
+  void resumeUpstreams(Connection &client, Kqueue &kq);
+  bool handshakeTls(Connection &client, int16_t filter, Kqueue &kq);
+  void handleRequestTimeOut(Connection &client, Kqueue &kq);
+  void parseRequests(Connection &client, Kqueue &kq);
+  bool isHttp2Upgrade(Connection &client, Request &req);
+  bool upgradeHttp2(Connection &client, Request *req, Kqueue &kq);
+  void parseFrames(Connection &client, Kqueue &kq);
+  void sendFrames(Connection &client, Kqueue &kq);
+  void processRequest(Connection &client, Request &req, Response &res,
+                      Kqueue &kq);
+  void finishTasks(Kqueue &kq);
+  void runDelayed(Kqueue &kq);
+  struct timespec *getWaitTimeout(struct timespec *timeout,
+                                  struct timespec &buf);
+  bool isWaiting(Connection &client);
+  void sendResponses(Connection &client, Kqueue &kq);
+  bool isClosing(Connection &client);
+  void setIdle(Connection &client);
+  void unsetIdle(Connection &client);
+  bool reclaimIdleClient(Kqueue &kq);
+  void disconnectClient(Connection &client, Kqueue &kq);
+  bool isOverBudget() const;
+  void updateMemory(Connection &client);
+  void pauseClient(Connection &client, Kqueue &kq);
+  void resumeClients(Kqueue &kq);
+  void rejectClient(int clientSock, bool isSsl);
+  void spillResponse(Response &res);
+  void collectStatsRows(std::vector<StatsRow> &rows);
+  void makeStatusPage(Response &res, bool isPrometheus, Kqueue &kq);
+  void recordStats(Request &req, Response &res);
+  void writeAccessLog(Request &req, Response &res);
+  void writeHistogram(std::stringstream &ss, const std::string &name,
+                      const Histogram &hist);
+  void dumpStats();
+  void writeBlockStats(std::stringstream &ss, const std::vector<StatsRow> &rows,
+                       bool isPrometheus);
 
  public:
   ServerOperator(ServerMap &serverMap, LocationMap &locationMap);
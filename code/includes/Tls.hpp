@@ -0,0 +1,75 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+#include <string>
+
+#define TLS_RECORD_MAX 16384      // plaintext of one record
+#define TLS_TICKET_KEY_SIZE 80    // ssl_session_ticket_key: name, hmac, aes
+#define TLS_SESSION_ID "webserv"  // the same for every context of a port
+
+class Server;
+class ServerBlock;
+
+// a step of the handshake
+enum e_tlsState { TLS_DONE, TLS_WANT_READ, TLS_WANT_WRITE, TLS_ERROR };
+
+// tls of one client socket. the handshake runs on the events of the socket,
+// then the data goes through it instead of the fd. with kernel tls the
+// records are made by the kernel and files are still sent with sendfile
+class Tls {
+ private:
+  SSL *_ssl;
+  bool _isDone;      // the handshake is finished
+  bool _isBroken;    // fatal error, no close_notify is sent
+  bool _isKtlsSend;  // writes are encrypted by the kernel
+
+  bool isRetry(int ret);
+  static int selectServerName(SSL *ssl, int *alert, void *arg);
+  static int selectAlpn(SSL *ssl, const unsigned char **out,
+                        unsigned char *outLen, const unsigned char *in,
+                        unsigned int inLen, void *arg);
+  static bool loadTicketKey(SSL_CTX *ctx, const std::string &path);
+
+ public:
+  Tls(SSL_CTX *ctx, int fd);
+  ~Tls();
+
+  static SSL_CTX *createContext(ServerBlock &sb, Server *server);
+  static std::string popErrors();
+  e_tlsState handshake();
+  bool isDone() const;
+  bool isResumed() const;
+  bool isKtlsSend() const;
+  ssize_t read(char *buf, size_t size);
+  ssize_t write(const char *buf, size_t size);
+  ssize_t writev(const struct iovec *iov, int iovCnt);
+  ssize_t sendFile(int fileFd, off_t offset, size_t size);
+};
+
+// the socket calls of a client, through its tls if it has one or the ring
+// if it is attached to it. with tls or the ring a write that would block
+// returns 0 and a read that hits the end or an error returns 0, a read that
+// would block returns -1 like the socket does
+ssize_t sockRead(int fd, Tls *tls, char *buf, size_t size);
+ssize_t sockWrite(int fd, Tls *tls, const char *buf, size_t size);
+ssize_t sockWritev(int fd, Tls *tls, const struct iovec *iov, int iovCnt);
+ssize_t sockSendFile(int fd, Tls *tls, int fileFd, off_t offset, size_t size);
+int sockClose(int fd);
+int fileClose(int fileFd);
+
+#endif
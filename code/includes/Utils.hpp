@@ -3,20 +3,36 @@
 
 #include <algorithm>
 #include <cmath>
+#include <ctime>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPILL_TEMPLATE "/tmp/webserv_spill.XXXXXX"
 
 int ftStoi(std::string str);
 std::string ftItos(int num);
+std::string ftUtos(size_t num);
 void ftToupper(std::string& str);
 size_t convertTimeUnits(std::string value);
 size_t convertByteUnits(std::string value);
 size_t hexToDecimal(const std::string& hex);
 std::string ftInetNtoa(struct in_addr addr);
 std::string getCurrentTime();
+std::string formatHttpTime(std::time_t t);
+const std::string& getCachedTime();
+void updateCachedTime();
+void initThreadTime();
+void useThreadTime();
+unsigned long getMonotonicUsec();
+int openSpillFile();
 
 #endif
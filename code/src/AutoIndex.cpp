@@ -0,0 +1,198 @@
+#include "../includes/AutoIndex.hpp"
+
+std::map<std::string, AutoIndex *> AutoIndex::_cache;
+std::list<std::string> AutoIndex::_lru;
+
+// file threads build listings while the loop releases them. a directory is
+// read without the lock, two threads may read the same one at once
+static pthread_mutex_t g_cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+AutoIndex::AutoIndex(const std::string &path, std::time_t mtime)
+    : _path(path),
+      _mtime(mtime),
+      _readTime(std::time(NULL)),
+      _refCnt(0),
+      _isCached(false) {}
+
+AutoIndex::~AutoIndex() {}
+
+static bool compareEntry(const DirEntry &a, const DirEntry &b) {
+  if (a.isDir != b.isDir) return a.isDir;
+  return a.name < b.name;
+}
+
+bool AutoIndex::readEntries() {
+  DIR *dir;
+  struct dirent *ent;
+  struct stat info;
+
+  if ((dir = opendir(_path.c_str())) == NULL) return false;
+  while ((ent = readdir(dir)) != NULL) {
+    DirEntry entry;
+    entry.name = ent->d_name;
+    if (entry.name == ".") continue;
+    entry.isDir = ent->d_type == DT_DIR;
+    entry.size = 0;
+    entry.mtime = 0;
+    if (stat((_path + entry.name).c_str(), &info) == 0) {
+      entry.isDir = S_ISDIR(info.st_mode);
+      entry.size = info.st_size;
+      entry.mtime = info.st_mtime;
+    }
+    _entries.push_back(entry);
+  }
+  closedir(dir);
+  std::sort(_entries.begin(), _entries.end(), compareEntry);
+  return true;
+}
+
+// mtime has a one second resolution, a listing read in the same second as
+// the last change may have missed a later change in that second
+bool AutoIndex::isCurrent(std::time_t mtime) const {
+  return _mtime == mtime && _mtime < _readTime;
+}
+
+void AutoIndex::uncache(const std::string &path) {
+  std::map<std::string, AutoIndex *>::iterator it = _cache.find(path);
+
+  if (it == _cache.end()) return;
+  it->second->_isCached = false;
+  if (it->second->_refCnt == 0) delete it->second;
+  _cache.erase(it);
+  _lru.remove(path);
+}
+
+// NULL if the directory cannot be read
+AutoIndex *AutoIndex::acquire(const std::string &path) {
+  struct stat info;
+
+  if (stat(path.c_str(), &info) == -1) return NULL;
+  pthread_mutex_lock(&g_cacheLock);
+  std::map<std::string, AutoIndex *>::iterator it = _cache.find(path);
+  if (it != _cache.end() && it->second->isCurrent(info.st_mtime)) {
+    _lru.remove(path);
+    _lru.push_back(path);
+    it->second->_refCnt++;
+    pthread_mutex_unlock(&g_cacheLock);
+    return it->second;
+  }
+  pthread_mutex_unlock(&g_cacheLock);
+
+  AutoIndex *index = new AutoIndex(path, info.st_mtime);
+  if (index->readEntries() == false) {
+    delete index;
+    return NULL;
+  }
+  pthread_mutex_lock(&g_cacheLock);
+  uncache(path);
+  while (_cache.size() >= AUTOINDEX_CACHE_SIZE) uncache(_lru.front());
+  index->_isCached = true;
+  index->_refCnt++;
+  _cache[path] = index;
+  _lru.push_back(path);
+  pthread_mutex_unlock(&g_cacheLock);
+  return index;
+}
+
+void AutoIndex::release(AutoIndex *index) {
+  pthread_mutex_lock(&g_cacheLock);
+  bool isUnused = --index->_refCnt == 0 && index->_isCached == false;
+  pthread_mutex_unlock(&g_cacheLock);
+  if (isUnused) delete index;
+}
+
+std::string AutoIndex::escapeHtml(const std::string &str) {
+  std::string ret;
+
+  for (size_t i = 0; i < str.size(); i++) {
+    if (str[i] == '&')
+      ret += "&amp;";
+    else if (str[i] == '<')
+      ret += "&lt;";
+    else if (str[i] == '>')
+      ret += "&gt;";
+    else if (str[i] == '"')
+      ret += "&quot;";
+    else
+      ret += str[i];
+  }
+  return ret;
+}
+
+std::string AutoIndex::escapeUri(const std::string &str) {
+  const char *hex = "0123456789ABCDEF";
+  std::string ret;
+
+  for (size_t i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' ||
+        c == '/')
+      ret += c;
+    else {
+      ret += '%';
+      ret += hex[c >> 4];
+      ret += hex[c & 0x0F];
+    }
+  }
+  return ret;
+}
+
+std::string AutoIndex::escapeJson(const std::string &str) {
+  const char *hex = "0123456789abcdef";
+  std::string ret;
+
+  for (size_t i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (c < 0x20) {
+      ret += "\\u00";
+      ret += hex[c >> 4];
+      ret += hex[c & 0x0F];
+    } else
+      ret += c;
+  }
+  return ret;
+}
+
+std::string AutoIndex::makeHead(const std::string &uri, bool isJson) const {
+  if (isJson) return "[";
+  std::string title = escapeHtml(uri);
+  return "<html>\n<head><title>Index of " + title +
+         "</title></head>\n<body>\n<h1>Index of " + title + "</h1><hr>\n";
+}
+
+// appends entries from pos until a chunk is filled, returns the next pos
+size_t AutoIndex::makeEntries(std::string &out, size_t pos, bool isJson) const {
+  for (; pos < _entries.size() && out.size() < AUTOINDEX_CHUNK; pos++) {
+    const DirEntry &entry = _entries[pos];
+    if (isJson) {
+      if (pos != 0) out += ",";
+      out += "\n{\"name\":\"" + escapeJson(entry.name) + "\",\"type\":\"";
+      out += entry.isDir ? "directory" : "file";
+      out += "\",\"mtime\":\"" + formatHttpTime(entry.mtime) + "\"";
+      if (entry.isDir == false) out += ",\"size\":" + ftUtos(entry.size);
+      out += "}";
+      continue;
+    }
+    out += "<a href=\"" + escapeUri(entry.name);
+    if (entry.isDir)
+      out += "/\">";
+    else if (entry.name.size() < 5 ||
+             entry.name.compare(entry.name.size() - 5, 5, ".html") != 0)
+      out += "\" download>";
+    else
+      out += "\">";
+    out += escapeHtml(entry.name);
+    out += entry.isDir ? "/</a><br>\n" : "</a><br>\n";
+  }
+  return pos;
+}
+
+std::string AutoIndex::makeTail(bool isJson) const {
+  if (isJson) return "\n]\n";
+  return "<hr>\n</body>\n</html>\n";
+}
+
+size_t AutoIndex::size() const { return _entries.size(); }
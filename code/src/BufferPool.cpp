@@ -0,0 +1,32 @@
+#include "../includes/BufferPool.hpp"
+
+BufferPool::BufferPool() {}
+
+BufferPool::~BufferPool() {}
+
+// makes room for BUFFER_CHUNK more bytes, a pooled buffer if buf is empty.
+// a buffer that keeps growing doubles so reads do not move it every time
+void BufferPool::acquire(std::string &buf) {
+  if (buf.capacity() - buf.size() >= BUFFER_CHUNK) return;
+  if (buf.empty() && _free.empty() == false) {
+    buf.swap(_free.back());
+    _free.pop_back();
+    return;
+  }
+  size_t capacity = buf.size() + BUFFER_CHUNK;
+  if (buf.empty() == false && capacity < buf.capacity() * 2)
+    capacity = buf.capacity() * 2;
+  buf.reserve(capacity);
+}
+
+// takes the memory of an empty buffer, a grown one is freed instead
+void BufferPool::release(std::string &buf) {
+  if (buf.empty() == false) return;
+  if (buf.capacity() >= BUFFER_CHUNK && buf.capacity() < BUFFER_CHUNK * 2 &&
+      _free.size() < BUFFER_POOL_MAX) {
+    _free.push_back(std::string());
+    _free.back().swap(buf);
+    return;
+  }
+  std::string().swap(buf);
+}
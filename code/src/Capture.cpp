@@ -0,0 +1,71 @@
+#include "../includes/Capture.hpp"
+
+#include "../includes/Utils.hpp"
+
+static void putUint(std::string &buf, unsigned long value, int bytes) {
+  while (bytes-- > 0) buf += static_cast<char>((value >> (bytes * 8)) & 0xff);
+}
+
+Capture::Capture(const std::string &path)
+    : _start(getMonotonicUsec()), _lastFlush(std::time(NULL)), _nextId(0) {
+  _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (_fd == -1) throw std::runtime_error("capture_file: cannot open " + path);
+  fcntl(_fd, F_SETFD, FD_CLOEXEC);
+  _buffer.append(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+}
+
+Capture::~Capture() {
+  flush(true);
+  ::close(_fd);
+}
+
+void Capture::addRecord(unsigned int id, e_captureType type, const char *data,
+                        size_t size) {
+  putUint(_buffer, id, 4);
+  putUint(_buffer, type, 1);
+  putUint(_buffer, getMonotonicUsec() - _start, 8);
+  putUint(_buffer, size, 4);
+  _buffer.append(data, size);
+  if (_buffer.size() >= CAPTURE_BUFFER_SIZE) flush(true);
+}
+
+void Capture::open(int clientSock, int port) {
+  std::string data;
+
+  putUint(data, port, 2);
+  _connIds[clientSock] = _nextId;
+  addRecord(_nextId++, CAPTURE_OPEN, data.c_str(), data.size());
+}
+
+void Capture::data(int clientSock, const char *data, size_t size) {
+  std::map<int, unsigned int>::iterator it = _connIds.find(clientSock);
+
+  if (it != _connIds.end()) addRecord(it->second, CAPTURE_DATA, data, size);
+}
+
+void Capture::close(int clientSock) {
+  std::map<int, unsigned int>::iterator it = _connIds.find(clientSock);
+
+  if (it == _connIds.end()) return;
+  addRecord(it->second, CAPTURE_CLOSE, "", 0);
+  _connIds.erase(it);
+}
+
+// like the logs, records that cannot be written are dropped
+void Capture::flush(bool force) {
+  std::time_t now = std::time(NULL);
+
+  if (_buffer.empty() ||
+      (force == false && now - _lastFlush < CAPTURE_FLUSH_INTERVAL))
+    return;
+  _lastFlush = now;
+  size_t sent = 0;
+  while (sent < _buffer.size()) {
+    ssize_t n = write(_fd, _buffer.c_str() + sent, _buffer.size() - sent);
+    if (n <= 0) break;
+    sent += n;
+  }
+  _buffer.clear();
+}
+
+bool Capture::hasPending() const { return _buffer.empty() == false; }
@@ -61,12 +61,17 @@ void Cgi::reqToEnvp(std::map<std::string, std::string> param, int &clientFd) {
   _envp[i] = NULL;
 }
 
-int Cgi::execute(const std::string &body, Kqueue &kq, int &clientFd) {
+// the pipes keep the request and response they work for, a client may run
+// several cgis at once over http2
+int Cgi::execute(Request &req, Response &res, Kqueue &kq, int &clientFd) {
   pid_t pid;
   int inpipe[2];
   int outpipe[2];
-  (void)body;
+  const char *path = _env["PATH_TRANSLATED"].c_str();
 
+  // what execve() can not run is answered here, the child can not
+  if (access(path, F_OK) == -1) throw ErrorException(404);
+  if (access(path, X_OK) == -1) throw ErrorException(403);
   if (pipe(inpipe) < 0)
     throw ErrorException(500);
   else if (pipe(outpipe) < 0) {
@@ -74,10 +79,12 @@ int Cgi::execute(const std::string &body, Kqueue &kq, int &clientFd) {
     close(inpipe[1]);
     throw ErrorException(500);
   }
-  fcntl(inpipe[0], F_SETFL, O_NONBLOCK, FD_CLOEXEC);
-  fcntl(inpipe[1], F_SETFL, O_NONBLOCK, FD_CLOEXEC);
-  fcntl(outpipe[0], F_SETFL, O_NONBLOCK, FD_CLOEXEC);
-  fcntl(outpipe[1], F_SETFL, O_NONBLOCK, FD_CLOEXEC);
+  // the ends of the cgi block, it reads stdin like a file. ours are closed
+  // in other cgis, an inherited copy would hold back the EOF of this one
+  fcntl(inpipe[1], F_SETFL, O_NONBLOCK);
+  fcntl(outpipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(inpipe[1], F_SETFD, FD_CLOEXEC);
+  fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
   if ((pid = fork()) == -1) {
     close(inpipe[0]);
     close(inpipe[1]);
@@ -92,20 +99,29 @@ int Cgi::execute(const std::string &body, Kqueue &kq, int &clientFd) {
     dup2(outpipe[1], 1);
     close(inpipe[0]);
     close(outpipe[1]);
-    const char *argv[2] = {_env["PATH_TRANSLATED"].c_str(), NULL};
-    execve(_env["PATH_TRANSLATED"].c_str(), const_cast<char **>(argv), _envp);
+    const char *argv[2] = {path, NULL};
+    execve(path, const_cast<char **>(argv), _envp);
+    // the ring or the epoll of the loop is shared, it must not run here
+    _exit(EXIT_FAILURE);
   }
   close(inpipe[0]);
   close(outpipe[1]);
-  std::vector<int> *fdVec = new std::vector<int>;
-  fdVec->push_back(clientFd);
-  fdVec->push_back(pid);
-  fdVec->push_back(inpipe[1]);
-  fdVec->push_back(outpipe[0]);
-  fdVec->push_back(0);
-  kq.setFdGroup(inpipe[1], FD_CGI);
-  kq.setFdGroup(outpipe[0], FD_CGI);
-  kq.changeEvents(inpipe[1], EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, fdVec);
-  kq.changeEvents(outpipe[0], EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, fdVec);
+  Connection *in = kq.openConn(inpipe[1], FD_CGI);
+  Connection *out = kq.openConn(outpipe[0], FD_CGI);
+  Connection *client = kq.getConn(clientFd);
+  in->client = clientFd;
+  in->pid = pid;
+  in->cgiReq = &req;
+  in->cgiRes = &res;
+  in->peer = outpipe[0];
+  out->client = clientFd;
+  out->pid = pid;
+  out->cgiReq = &req;
+  out->cgiRes = &res;
+  out->peer = inpipe[1];
+  client->cgiPipes.push_back(inpipe[1]);
+  client->cgiPipes.push_back(outpipe[0]);
+  kq.changeEvents(inpipe[1], EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, in);
+  kq.changeEvents(outpipe[0], EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, out);
   return EXIT_SUCCESS;
 }
@@ -45,7 +45,12 @@ void Delete::makeStatusLine(Request &request, Response &response) {
 
 void Delete::process(Request &request, Response &response) {
   makeStatusLine(request, response);
-  response.setResult();
+  if (response.hasResult() == false) response.setResult();
+}
+
+bool Delete::isFileWork(Request &request) {
+  (void)request;
+  return true;
 }
 
 Delete::Delete() {}
@@ -0,0 +1,75 @@
+#include "../includes/ErrorPage.hpp"
+
+#include "../includes/Response.hpp"
+
+std::map<int, ErrorPage> ErrorPage::_defaults;
+
+ErrorPage::ErrorPage() {}
+
+ErrorPage::ErrorPage(int statusCode, const std::string &type,
+                     const std::string &body)
+    : _head(Response::getStatusLine(statusCode)), _body(body) {
+  _head += "\r\nContent-Type: ";
+  _head += type;
+  _head += "\r\n";
+}
+
+ErrorPage::~ErrorPage() {}
+
+std::string ErrorPage::makeDefaultBody(int statusCode) {
+  std::string title = ftItos(statusCode);
+  title += Response::getStatusMessage(statusCode);
+
+  std::string body = "<html>\n<head><title>";
+  body += title;
+  body += "</title></head>\n<body>\n<center><h1>";
+  body += title;
+  body +=
+      "</h1></center>\n<hr><center>webserver/1.0.0</center>\n</body>\n</"
+      "html>";
+  return body;
+}
+
+// called while parsing the config, a missing page is a config error
+ErrorPage ErrorPage::load(int statusCode, const std::string &path) {
+  std::ifstream file(path.c_str());
+  std::stringstream buffer;
+
+  if (file.is_open() == false)
+    throw std::runtime_error("error_page: cannot open " + path);
+  buffer << file.rdbuf();
+  return ErrorPage(statusCode, "text/html", buffer.str());
+}
+
+// every code a response can be made with, getDefault() is read from the
+// file threads too so nothing is added later
+void ErrorPage::loadDefaults() {
+  const int codes[] = {301, 303, 307, 400, 401, 403, 404, 405, 406, 408, 409,
+                       410, 412, 413, 414, 415, 416, 429, 500, 502, 503};
+
+  for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+    int code = codes[i];
+    std::string path = "./error" + ftItos(code) + ".html";
+    std::ifstream file(path.c_str());
+
+    if (code >= 400 && file.is_open() == false) file.open("./error.html");
+    if (code >= 400 && file.is_open()) {
+      std::stringstream buffer;
+      buffer << file.rdbuf();
+      _defaults[code] = ErrorPage(code, "text/html", buffer.str());
+    } else
+      _defaults[code] = ErrorPage(code, "text/html", makeDefaultBody(code));
+  }
+}
+
+// a code that is not loaded gets the page of 500
+const ErrorPage &ErrorPage::getDefault(int statusCode) {
+  std::map<int, ErrorPage>::const_iterator it = _defaults.find(statusCode);
+
+  if (it == _defaults.end()) it = _defaults.find(500);
+  return it->second;
+}
+
+const std::string &ErrorPage::getHead() const { return _head; }
+
+const std::string &ErrorPage::getBody() const { return _body; }
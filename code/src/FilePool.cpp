@@ -0,0 +1,103 @@
+#include "../includes/FilePool.hpp"
+
+#include "../includes/Logger.hpp"
+
+FilePool::FilePool() : _isStopping(false), _inFlight(0) {
+  _pipe[0] = -1;
+  _pipe[1] = -1;
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_cond, NULL);
+}
+
+// tasks still waiting are dropped, running ones finish first
+FilePool::~FilePool() {
+  pthread_mutex_lock(&_lock);
+  _isStopping = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_lock);
+  for (size_t i = 0; i < _threads.size(); i++) pthread_join(_threads[i], NULL);
+  if (_pipe[0] != -1) {
+    close(_pipe[0]);
+    close(_pipe[1]);
+  }
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+void *FilePool::work(void *arg) {
+  FilePool *pool = static_cast<FilePool *>(arg);
+
+  useThreadTime();
+  pthread_mutex_lock(&pool->_lock);
+  while (true) {
+    while (pool->_queue.empty() && pool->_isStopping == false)
+      pthread_cond_wait(&pool->_cond, &pool->_lock);
+    if (pool->_isStopping) break;
+    FileTask *task = pool->_queue.front();
+    pool->_queue.pop_front();
+    pthread_mutex_unlock(&pool->_lock);
+    task->run();
+    // a pointer is written at once and the pipe holds FILE_TASK_MAX of them
+    if (write(pool->_pipe[1], &task, sizeof(task)) != sizeof(task))
+      Logger::log(LEVEL_CRIT, "file_threads: a finished task is lost");
+    pthread_mutex_lock(&pool->_lock);
+  }
+  pthread_mutex_unlock(&pool->_lock);
+  return NULL;
+}
+
+// the threads get no signals, the loop takes them as events
+bool FilePool::start(size_t threadCnt) {
+  sigset_t all;
+  sigset_t old;
+
+  if (threadCnt == 0) return true;
+  if (pipe(_pipe) == -1) {
+    _pipe[0] = -1;
+    return false;
+  }
+  fcntl(_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(_pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(_pipe[1], F_SETFD, FD_CLOEXEC);
+  initThreadTime();
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (size_t i = 0; i < threadCnt; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, work, this) != 0) break;
+    _threads.push_back(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return _threads.size() == threadCnt;
+}
+
+// false if there are no threads or too many tasks, the caller runs it then
+bool FilePool::push(FileTask *task) {
+  if (_threads.empty() || _inFlight >= FILE_TASK_MAX) return false;
+  pthread_mutex_lock(&_lock);
+  _queue.push_back(task);
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_lock);
+  _inFlight++;
+  return true;
+}
+
+// the tasks finished since the last call, in the order they finished
+void FilePool::popFinished(std::vector<FileTask *> &tasks) {
+  FileTask *buf[64];
+  ssize_t n;
+
+  while ((n = read(_pipe[0], buf, sizeof(buf))) > 0) {
+    size_t cnt = n / sizeof(buf[0]);
+    tasks.insert(tasks.end(), buf, buf + cnt);
+    _inFlight -= cnt;
+    if (static_cast<size_t>(n) < sizeof(buf)) break;
+  }
+}
+
+// -1 if the pool is off
+int FilePool::getFd() const { return _threads.empty() ? -1 : _pipe[0]; }
+
+size_t FilePool::getThreadCount() const { return _threads.size(); }
+
+size_t FilePool::getInFlight() const { return _inFlight; }
@@ -4,37 +4,273 @@ Get::Get() {}
 
 Get::~Get() {}
 
-void Get::makeBody(Response &response, std::ifstream &file) {
-  std::stringstream buffer;
+// the body is the file deflated a chunk at a time while the socket drains
+void Get::makeGzipResponse(Request &request, Response &response) {
+  int fd = open(_path.c_str(), O_RDONLY);
 
-  buffer << file.rdbuf();
-  file.close();
-  if (buffer.good() == false) throw ErrorException(500);
-  response.setBody(buffer);
-  return;
+  if (fd == -1) throw ErrorException(403);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (response.setGzipBody(fd, request.getLocBlock()->getGzipCompLevel(),
+                           request.getHeaderByKey("protocol") ==
+                               "HTTP/1.1") == false) {
+    close(fd);
+    throw ErrorException(500);
+  }
+  response.setHeaders("Content-Type", getContentType(request));
+}
+
+// the gzip coding of Accept-Encoding, matched whole and in any case.
+// refused if its q value is 0, like gzip;q=0 or gzip;q=0.000
+bool Get::isAcceptGzip(Request &request) {
+  std::stringstream ss(request.getHeaderByKey("Accept-Encoding"));
+  std::string coding;
+
+  while (std::getline(ss, coding, ',')) {
+    std::stringstream params(coding);
+    std::string name;
+    std::getline(params, name, ';');
+    name.erase(0, name.find_first_not_of(" \t"));
+    name.erase(name.find_last_not_of(" \t") + 1);
+    if (strcasecmp(name.c_str(), "gzip") != 0) continue;
+    std::string param;
+    while (std::getline(params, param, ';')) {
+      param.erase(0, param.find_first_not_of(" \t"));
+      if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') &&
+          param[1] == '=')
+        return std::strtod(param.c_str() + 2, NULL) > 0;
+    }
+    return true;
+  }
+  return false;
+}
+
+// gzip_static serves path.gz as is, gzip compresses on the fly.
+// returns the file to send, empty if the body is deflated as it is sent
+std::string Get::setGzipBody(Request &request, Response &response,
+                             std::ifstream &file) {
+  ServerBlock *locBlock = request.getLocBlock();
+
+  if (locBlock->getGzip() != "on" && locBlock->getGzipStatic() != "on")
+    return _path;
+  if (isAcceptGzip(request) == false) return _path;
+  if (locBlock->getGzipStatic() == "on") {
+    std::ifstream gzFile((_path + ".gz").c_str());
+    if (gzFile.is_open()) {
+      response.setHeaders("Content-Encoding", "gzip");
+      return _path + ".gz";
+    }
+  }
+  if (locBlock->getGzip() != "on" ||
+      locBlock->isGzipType(Request::findMime(_path)) == false)
+    return _path;
+  file.seekg(0, std::ios::end);
+  size_t fileSize = file.tellg();
+  file.seekg(0, std::ios::beg);
+  if (fileSize < locBlock->getGzipMinLength()) return _path;
+  makeGzipResponse(request, response);
+  return "";
 }
 
-void Get::makeHeader(Request &request, Response &response) {
-  if (response.getBody() != "")
-    if (response.isInHeader("Content-Type") == false) {
-      response.setHeaders("Content-Type", request.getMime());
+std::string Get::getContentType(Request &request) {
+  if (request.getMime() == "directory")  // index file of a directory
+    return Request::findMime(_path);
+  return request.getMime();
+}
+
+// ETag from inode, size and mtime, Last-Modified and the expires headers
+void Get::setCacheHeaders(Request &request, Response &response,
+                          struct stat &info) {
+  ServerBlock *locBlock = request.getLocBlock();
+  std::stringstream ss;
+
+  ss << std::hex << "\"" << info.st_ino << "-" << info.st_size << "-"
+     << info.st_mtime << "\"";
+  _etag = ss.str();
+  _lastModified = formatHttpTime(info.st_mtime);
+  response.setHeaders("ETag", _etag);
+  response.setHeaders("Last-Modified", _lastModified);
+  if (locBlock->isExpires() == false) return;
+  long expires = locBlock->getExpires();
+  if (expires < 0) {
+    response.setHeaders("Expires", formatHttpTime(1));
+    response.setHeaders("Cache-Control", "no-cache");
+  } else {
+    response.setHeaders("Expires", formatHttpTime(std::time(NULL) + expires));
+    response.setHeaders("Cache-Control", "max-age=" + ftUtos(expires));
+  }
+}
+
+// If-None-Match wins over If-Modified-Since, which must match exactly
+bool Get::isNotModified(Request &request) {
+  const std::string &ifNoneMatch = request.getHeaderByKey("If-None-Match");
+
+  if (ifNoneMatch != "") {
+    std::stringstream ss(ifNoneMatch);
+    std::string tag;
+    while (std::getline(ss, tag, ',')) {
+      tag.erase(0, tag.find_first_not_of(" "));
+      tag.erase(tag.find_last_not_of(" ") + 1);
+      if (tag.compare(0, 2, "W/") == 0) tag.erase(0, 2);  // weak comparison
+      if (tag == "*" || tag == _etag) return true;
     }
-  response.setHeaders("Content-Length", ftItos(response.getBody().size()));
+    return false;
+  }
+  const std::string &ifModifiedSince =
+      request.getHeaderByKey("If-Modified-Since");
+  return ifModifiedSince != "" && ifModifiedSince == _lastModified;
+}
+
+// If-Range must match the strong ETag or the modification date
+bool Get::isIfRangeMatch(Request &request) {
+  const std::string &ifRange = request.getHeaderByKey("If-Range");
+
+  if (ifRange == "") return true;
+  return ifRange == _lastModified ||
+         (ifRange == _etag && _etag.compare(0, 2, "W/") != 0);
 }
 
+// Range: bytes=0-99,200-,-50
+// returns 206, or 200 when the header is ignored and the whole file is sent
+int Get::makeRangeParts(const std::string &range, off_t size,
+                        const std::string &contentType,
+                        std::vector<FilePart> &parts, Response &response) {
+  std::vector<std::pair<off_t, off_t> > ranges;  // first, last byte
+  std::string total = ftUtos(size);
+
+  if (range.compare(0, 6, "bytes=") != 0) return 200;
+  std::stringstream ss(range.substr(6));
+  std::string spec;
+  while (std::getline(ss, spec, ',')) {
+    spec.erase(0, spec.find_first_not_of(" "));
+    spec.erase(spec.find_last_not_of(" ") + 1);
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos) return 200;
+    std::string first = spec.substr(0, dash);
+    std::string last = spec.substr(dash + 1);
+    if (first.find_first_not_of("0123456789") != std::string::npos ||
+        last.find_first_not_of("0123456789") != std::string::npos ||
+        (first.empty() && last.empty()))
+      return 200;
+    off_t begin = 0;
+    off_t end = 0;
+    std::stringstream(first) >> begin;
+    std::stringstream(last) >> end;
+    if (first.empty()) {  // suffix, the last n bytes
+      if (end == 0 || size == 0) continue;
+      begin = size > end ? size - end : 0;
+      end = size - 1;
+    } else {
+      if (last.empty() == false && end < begin) return 200;
+      if (begin >= size) continue;
+      if (last.empty() || end >= size) end = size - 1;
+    }
+    ranges.push_back(std::make_pair(begin, end));
+    if (ranges.size() > MAX_RANGES) return 200;
+  }
+  if (ranges.empty()) {
+    response.setHeaders("Content-Range", "bytes */" + total);
+    throw ErrorException(416);
+  }
+  if (ranges.size() == 1) {
+    FilePart part = {"", ranges[0].first,
+                     static_cast<size_t>(ranges[0].second - ranges[0].first + 1)};
+    parts.push_back(part);
+    response.setHeaders("Content-Type", contentType);
+    response.setHeaders("Content-Range", "bytes " + ftUtos(ranges[0].first) +
+                                             "-" + ftUtos(ranges[0].second) +
+                                             "/" + total);
+    return 206;
+  }
+  static size_t boundaryCnt = 0;  // shared by the file threads
+  std::string boundary = ftUtos(__sync_add_and_fetch(&boundaryCnt, 1));
+  boundary.insert(0, 20 - boundary.size(), '0');
+  for (size_t i = 0; i < ranges.size(); i++) {
+    FilePart part = {"\r\n--" + boundary + "\r\nContent-Type: " + contentType +
+                         "\r\nContent-Range: bytes " + ftUtos(ranges[i].first) +
+                         "-" + ftUtos(ranges[i].second) + "/" + total +
+                         "\r\n\r\n",
+                     ranges[i].first,
+                     static_cast<size_t>(ranges[i].second - ranges[i].first + 1)};
+    parts.push_back(part);
+  }
+  FilePart closing = {"\r\n--" + boundary + "--\r\n", 0, 0};
+  parts.push_back(closing);
+  response.setHeaders("Content-Type",
+                      "multipart/byteranges; boundary=" + boundary);
+  return 206;
+}
+
+// only the header is made here, the write loop sends the body from the file
+void Get::makeFileResponse(Request &request, Response &response,
+                           const std::string &filePath) {
+  struct stat info;
+  std::vector<FilePart> parts;
+  int status = request.getStatus();
+
+  if (stat(filePath.c_str(), &info) == -1) throw ErrorException(404);
+  response.setHeaders("Accept-Ranges", "bytes");
+  if (request.getHeaderByKey("Range") != "" && isIfRangeMatch(request))
+    status = makeRangeParts(request.getHeaderByKey("Range"), info.st_size,
+                            getContentType(request), parts, response);
+  if (parts.empty()) {
+    FilePart part = {"", 0, static_cast<size_t>(info.st_size)};
+    parts.push_back(part);
+    response.setHeaders("Content-Type", getContentType(request));
+  }
+  size_t length = 0;
+  for (size_t i = 0; i < parts.size(); i++)
+    length += parts[i].head.size() + parts[i].size;
+  response.setHeaders("Content-Length", ftUtos(length));
+
+  int fd = open(filePath.c_str(), O_RDONLY);
+  if (fd == -1) throw ErrorException(403);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  response.setStatusLine(status);
+  response.setResult();
+  response.setFileBody(fd, parts);
+}
+
+// conditional requests are answered before the file is read
 void Get::makeResponse(Request &request, Response &response,
                        std::ifstream &file) {
-  makeBody(response, file);
-  makeHeader(request, response);
+  ServerBlock *locBlock = request.getLocBlock();
+  struct stat info;
+
+  if (stat(_path.c_str(), &info) == -1) throw ErrorException(404);
+  if (locBlock->getGzip() == "on" || locBlock->getGzipStatic() == "on")
+    response.setHeaders("Vary", "Accept-Encoding");
+  setCacheHeaders(request, response, info);
+  if (isNotModified(request)) {
+    file.close();
+    response.setStatusLine(304);
+    response.setResult();
+    return;
+  }
+
+  std::string filePath = setGzipBody(request, response, file);
+  file.close();
+  if (response.isInHeader("Content-Encoding")) {  // not the same bytes
+    _etag.insert(0, "W/");
+    response.setHeaders("ETag", _etag);
+  }
+  if (filePath.empty() == false) {
+    makeFileResponse(request, response, filePath);
+    return;
+  }
   response.setStatusLine(request.getStatus());
   response.setResult();
 }
 
+bool Get::isFileWork(Request &request) {
+  (void)request;
+  return true;
+}
+
 void Get::process(Request &request, Response &response) {
   try {
     std::string fullUri = request.getHeaderByKey("RootDir");
     fullUri += request.getHeaderByKey("CuttedURI");
-    if (fullUri.back() == '/') {
+    if (fullUri[fullUri.size() - 1] == '/') {
       if (request.getHeaderByKey("Index") != "") {
         std::stringstream ss(request.getHeaderByKey("Index"));
         std::string token;
@@ -54,9 +290,13 @@ void Get::process(Request &request, Response &response) {
         makeResponse(request, response, tmp);
         return;
       }
-      if (request.getHeaderByKey("AutoIndex") == "on")
-        response.directoryListing(fullUri);
-      else
+      if (request.getHeaderByKey("AutoIndex") == "on") {
+        response.directoryListing(
+            fullUri, request.getHeaderByKey("RawURI"),
+            request.getLocBlock()->getAutoindexFormat() == "json",
+            request.getHeaderByKey("protocol") == "HTTP/1.1");
+        if (response.hasResult() == false) throw ErrorException(500);
+      } else
         throw ErrorException(404);
     } else if (request.getMime() == "directory") {
       std::string tmp = request.getHeaderByKey("RawURI");
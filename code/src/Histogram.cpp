@@ -0,0 +1,49 @@
+#include "../includes/Histogram.hpp"
+
+Histogram::Histogram() : _total(0), _max(0) {
+  for (size_t i = 0; i < HIST_BUCKETS; i++) _counts[i] = 0;
+}
+
+Histogram::~Histogram() {}
+
+// values below HIST_SUB_CNT are exact, above that every power of two is
+// split into HIST_SUB_CNT linear buckets
+size_t Histogram::bucketOf(unsigned long value) {
+  if (value < HIST_SUB_CNT) return value;
+  size_t msb = HIST_SUB_BITS;
+  while (value >> (msb + 1)) msb++;
+  size_t shift = msb - HIST_SUB_BITS;
+  size_t bucket = (shift + 1) * HIST_SUB_CNT + (value >> shift) - HIST_SUB_CNT;
+  return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+// highest value that falls into the bucket
+unsigned long Histogram::valueOf(size_t bucket) {
+  if (bucket < HIST_SUB_CNT) return bucket;
+  size_t shift = bucket / HIST_SUB_CNT - 1;
+  unsigned long base = bucket % HIST_SUB_CNT + HIST_SUB_CNT;
+  return ((base + 1) << shift) - 1;
+}
+
+void Histogram::record(unsigned long value) {
+  _counts[bucketOf(value)]++;
+  _total++;
+  if (value > _max) _max = value;
+}
+
+// percent in 0 ~ 100, 0 if nothing is recorded
+unsigned long Histogram::percentile(double percent) const {
+  if (_total == 0) return 0;
+  size_t rank = static_cast<size_t>(percent / 100 * _total + 0.5);
+  if (rank == 0) rank = 1;
+  size_t seen = 0;
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    seen += _counts[i];
+    if (seen >= rank) return valueOf(i) < _max ? valueOf(i) : _max;
+  }
+  return _max;
+}
+
+size_t Histogram::getCount() const { return _total; }
+
+unsigned long Histogram::getMax() const { return _max; }
@@ -0,0 +1,408 @@
+#include "../includes/Hpack.hpp"
+
+#define STATIC_TABLE_SIZE 61
+#define ENTRY_OVERHEAD 32  // added to name and value for the table size
+#define HUFFMAN_EOS 256
+
+// RFC 7541 appendix A, index 1 first
+static const char *STATIC_TABLE[STATIC_TABLE_SIZE][2] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""}
+};
+
+// RFC 7541 appendix B, code and bit length of every symbol
+static const struct {
+  uint32_t code;
+  int size;
+} HUFFMAN_CODES[HUFFMAN_EOS + 1] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},  // EOS
+};
+
+std::vector<HuffmanNode> Hpack::_huffmanTree = Hpack::initHuffmanTree();
+
+std::vector<HuffmanNode> Hpack::initHuffmanTree() {
+  std::vector<HuffmanNode> tree(1);
+
+  tree[0].child[0] = tree[0].child[1] = 0;
+  tree[0].sym = -1;
+  for (int sym = 0; sym <= HUFFMAN_EOS; sym++) {
+    size_t node = 0;
+    for (int bit = HUFFMAN_CODES[sym].size - 1; bit >= 0; bit--) {
+      int side = (HUFFMAN_CODES[sym].code >> bit) & 1;
+      if (tree[node].child[side] == 0) {
+        HuffmanNode next;
+        next.child[0] = next.child[1] = 0;
+        next.sym = -1;
+        tree[node].child[side] = tree.size();
+        tree.push_back(next);
+      }
+      node = tree[node].child[side];
+    }
+    tree[node].sym = sym;
+  }
+  return tree;
+}
+
+Hpack::Hpack()
+    : _size(0),
+      _maxSize(HPACK_TABLE_SIZE),
+      _limit(HPACK_TABLE_SIZE),
+      _isResized(false) {}
+
+// drops the oldest entries until room more bytes fit
+void Hpack::evict(size_t room) {
+  while (_table.empty() == false && _size + room > _maxSize) {
+    const HeaderField &field = _table.back();
+    _size -= ENTRY_OVERHEAD + field.first.size() + field.second.size();
+    _table.pop_back();
+  }
+}
+
+// an entry larger than the table empties it and is not added
+void Hpack::insert(const HeaderField &field) {
+  size_t size = ENTRY_OVERHEAD + field.first.size() + field.second.size();
+
+  if (size > _maxSize) {
+    evict(_maxSize + 1);
+    return;
+  }
+  evict(size);
+  _table.push_front(field);
+  _size += size;
+}
+
+// static entries then the dynamic table, NULL if the index is not in them
+const HeaderField *Hpack::getField(size_t index) const {
+  static std::vector<HeaderField> statics;
+
+  if (statics.empty())
+    for (int i = 0; i < STATIC_TABLE_SIZE; i++)
+      statics.push_back(HeaderField(STATIC_TABLE[i][0], STATIC_TABLE[i][1]));
+  if (index == 0) return NULL;
+  if (index <= STATIC_TABLE_SIZE) return &statics[index - 1];
+  index -= STATIC_TABLE_SIZE + 1;
+  if (index >= _table.size()) return NULL;
+  return &_table[index];
+}
+
+// index of the field or else of its name, 0 if neither is in the tables
+size_t Hpack::findField(const HeaderField &field, bool &isFullMatch) const {
+  size_t nameIndex = 0;
+
+  isFullMatch = false;
+  for (size_t i = 1; i <= STATIC_TABLE_SIZE + _table.size(); i++) {
+    const HeaderField *entry = getField(i);
+    if (entry->first != field.first) continue;
+    if (entry->second == field.second) {
+      isFullMatch = true;
+      return i;
+    }
+    if (nameIndex == 0) nameIndex = i;
+  }
+  return nameIndex;
+}
+
+// values that change with every response would only push out useful entries
+bool Hpack::isIndexable(const std::string &name) {
+  return name != "content-length" && name != "etag" &&
+         name != "last-modified" && name != "content-range" &&
+         name != "location" && name != "set-cookie";
+}
+
+// prefixed integer (RFC 7541 5.1), false if it is cut or too large
+bool Hpack::decodeInt(const std::string &block, size_t &pos, int prefix,
+                      size_t &value) {
+  size_t max = (1 << prefix) - 1;
+
+  if (pos >= block.size()) return false;
+  value = static_cast<uint8_t>(block[pos++]) & max;
+  if (value < max) return true;
+  for (int shift = 0; pos < block.size() && shift <= 21; shift += 7) {
+    uint8_t byte = block[pos++];
+    value += static_cast<size_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+bool Hpack::decodeString(const std::string &block, size_t &pos,
+                         std::string &str) {
+  size_t size;
+
+  if (pos >= block.size()) return false;
+  bool isHuffman = block[pos] & 0x80;
+  if (decodeInt(block, pos, 7, size) == false || size > block.size() - pos)
+    return false;
+  if (isHuffman) {
+    if (decodeHuffman(block.data() + pos, size, str) == false) return false;
+  } else
+    str.assign(block, pos, size);
+  pos += size;
+  return true;
+}
+
+// the padding must be the start of EOS, at most 7 bits of 1
+bool Hpack::decodeHuffman(const char *data, size_t size, std::string &str) {
+  size_t node = 0;
+  int depth = 0;
+  bool isOnes = true;
+
+  str.clear();
+  for (size_t i = 0; i < size; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      int side = (static_cast<uint8_t>(data[i]) >> bit) & 1;
+      node = _huffmanTree[node].child[side];
+      if (node == 0) return false;
+      depth++;
+      isOnes = isOnes && side == 1;
+      if (_huffmanTree[node].sym == -1) continue;
+      if (_huffmanTree[node].sym == HUFFMAN_EOS) return false;
+      str += static_cast<char>(_huffmanTree[node].sym);
+      node = 0;
+      depth = 0;
+      isOnes = true;
+    }
+  }
+  return depth < 8 && isOnes;
+}
+
+void Hpack::encodeInt(std::string &block, uint8_t flags, int prefix,
+                      size_t value) {
+  size_t max = (1 << prefix) - 1;
+
+  if (value < max) {
+    block += static_cast<char>(flags | value);
+    return;
+  }
+  block += static_cast<char>(flags | max);
+  for (value -= max; value >= 0x80; value >>= 7)
+    block += static_cast<char>(0x80 | (value & 0x7f));
+  block += static_cast<char>(value);
+}
+
+// huffman only when it is shorter
+void Hpack::encodeString(std::string &block, const std::string &str) {
+  size_t bits = 0;
+
+  for (size_t i = 0; i < str.size(); i++)
+    bits += HUFFMAN_CODES[static_cast<uint8_t>(str[i])].size;
+  if ((bits + 7) / 8 >= str.size()) {
+    encodeInt(block, 0, 7, str.size());
+    block += str;
+    return;
+  }
+  encodeInt(block, 0x80, 7, (bits + 7) / 8);
+  uint64_t acc = 0;
+  int accBits = 0;
+  for (size_t i = 0; i < str.size(); i++) {
+    const int sym = static_cast<uint8_t>(str[i]);
+    acc = (acc << HUFFMAN_CODES[sym].size) | HUFFMAN_CODES[sym].code;
+    accBits += HUFFMAN_CODES[sym].size;
+    for (; accBits >= 8; accBits -= 8)
+      block += static_cast<char>(acc >> (accBits - 8));
+  }
+  if (accBits > 0)
+    block += static_cast<char>((acc << (8 - accBits)) | (0xff >> accBits));
+}
+
+// false if the block is malformed, the connection can not go on then
+bool Hpack::decode(const std::string &block, std::vector<HeaderField> &fields) {
+  size_t pos = 0;
+  bool isFieldSeen = false;  // size updates only come first
+
+  while (pos < block.size()) {
+    uint8_t byte = block[pos];
+    size_t index;
+
+    if (byte & 0x80) {
+      if (decodeInt(block, pos, 7, index) == false) return false;
+      const HeaderField *field = getField(index);
+      if (field == NULL) return false;
+      fields.push_back(*field);
+    } else if ((byte & 0xe0) == 0x20) {
+      if (isFieldSeen || decodeInt(block, pos, 5, index) == false ||
+          index > _limit)
+        return false;
+      _maxSize = index;
+      evict(0);
+      continue;
+    } else {
+      // with incremental indexing, else without or never indexed
+      bool isIndexed = byte & 0x40;
+      HeaderField field;
+      if (decodeInt(block, pos, isIndexed ? 6 : 4, index) == false)
+        return false;
+      if (index > 0) {
+        const HeaderField *name = getField(index);
+        if (name == NULL) return false;
+        field.first = name->first;
+      } else if (decodeString(block, pos, field.first) == false)
+        return false;
+      if (decodeString(block, pos, field.second) == false) return false;
+      if (isIndexed) insert(field);
+      fields.push_back(field);
+    }
+    isFieldSeen = true;
+  }
+  return true;
+}
+
+void Hpack::encode(const std::vector<HeaderField> &fields,
+                   std::string &block) {
+  if (_isResized) {
+    encodeInt(block, 0x20, 5, _maxSize);
+    _isResized = false;
+  }
+  for (size_t i = 0; i < fields.size(); i++) {
+    bool isFullMatch;
+    size_t index = findField(fields[i], isFullMatch);
+
+    if (isFullMatch) {
+      encodeInt(block, 0x80, 7, index);
+      continue;
+    }
+    bool isIndexed = isIndexable(fields[i].first);
+    if (isIndexed)
+      encodeInt(block, 0x40, 6, index);
+    else
+      encodeInt(block, 0x00, 4, index);
+    if (index == 0) encodeString(block, fields[i].first);
+    encodeString(block, fields[i].second);
+    if (isIndexed) insert(fields[i]);
+  }
+}
+
+// encoder: the peer's SETTINGS_HEADER_TABLE_SIZE, the table is never larger
+// than the default even if the peer allows it
+void Hpack::setLimit(size_t limit) {
+  size_t maxSize = limit < HPACK_TABLE_SIZE ? limit : HPACK_TABLE_SIZE;
+
+  _limit = limit;
+  if (maxSize == _maxSize) return;
+  _maxSize = maxSize;
+  evict(0);
+  _isResized = true;
+}
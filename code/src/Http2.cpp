@@ -0,0 +1,761 @@
+#include "../includes/Http2.hpp"
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+#define DEFAULT_WINDOW 65535
+#define WINDOW_MAX 2147483647
+
+static uint32_t readUint32(const char *data) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+
+  return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void writeUint32(char *data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static void writeHead(char *head, size_t size, uint8_t type, uint8_t flags,
+                      uint32_t id) {
+  head[0] = size >> 16;
+  head[1] = size >> 8;
+  head[2] = size;
+  head[3] = type;
+  head[4] = flags;
+  writeUint32(head + 5, id);
+}
+
+// HTTP2-Settings is base64url without padding
+static bool decodeBase64Url(const std::string &text, std::string &data) {
+  const std::string chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  uint32_t acc = 0;
+  int bits = 0;
+
+  for (size_t i = 0; i < text.size() && text[i] != '='; i++) {
+    size_t value = chars.find(text[i]);
+    if (text[i] == '+') value = 62;
+    if (text[i] == '/') value = 63;
+    if (value == std::string::npos) return false;
+    acc = acc << 6 | value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      data += static_cast<char>(acc >> bits);
+    }
+  }
+  return true;
+}
+
+// hop-by-hop headers have no meaning in http2
+static bool isConnectionHeader(const std::string &name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade";
+}
+
+// names are lowercase, neither may break the HTTP/1.1 form of the request
+static bool isValidField(const HeaderField &field) {
+  const std::string &name = field.first;
+
+  if (name.empty()) return false;
+  for (size_t i = 0; i < name.size(); i++)
+    if ((name[i] >= 'A' && name[i] <= 'Z') || name[i] == '\r' ||
+        name[i] == '\n' || name[i] == '\0' || name[i] == ' ' ||
+        (name[i] == ':' && i > 0))
+      return false;
+  return field.second.find_first_of(std::string("\r\n\0", 3)) ==
+         std::string::npos;
+}
+
+// "content-type" is "Content-Type" for the HTTP/1.1 parser
+static std::string canonicalName(const std::string &name) {
+  std::string canon = name;
+
+  for (size_t i = 0; i < canon.size(); i++)
+    if ((i == 0 || canon[i - 1] == '-') && canon[i] >= 'a' && canon[i] <= 'z')
+      canon[i] = canon[i] - 'a' + 'A';
+  return canon;
+}
+
+Http2::Http2(const std::string &clientIp)
+    : _clientIp(clientIp),
+      _outSent(0),
+      _sendWindow(DEFAULT_WINDOW),
+      _recvUnacked(0),
+      _peerWindow(DEFAULT_WINDOW),
+      _peerFrameMax(H2_FRAME_MAX),
+      _lastId(0),
+      _nextId(0),
+      _blockId(0),
+      _isBlockEnd(false),
+      _isPrefaceRead(false),
+      _isGoingAway(false),
+      _isBroken(false) {}
+
+// requests still being read, the others belong to the client queue
+Http2::~Http2() {
+  for (std::map<uint32_t, H2Stream>::iterator it = _streams.begin();
+       it != _streams.end(); it++)
+    if (it->second.res == NULL) delete it->second.req;
+}
+
+// 1 if raw starts with the client preface, 0 if it may once more bytes come,
+// -1 if it is HTTP/1
+int Http2::matchPreface(const std::string &raw) {
+  size_t size = raw.size() < H2_PREFACE_SIZE ? raw.size() : H2_PREFACE_SIZE;
+
+  if (raw.compare(0, size, H2_PREFACE, size) != 0) return -1;
+  return size == H2_PREFACE_SIZE ? 1 : 0;
+}
+
+// prior knowledge, the client preface is next in the read buffer
+void Http2::start() { putPreface(); }
+
+// h2c: the request that asked for it becomes stream 1 and is answered after
+// 101. false if its HTTP2-Settings can not be read
+bool Http2::upgrade(Request *req) {
+  std::string settings;
+
+  if (decodeBase64Url(req->getHeaderByKey("HTTP2-Settings"), settings) ==
+          false ||
+      applySettings(settings.data(), settings.size()) == false)
+    return false;
+  _out = "HTTP/1.1 101 Switching Protocols\r\n";
+  _out += "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+  putPreface();
+  addStream(1, req).isRemoteEnd = true;
+  _lastId = 1;
+  return true;
+}
+
+void Http2::putFrame(uint8_t type, uint8_t flags, uint32_t id,
+                     const char *payload, size_t size) {
+  char head[H2_HEAD_SIZE];
+
+  writeHead(head, size, type, flags, id);
+  _out.append(head, H2_HEAD_SIZE);
+  _out.append(payload, size);
+}
+
+// our SETTINGS and the larger connection window, the first frames we send
+void Http2::putPreface() {
+  char settings[12];
+
+  settings[0] = 0;
+  settings[1] = 3;  // SETTINGS_MAX_CONCURRENT_STREAMS
+  writeUint32(settings + 2, H2_MAX_STREAMS);
+  settings[6] = 0;
+  settings[7] = 4;  // SETTINGS_INITIAL_WINDOW_SIZE
+  writeUint32(settings + 8, H2_WINDOW);
+  putFrame(H2_SETTINGS, 0, 0, settings, sizeof(settings));
+  putWindowUpdate(0, H2_WINDOW - DEFAULT_WINDOW);
+}
+
+void Http2::putWindowUpdate(uint32_t id, size_t increment) {
+  char payload[4];
+
+  writeUint32(payload, increment);
+  putFrame(H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+void Http2::putReset(uint32_t id, e_h2Error code) {
+  char payload[4];
+
+  writeUint32(payload, code);
+  putFrame(H2_RST_STREAM, 0, id, payload, sizeof(payload));
+}
+
+// no new streams after this. an error also ends the connection once the
+// frame is written
+void Http2::goAway(e_h2Error code) {
+  char payload[8];
+
+  if (_isBroken || (_isGoingAway && code == H2_NO_ERROR)) return;
+  writeUint32(payload, _lastId);
+  writeUint32(payload + 4, code);
+  putFrame(H2_GOAWAY, 0, 0, payload, sizeof(payload));
+  _isGoingAway = true;
+  if (code != H2_NO_ERROR) _isBroken = true;
+}
+
+// reads every complete frame, returns the bytes consumed. after a
+// connection error the rest is dropped
+size_t Http2::receive(const char *data, size_t size) {
+  size_t pos = 0;
+
+  if (_isBroken) return size;
+  if (_isPrefaceRead == false) {
+    if (size < H2_PREFACE_SIZE) return 0;
+    if (memcmp(data, H2_PREFACE, H2_PREFACE_SIZE) != 0) {
+      goAway(H2_PROTOCOL_ERROR);
+      return size;
+    }
+    _isPrefaceRead = true;
+    pos = H2_PREFACE_SIZE;
+  }
+  while (_isBroken == false && size - pos >= H2_HEAD_SIZE) {
+    const uint8_t *head = reinterpret_cast<const uint8_t *>(data + pos);
+    size_t length = head[0] << 16 | head[1] << 8 | head[2];
+    if (length > H2_FRAME_MAX) {
+      goAway(H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if (size - pos < H2_HEAD_SIZE + length) break;
+    readFrame(head[3], head[4], readUint32(data + pos + 5) & 0x7fffffff,
+              data + pos + H2_HEAD_SIZE, length);
+    pos += H2_HEAD_SIZE + length;
+  }
+  return _isBroken ? size : pos;
+}
+
+// unknown frame types are ignored
+void Http2::readFrame(uint8_t type, uint8_t flags, uint32_t id,
+                      const char *data, size_t size) {
+  if (_blockId != 0 && type != H2_CONTINUATION)
+    goAway(H2_PROTOCOL_ERROR);
+  else if (type == H2_DATA)
+    readData(flags, id, data, size);
+  else if (type == H2_HEADERS)
+    readHeaders(flags, id, data, size);
+  else if (type == H2_CONTINUATION)
+    readContinuation(flags, id, data, size);
+  else if (type == H2_SETTINGS)
+    readSettings(flags, id, data, size);
+  else if (type == H2_WINDOW_UPDATE)
+    readWindowUpdate(id, data, size);
+  else if (type == H2_RST_STREAM)
+    readReset(id, data, size);
+  else if (type == H2_PING) {
+    if (id != 0)
+      goAway(H2_PROTOCOL_ERROR);
+    else if (size != 8)
+      goAway(H2_FRAME_SIZE_ERROR);
+    else if ((flags & FLAG_ACK) == 0)
+      putFrame(H2_PING, FLAG_ACK, 0, data, size);
+  } else if (type == H2_PRIORITY) {
+    if (id == 0)
+      goAway(H2_PROTOCOL_ERROR);
+    else if (size != 5)
+      goAway(H2_FRAME_SIZE_ERROR);
+  } else if (type == H2_GOAWAY) {
+    if (id != 0)
+      goAway(H2_PROTOCOL_ERROR);
+    else
+      _isGoingAway = true;
+  } else if (type == H2_PUSH_PROMISE)
+    goAway(H2_PROTOCOL_ERROR);
+}
+
+// drops the pad length and the padding, false on a connection error
+bool Http2::stripPadding(uint8_t flags, const char *&data, size_t &size) {
+  if ((flags & FLAG_PADDED) == 0) return true;
+  if (size == 0 || static_cast<uint8_t>(data[0]) >= size) {
+    goAway(H2_PROTOCOL_ERROR);
+    return false;
+  }
+  size -= 1 + static_cast<uint8_t>(data[0]);
+  data++;
+  return true;
+}
+
+// the windows count the padding too, half a window read is given back
+void Http2::readData(uint8_t flags, uint32_t id, const char *data,
+                     size_t size) {
+  size_t frameSize = size;
+
+  if (id == 0 || id > _lastId) {
+    goAway(H2_PROTOCOL_ERROR);
+    return;
+  }
+  _recvUnacked += frameSize;
+  if (_recvUnacked > H2_WINDOW) {
+    goAway(H2_FLOW_CONTROL_ERROR);
+    return;
+  }
+  if (_recvUnacked >= H2_WINDOW / 2) {
+    putWindowUpdate(0, _recvUnacked);
+    _recvUnacked = 0;
+  }
+  if (stripPadding(flags, data, size) == false) return;
+  std::map<uint32_t, H2Stream>::iterator it = _streams.find(id);
+  if (it == _streams.end()) return;  // closed, the data is dropped
+  H2Stream &stream = it->second;
+  if (stream.isRemoteEnd) {
+    putReset(id, H2_STREAM_CLOSED);
+    cancel(stream);
+    return;
+  }
+  stream.recvUnacked += frameSize;
+  if (stream.recvUnacked > H2_WINDOW) {
+    putReset(id, H2_FLOW_CONTROL_ERROR);
+    cancel(stream);
+    return;
+  }
+  if (flags & FLAG_END_STREAM)
+    stream.isRemoteEnd = true;
+  else if (stream.recvUnacked >= H2_WINDOW / 2) {
+    putWindowUpdate(id, stream.recvUnacked);
+    stream.recvUnacked = 0;
+  }
+  if (stream.res != NULL) return;  // answered early, the body is not needed
+  if (size > 0) {
+    std::stringstream ss;
+    ss << std::hex << size << "\r\n";
+    stream.req->addRawContents(ss.str().c_str(), ss.str().size());
+    stream.req->addRawContents(data, size);
+    stream.req->addRawContents("\r\n", 2);
+  }
+  if (stream.isRemoteEnd) endBody(stream);
+  _updated.push_back(id);
+}
+
+void Http2::readHeaders(uint8_t flags, uint32_t id, const char *data,
+                        size_t size) {
+  if (id == 0 || id % 2 == 0) {
+    goAway(H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (stripPadding(flags, data, size) == false) return;
+  if (flags & FLAG_PRIORITY) {
+    if (size < 5) {
+      goAway(H2_FRAME_SIZE_ERROR);
+      return;
+    }
+    data += 5;
+    size -= 5;
+  }
+  _blockId = id;
+  _isBlockEnd = flags & FLAG_END_STREAM;
+  _block.assign(data, size);
+  if (flags & FLAG_END_HEADERS) readBlock();
+}
+
+void Http2::readContinuation(uint8_t flags, uint32_t id, const char *data,
+                             size_t size) {
+  if (id == 0 || id != _blockId) {
+    goAway(H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (_block.size() + size > H2_BLOCK_MAX) {
+    goAway(H2_ENHANCE_YOUR_CALM);
+    return;
+  }
+  _block.append(data, size);
+  if (flags & FLAG_END_HEADERS) readBlock();
+}
+
+// a complete header block opens a stream or ends one as trailers. refused
+// streams are decoded too, the table must stay in step with the client
+void Http2::readBlock() {
+  uint32_t id = _blockId;
+  std::vector<HeaderField> fields;
+
+  _blockId = 0;
+  bool isDecoded = _decoder.decode(_block, fields);
+  _block.clear();
+  if (isDecoded == false) {
+    goAway(H2_COMPRESSION_ERROR);
+    return;
+  }
+  std::map<uint32_t, H2Stream>::iterator it = _streams.find(id);
+  if (it != _streams.end()) {
+    H2Stream &stream = it->second;
+    if (stream.isRemoteEnd || _isBlockEnd == false) {
+      putReset(id, H2_PROTOCOL_ERROR);
+      cancel(stream);
+      return;
+    }
+    // trailers, their fields are not passed on
+    stream.isRemoteEnd = true;
+    if (stream.res == NULL) {
+      endBody(stream);
+      _updated.push_back(id);
+    }
+    return;
+  }
+  if (id <= _lastId) return;  // a stream we closed already
+  _lastId = id;
+  if (_isGoingAway) return;
+  if (_streams.size() >= H2_MAX_STREAMS) {
+    putReset(id, H2_REFUSED_STREAM);
+    return;
+  }
+  openStream(id, fields, _isBlockEnd);
+}
+
+// false on a bad value, GOAWAY is queued then
+bool Http2::applySettings(const char *data, size_t size) {
+  if (size % 6 != 0) {
+    goAway(H2_FRAME_SIZE_ERROR);
+    return false;
+  }
+  for (size_t i = 0; i < size; i += 6) {
+    int key = static_cast<uint8_t>(data[i]) << 8 |
+              static_cast<uint8_t>(data[i + 1]);
+    uint32_t value = readUint32(data + i + 2);
+
+    if (key == 1)
+      _encoder.setLimit(value);
+    else if (key == 2 && value > 1) {
+      goAway(H2_PROTOCOL_ERROR);
+      return false;
+    } else if (key == 4) {
+      if (value > WINDOW_MAX) {
+        goAway(H2_FLOW_CONTROL_ERROR);
+        return false;
+      }
+      // open streams move by the difference, they may go negative
+      int64_t delta = static_cast<int64_t>(value) - _peerWindow;
+      for (std::map<uint32_t, H2Stream>::iterator it = _streams.begin();
+           it != _streams.end(); it++)
+        it->second.sendWindow += delta;
+      _peerWindow = value;
+    } else if (key == 5) {
+      if (value < H2_FRAME_MAX || value > 16777215) {
+        goAway(H2_PROTOCOL_ERROR);
+        return false;
+      }
+      _peerFrameMax = value;
+    }
+  }
+  return true;
+}
+
+void Http2::readSettings(uint8_t flags, uint32_t id, const char *data,
+                         size_t size) {
+  if (id != 0) {
+    goAway(H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (flags & FLAG_ACK) {
+    if (size != 0) goAway(H2_FRAME_SIZE_ERROR);
+    return;
+  }
+  if (applySettings(data, size)) putFrame(H2_SETTINGS, FLAG_ACK, 0, "", 0);
+}
+
+void Http2::readWindowUpdate(uint32_t id, const char *data, size_t size) {
+  if (size != 4) {
+    goAway(H2_FRAME_SIZE_ERROR);
+    return;
+  }
+  int64_t increment = readUint32(data) & 0x7fffffff;
+  if (id == 0) {
+    if (increment == 0)
+      goAway(H2_PROTOCOL_ERROR);
+    else if (_sendWindow + increment > WINDOW_MAX)
+      goAway(H2_FLOW_CONTROL_ERROR);
+    else
+      _sendWindow += increment;
+    return;
+  }
+  std::map<uint32_t, H2Stream>::iterator it = _streams.find(id);
+  if (it == _streams.end()) return;
+  if (increment == 0 || it->second.sendWindow + increment > WINDOW_MAX) {
+    putReset(id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+    cancel(it->second);
+    return;
+  }
+  it->second.sendWindow += increment;
+}
+
+void Http2::readReset(uint32_t id, const char *data, size_t size) {
+  (void)data;
+  if (id == 0) {
+    goAway(H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (size != 4) {
+    goAway(H2_FRAME_SIZE_ERROR);
+    return;
+  }
+  std::map<uint32_t, H2Stream>::iterator it = _streams.find(id);
+  if (it != _streams.end()) cancel(it->second);
+}
+
+H2Stream &Http2::addStream(uint32_t id, Request *req) {
+  H2Stream &stream = _streams[id];
+
+  stream.id = id;
+  stream.req = req;
+  stream.res = NULL;
+  stream.sendWindow = _peerWindow;
+  stream.recvUnacked = 0;
+  stream.isRemoteEnd = false;
+  stream.isReady = false;
+  stream.isHeadSent = false;
+  stream.isReset = false;
+  return stream;
+}
+
+// the request line and headers in HTTP/1.1 form. cookies are joined again,
+// a body is announced as chunked, content-length is kept for a cgi
+void Http2::openStream(uint32_t id, const std::vector<HeaderField> &fields,
+                       bool isEnd) {
+  std::string method, path, authority, headers, cookie;
+  bool isMalformed = false;
+  bool isRegularSeen = false;  // pseudo headers only come first
+
+  for (size_t i = 0; i < fields.size() && isMalformed == false; i++) {
+    const std::string &name = fields[i].first;
+    const std::string &value = fields[i].second;
+
+    if (isValidField(fields[i]) == false)
+      isMalformed = true;
+    else if (name[0] == ':') {
+      if (isRegularSeen)
+        isMalformed = true;
+      else if (name == ":method")
+        method = value;
+      else if (name == ":path")
+        path = value;
+      else if (name == ":authority")
+        authority = value;
+      else if (name != ":scheme")
+        isMalformed = true;
+    } else {
+      isRegularSeen = true;
+      if (isConnectionHeader(name) || (name == "te" && value != "trailers"))
+        isMalformed = true;
+      else if (name == "cookie")
+        cookie += (cookie.empty() ? "" : "; ") + value;
+      else if (name == "host") {
+        if (authority.empty()) authority = value;
+      } else if (name != "te" && value.empty() == false)
+        headers += canonicalName(name) + ": " + value + "\r\n";
+    }
+  }
+  if (isMalformed || method.empty() || path.empty() ||
+      path.find(' ') != std::string::npos) {
+    putReset(id, H2_PROTOCOL_ERROR);
+    return;
+  }
+  std::string head = method + " " + path + " HTTP/2.0\r\n";
+  if (authority.empty() == false) head += "Host: " + authority + "\r\n";
+  head += headers;
+  if (cookie.empty() == false) head += "Cookie: " + cookie + "\r\n";
+  if (isEnd == false) head += "Transfer-Encoding: chunked\r\n";
+  head += "\r\n";
+
+  H2Stream &stream = addStream(id, new Request());
+  stream.req->addHeader("ClientIP", _clientIp);
+  stream.req->addRawContents(head.c_str(), head.size());
+  stream.isRemoteEnd = isEnd;
+  _updated.push_back(id);
+}
+
+// END_STREAM is the last chunk
+void Http2::endBody(H2Stream &stream) {
+  stream.req->addRawContents("0\r\n\r\n", 5);
+}
+
+// the stream is over for the client, nothing more is sent on it. a
+// response still being made is dropped once it is ready
+void Http2::cancel(H2Stream &stream) {
+  uint32_t id = stream.id;
+
+  if (stream.res == NULL) {
+    delete stream.req;
+    _streams.erase(id);
+  } else if (stream.isReady) {
+    _finished.push_back(stream.res);
+    _streams.erase(id);
+  } else
+    stream.isReset = true;
+}
+
+// the last frame of the response is queued. a body the client still sends
+// is not needed, an error is always sent
+void Http2::finish(H2Stream &stream, e_h2Error code) {
+  uint32_t id = stream.id;
+
+  if (code != H2_NO_ERROR || stream.isRemoteEnd == false) putReset(id, code);
+  _finished.push_back(stream.res);
+  _streams.erase(id);
+}
+
+void Http2::popUpdated(std::vector<uint32_t> &ids) {
+  ids.swap(_updated);
+  _updated.clear();
+}
+
+// NULL if the stream is gone or its request is complete already
+Request *Http2::getRequest(uint32_t id) {
+  std::map<uint32_t, H2Stream>::iterator it = _streams.find(id);
+
+  if (it == _streams.end() || it->second.res != NULL) return NULL;
+  return it->second.req;
+}
+
+// the request is complete, from now on the client queue owns both
+void Http2::setResponse(uint32_t id, Response *res) {
+  std::map<uint32_t, H2Stream>::iterator it = _streams.find(id);
+
+  if (it != _streams.end()) it->second.res = res;
+}
+
+// the handler of res is done, its frames can be sent
+void Http2::setReady(Response *res) {
+  for (std::map<uint32_t, H2Stream>::iterator it = _streams.begin();
+       it != _streams.end(); it++) {
+    if (it->second.res != res) continue;
+    it->second.isReady = true;
+    if (it->second.isReset) cancel(it->second);
+    return;
+  }
+}
+
+// after h2c the response waits for the client preface, some clients only
+// take a little data with the 101
+bool Http2::canSend(const H2Stream &stream) const {
+  if (stream.isReady == false || _isPrefaceRead == false) return false;
+  return stream.isHeadSent == false ||
+         (_sendWindow > 0 && stream.sendWindow > 0);
+}
+
+// queues frames of the ready streams, one frame of each stream a round so
+// a large body does not hold back the others. stops at H2_OUT_MAX or once
+// the windows are used up
+void Http2::fill() {
+  bool isProgress = true;
+
+  if (_outSent > 0) {
+    _out.erase(0, _outSent);
+    _outSent = 0;
+  }
+  while (isProgress && _out.size() < H2_OUT_MAX) {
+    std::map<uint32_t, H2Stream>::iterator it = _streams.lower_bound(_nextId);
+
+    isProgress = false;
+    for (size_t cnt = _streams.size(); cnt > 0 && _out.size() < H2_OUT_MAX;
+         cnt--) {
+      if (_streams.empty()) break;
+      if (it == _streams.end()) it = _streams.begin();
+      H2Stream &stream = it->second;
+      // the stream may be erased below
+      ++it;
+      _nextId = it == _streams.end() ? 0 : it->first;
+      if (canSend(stream) == false) continue;
+      if (stream.isHeadSent ? sendData(stream) : sendHead(stream))
+        isProgress = true;
+    }
+  }
+}
+
+// the HTTP/1.1 head of the response as HEADERS and CONTINUATION frames,
+// with END_STREAM if there is no body
+bool Http2::sendHead(H2Stream &stream) {
+  std::stringstream head(stream.res->takeHead());
+  std::vector<HeaderField> fields;
+  std::string line;
+
+  std::getline(head, line);
+  fields.push_back(HeaderField(":status", line.substr(9, 3)));
+  while (std::getline(head, line)) {
+    if (line.empty() == false && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string name = line.substr(0, colon);
+    for (size_t i = 0; i < name.size(); i++)
+      if (name[i] >= 'A' && name[i] <= 'Z') name[i] = name[i] - 'A' + 'a';
+    if (isConnectionHeader(name)) continue;
+    size_t start = line.find_first_not_of(' ', colon + 1);
+    fields.push_back(HeaderField(
+        name, start == std::string::npos ? "" : line.substr(start)));
+  }
+
+  std::string block;
+  bool isEnd = stream.res->isFullWrite();
+  _encoder.encode(fields, block);
+  for (size_t pos = 0; pos < block.size();) {
+    size_t size = block.size() - pos;
+    if (size > _peerFrameMax) size = _peerFrameMax;
+    uint8_t flags = pos + size == block.size() ? FLAG_END_HEADERS : 0;
+    if (pos == 0)
+      putFrame(H2_HEADERS, flags | (isEnd ? FLAG_END_STREAM : 0), stream.id,
+               block.data(), size);
+    else
+      putFrame(H2_CONTINUATION, flags, stream.id, block.data() + pos, size);
+    pos += size;
+  }
+  stream.isHeadSent = true;
+  if (isEnd) finish(stream, H2_NO_ERROR);
+  return true;
+}
+
+// the next DATA frame, as large as the windows allow
+bool Http2::sendData(H2Stream &stream) {
+  int64_t size = _peerFrameMax;
+
+  if (size > _sendWindow) size = _sendWindow;
+  if (size > stream.sendWindow) size = stream.sendWindow;
+  size_t start = _out.size();
+  _out.resize(start + H2_HEAD_SIZE + size);
+  ssize_t n = stream.res->readBody(&_out[start + H2_HEAD_SIZE], size);
+  if (n == -1) {
+    _out.resize(start);
+    finish(stream, H2_INTERNAL_ERROR);
+    return true;
+  }
+  _out.resize(start + H2_HEAD_SIZE + n);
+  bool isEnd = stream.res->isFullWrite();
+  if (n == 0 && isEnd == false) {
+    _out.resize(start);
+    return false;
+  }
+  writeHead(&_out[start], n, H2_DATA, isEnd ? FLAG_END_STREAM : 0, stream.id);
+  _sendWindow -= n;
+  stream.sendWindow -= n;
+  if (isEnd) finish(stream, H2_NO_ERROR);
+  return true;
+}
+
+void Http2::popFinished(std::vector<Response *> &responses) {
+  responses.insert(responses.end(), _finished.begin(), _finished.end());
+  _finished.clear();
+}
+
+const char *Http2::getOutData() const { return _out.data() + _outSent; }
+
+size_t Http2::getOutSize() const { return _out.size() - _outSent; }
+
+void Http2::addSent(size_t size) {
+  _outSent += size;
+  if (_outSent < _out.size()) return;
+  _out.clear();
+  _outSent = 0;
+}
+
+bool Http2::wantsWrite() const {
+  if (getOutSize() > 0 || _finished.empty() == false) return true;
+  for (std::map<uint32_t, H2Stream>::const_iterator it = _streams.begin();
+       it != _streams.end(); it++)
+    if (canSend(it->second)) return true;
+  return false;
+}
+
+// the connection can be closed, everything it will ever send is written
+bool Http2::isDone() const {
+  if (getOutSize() > 0) return false;
+  return _isBroken || (_isGoingAway && _streams.empty());
+}
+
+bool Http2::isIdle() const { return _streams.empty(); }
+
+// heap bytes of the frames and of the requests still being read
+size_t Http2::getMemorySize() const {
+  size_t memory = _out.capacity() + _block.capacity();
+
+  for (std::map<uint32_t, H2Stream>::const_iterator it = _streams.begin();
+       it != _streams.end(); it++)
+    if (it->second.res == NULL) memory += it->second.req->getMemorySize();
+  return memory;
+}
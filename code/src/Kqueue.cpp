@@ -1,23 +1,76 @@
 #include "../includes/Kqueue.hpp"
 
+void Connection::reset(int fd, e_fdGroup type) {
+  this->fd = fd;
+  this->type = type;
+  server = NULL;
+  req = NULL;
+  queue.clear();
+  reqCount = 0;
+  acceptTime = 0;
+  isIdle = false;
+  cgiPipes.clear();
+  upstreams.clear();
+  memory = 0;
+  isPaused = false;
+  task = NULL;
+  h2 = NULL;
+  tls = NULL;
+  client = -1;
+  pid = -1;
+  written = 0;
+  cgiReq = NULL;
+  cgiRes = NULL;
+  peer = -1;
+  proxy = NULL;
+}
+
 Kqueue::Kqueue() {
   _checkList = new std::vector<struct kevent>;
-  FD_ZERO(&_fdServer);
-  FD_ZERO(&_fdClient);
-  FD_ZERO(&_fdCGI);
+#ifdef __linux__
+  _poller = NULL;
+#else
+  _kq = -1;
+#endif
 }
 
-Kqueue::~Kqueue() {}
+Kqueue::~Kqueue() {
+  for (size_t i = 0; i < _slots.size(); i++) delete _slots[i];
+  delete _checkList;
+#ifdef __linux__
+  delete _poller;
+#else
+  if (_kq != -1) close(_kq);
+#endif
+}
 
-int Kqueue::init(ServerMap serverMap) {
+// method is the use directive, empty picks the best one of the system
+int Kqueue::init(ServerMap serverMap, const std::string &method) {
+#ifdef __linux__
+  if ((_poller = Poller::create(method)) == NULL) {
+    std::cout << "use " << method << ": cannot start event method\n";
+    return EXIT_FAILURE;
+  }
+  Logger::log(LEVEL_NOTICE,
+              std::string("event method: ") + _poller->getName());
+#else
+  if (method != "" && method != "kqueue") {
+    std::cout << "use " << method << ": only kqueue here\n";
+    return EXIT_FAILURE;
+  }
   if ((_kq = kqueue()) == -1) {
     std::cout << "kqueue() error\n";
     return EXIT_FAILURE;
   }
+#endif
   for (ServerMap::iterator it = serverMap.begin(); it != serverMap.end();
        it++) {
-    changeEvents((*it).first, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-    FD_SET((*it).first, &_fdServer);
+    Connection *conn = openConn((*it).first, FD_SERVER);
+    conn->server = (*it).second;
+#ifdef __linux__
+    _poller->listen((*it).first);
+#endif
+    changeEvents((*it).first, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, conn);
   }
   return EXIT_SUCCESS;
 }
@@ -30,12 +83,18 @@ void Kqueue::changeEvents(uintptr_t ident, int16_t filter, uint16_t flags,
   _checkList->push_back(tmp);
 }
 
-int Kqueue::countEvents() {
+// timeout NULL waits until an event comes
+int Kqueue::countEvents(const struct timespec *timeout) {
   int cnt;
+#ifdef __linux__
+  cnt = _poller->kevent(&(*_checkList)[0], _checkList->size(), _eventList,
+                        MAX_EVENTS, timeout);
+#else
   cnt = kevent(_kq, &(*_checkList)[0], _checkList->size(), _eventList,
-               MAX_EVENTS, NULL);
+               MAX_EVENTS, timeout);
+#endif
   if (cnt == -1) {
-    std::cout << "kevent() error\n";
+    Logger::log(LEVEL_ERROR, "kevent() error");
     return -1;
   }
   return cnt;
@@ -43,47 +102,71 @@ int Kqueue::countEvents() {
 
 void Kqueue::clearCheckList() { _checkList->clear(); }
 
+size_t Kqueue::getCheckListSize() const { return _checkList->size(); }
+
 struct kevent *Kqueue::getEventList() { return _eventList; }
 
-void Kqueue::setFdGroup(int fd, e_fdGroup fdGroup) {
-  switch (fdGroup) {
-    case FD_SERVER:
-      FD_SET(fd, &_fdServer);
-      break;
-    case FD_CLIENT:
-      FD_SET(fd, &_fdClient);
-      break;
-    case FD_CGI:
-      FD_SET(fd, &_fdCGI);
-      break;
-    default:
-      break;
-  }
+// a new client of the listening socket fd, -1 if none
+int Kqueue::accept(int fd, sockaddr_in *addr) {
+#ifdef __linux__
+  return _poller->accept(fd, addr);
+#else
+  socklen_t len = sizeof(*addr);
+  return ::accept(fd, reinterpret_cast<struct sockaddr *>(addr), &len);
+#endif
 }
 
-void Kqueue::eraseFdGroup(int fd, e_fdGroup fdGroup) {
-  switch (fdGroup) {
-    case FD_SERVER:
-      FD_CLR(fd, &_fdServer);
-      break;
-    case FD_CLIENT:
-      FD_CLR(fd, &_fdClient);
-      break;
-    case FD_CGI:
-      FD_CLR(fd, &_fdCGI);
-      break;
-    default:
-      break;
-  }
+// true if the client socket does its i/o through the ring from now on, see
+// sockRead(). it stays blocking then
+bool Kqueue::attach(int fd) {
+#ifdef __linux__
+  return _poller->attach(fd);
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+// bytes the poller keeps for the attached sockets, see Poller
+size_t Kqueue::getHeldSize() const {
+#ifdef __linux__
+  return _poller->getHeldSize();
+#else
+  return 0;
+#endif
 }
 
-e_fdGroup Kqueue::getFdGroup(int fd) {
-  if (FD_ISSET(fd, &_fdServer)) {
-    return (FD_SERVER);
-  } else if (FD_ISSET(fd, &_fdClient)) {
-    return (FD_CLIENT);
-  } else if (FD_ISSET(fd, &_fdCGI)) {
-    return (FD_CGI);
-  } else
-    return (FD_NONE);
+// the slot of a new fd, cleared of what its previous fd left
+Connection *Kqueue::openConn(int fd, e_fdGroup type) {
+  if (static_cast<size_t>(fd) >= _slots.size())
+    _slots.resize(std::max(static_cast<size_t>(fd) + 1, _slots.size() * 2),
+                  NULL);
+  if (_slots[fd] == NULL) _slots[fd] = new Connection;
+  _slots[fd]->reset(fd, type);
+  return _slots[fd];
 }
+
+// events of this batch may still point at the slot, they see FD_NONE.
+// its read and write changes not applied yet go with it, the number may be
+// taken again before they are and their errors would hit the new fd
+void Kqueue::closeConn(Connection *conn) {
+  size_t kept = 0;
+
+  for (size_t i = 0; i < _checkList->size(); i++)
+    if ((*_checkList)[i].ident != static_cast<uintptr_t>(conn->fd) ||
+        (*_checkList)[i].filter == EVFILT_TIMER)
+      (*_checkList)[kept++] = (*_checkList)[i];
+  _checkList->resize(kept);
+#ifdef __linux__
+  _poller->forget(conn->fd);
+#endif
+  conn->type = FD_NONE;
+}
+
+// NULL if the fd was never opened
+Connection *Kqueue::getConn(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= _slots.size()) return NULL;
+  return _slots[fd];
+}
+
+size_t Kqueue::getSlotCount() const { return _slots.size(); }
@@ -0,0 +1,155 @@
+#include "../includes/Limiter.hpp"
+
+#include <algorithm>
+
+Limiter::Limiter()
+    : _size(0),
+      _used(0),
+      _head(-1),
+      _tail(-1),
+      _delayCnt(0),
+      _reqRejectCnt(0),
+      _connRejectCnt(0),
+      _evictCnt(0) {}
+
+Limiter::~Limiter() {}
+
+// before the first key only, the table does not grow or shrink after it
+void Limiter::setSize(size_t size) {
+  if (_nodes.empty()) _size = size;
+}
+
+// FNV-1a of the zone, the directive the limit comes from, and the key
+uint64_t Limiter::makeHash(int zone, const std::string &key) {
+  uint64_t hash = (static_cast<uint64_t>(0xcbf29ce4) << 32) | 0x84222325;
+  const uint64_t prime = (static_cast<uint64_t>(1) << 40) | 0x1b3;
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&zone);
+
+  for (size_t i = 0; i < sizeof(zone); i++) hash = (hash ^ bytes[i]) * prime;
+  for (size_t i = 0; i < key.size(); i++)
+    hash = (hash ^ static_cast<unsigned char>(key[i])) * prime;
+  return hash;
+}
+
+// the node of a key, made the most recently used. a missing one is added
+// if isAdded, else NULL
+LimitNode *Limiter::find(uint64_t hash, bool isAdded) {
+  if (_nodes.empty()) {
+    if (isAdded == false) return NULL;
+    size_t cnt = std::max(_size / (sizeof(LimitNode) + sizeof(int32_t)),
+                          static_cast<size_t>(1));
+    size_t bucketCnt = 1;
+    while (bucketCnt * 2 <= cnt) bucketCnt *= 2;
+    _nodes.resize(cnt);
+    _buckets.assign(bucketCnt, -1);
+  }
+  int32_t &bucket = _buckets[hash & (_buckets.size() - 1)];
+  int32_t idx = bucket;
+
+  while (idx != -1 && _nodes[idx].hash != hash) idx = _nodes[idx].chain;
+  if (idx == -1 && isAdded == false) return NULL;
+  if (idx != -1) {
+    unlink(idx);
+  } else {
+    if (_used < _nodes.size()) {
+      idx = static_cast<int32_t>(_used++);
+    } else {
+      idx = _tail;
+      unlink(idx);
+      unchain(idx);
+      _evictCnt++;
+    }
+    LimitNode &node = _nodes[idx];
+    node.hash = hash;
+    node.tokens = LIMIT_TOKEN;
+    node.last = 0;
+    node.conns = 0;
+    node.chain = bucket;
+    bucket = idx;
+  }
+  _nodes[idx].prev = -1;
+  _nodes[idx].next = _head;
+  if (_head != -1) _nodes[_head].prev = idx;
+  _head = idx;
+  if (_tail == -1) _tail = idx;
+  return &_nodes[idx];
+}
+
+// out of the recently used list
+void Limiter::unlink(int32_t idx) {
+  LimitNode &node = _nodes[idx];
+
+  if (node.prev != -1)
+    _nodes[node.prev].next = node.next;
+  else
+    _head = node.next;
+  if (node.next != -1)
+    _nodes[node.next].prev = node.prev;
+  else
+    _tail = node.prev;
+}
+
+// out of its bucket
+void Limiter::unchain(int32_t idx) {
+  int32_t *link = &_buckets[_nodes[idx].hash & (_buckets.size() - 1)];
+
+  while (*link != idx) link = &_nodes[*link].chain;
+  *link = _nodes[idx].chain;
+}
+
+// limit_req: a request takes a token, rate of them come back a second, a
+// key holds one at most. the bucket may go burst tokens into debt, such a
+// request waits until its token would have come unless nodelay. past the
+// burst it is rejected and takes nothing. rate is in 1/1000 a second
+bool Limiter::take(uint64_t hash, size_t rate, size_t burst, bool isNodelay,
+                   uint64_t now, uint64_t &wait) {
+  LimitNode &node = *find(hash, true);
+  uint64_t need = LIMIT_TOKEN - node.tokens;  // to a full bucket
+  uint64_t elapsed = now - node.last;
+  int64_t tokens = LIMIT_TOKEN;
+
+  wait = 0;
+  if (elapsed < need * 1000000 / rate)
+    tokens = node.tokens + elapsed * rate / 1000000;
+  tokens -= LIMIT_TOKEN;
+  if (tokens < -static_cast<int64_t>(burst * LIMIT_TOKEN)) {
+    _reqRejectCnt++;
+    return false;
+  }
+  node.tokens = tokens;
+  node.last = now;
+  if (tokens < 0 && isNodelay == false) {
+    wait = -tokens * 1000000 / rate;
+    _delayCnt++;
+  }
+  return true;
+}
+
+// limit_conn: false if the key has limit requests in progress already
+bool Limiter::acquire(uint64_t hash, size_t limit) {
+  LimitNode &node = *find(hash, true);
+
+  if (node.conns >= limit) {
+    _connRejectCnt++;
+    return false;
+  }
+  node.conns++;
+  return true;
+}
+
+// the request is done or dropped
+void Limiter::release(uint64_t hash) {
+  LimitNode *node = find(hash, false);
+
+  if (node != NULL && node->conns > 0) node->conns--;
+}
+
+size_t Limiter::getDelayCnt() const { return _delayCnt; }
+
+size_t Limiter::getReqRejectCnt() const { return _reqRejectCnt; }
+
+size_t Limiter::getConnRejectCnt() const { return _connRejectCnt; }
+
+size_t Limiter::getEvictCnt() const { return _evictCnt; }
+
+size_t Limiter::getKeyCnt() const { return _used; }
@@ -18,6 +18,7 @@ void LocationBlock::setKeyVal(std::string key, std::string value) {
   funcmap["limit_except"] = &LocationBlock::setLimitExcept;
   funcmap["cgi"] = &LocationBlock::setCgi;
   funcmap["cgi_redir"] = &LocationBlock::setCgiRedir;
+  funcmap["proxy_pass"] = &LocationBlock::setProxyPass;
 
   if (funcmap.find(key) != funcmap.end())
     (this->*(funcmap[key]))(value);
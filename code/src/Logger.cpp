@@ -0,0 +1,232 @@
+#include "../includes/Logger.hpp"
+
+std::map<std::string, Logger *> Logger::_loggers;
+std::map<std::string, LogFormat> Logger::_formats = Logger::initFormats();
+Logger *Logger::_errorLog = NULL;
+e_logLevel Logger::_errorLevel = LEVEL_ERROR;
+
+static const char *g_levelNames[] = {"debug", "info",  "notice",
+                                     "warn",  "error", "crit"};
+static std::string g_timeLocal;  // 19/Oct/2026:13:42:50 +0000
+static std::string g_timeError;  // 2026/10/19 13:42:50
+static std::time_t g_timeSecond = 0;
+static pthread_mutex_t g_logLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void updateLogTime() {
+  std::time_t t = std::time(NULL);
+  std::tm tm;
+  char buf[64];
+
+  if (t == g_timeSecond) return;
+  g_timeSecond = t;
+  localtime_r(&t, &tm);
+  std::strftime(buf, sizeof(buf), "%d/%b/%Y:%H:%M:%S %z", &tm);
+  g_timeLocal = buf;
+  std::strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", &tm);
+  g_timeError = buf;
+}
+
+Logger::Logger(const std::string &path)
+    : _path(path), _fd(-1), _lastFlush(std::time(NULL)) {
+  open();
+  if (_fd == -1) throw std::runtime_error("log: cannot open " + path);
+}
+
+Logger::~Logger() {
+  flush();
+  if (_fd > STDERR_FILENO) close(_fd);
+}
+
+// keeps the current file if the new one cannot be opened
+void Logger::open() {
+  if (_path.empty()) {
+    _fd = STDERR_FILENO;
+    return;
+  }
+  int fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd == -1) return;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (_fd > STDERR_FILENO) close(_fd);
+  _fd = fd;
+}
+
+// a line that cannot be written is dropped, the loop never waits for it
+void Logger::flush() {
+  _lastFlush = std::time(NULL);
+  if (_buffer.empty()) return;
+  ssize_t written = write(_fd, _buffer.c_str(), _buffer.size());
+  if (written > 0 && static_cast<size_t>(written) < _buffer.size())
+    _buffer.erase(0, written);
+  else
+    _buffer.clear();
+}
+
+// "stderr" or an empty path is the standard error
+Logger *Logger::get(const std::string &path) {
+  std::string key = path == "stderr" ? "" : path;
+  std::map<std::string, Logger *>::iterator it = _loggers.find(key);
+
+  if (it != _loggers.end()) return it->second;
+  Logger *logger = new Logger(key);
+  _loggers[key] = logger;
+  return logger;
+}
+
+e_logLevel Logger::parseLevel(const std::string &level) {
+  for (int i = LEVEL_DEBUG; i <= LEVEL_CRIT; i++)
+    if (level == g_levelNames[i]) return static_cast<e_logLevel>(i);
+  throw std::runtime_error("error_log: invalid level " + level);
+}
+
+// error_log path [level];
+void Logger::setErrorLog(const std::string &value) {
+  std::stringstream ss(value);
+  std::string path;
+  std::string level;
+
+  ss >> path >> level;
+  _errorLog = get(path);
+  _errorLevel = level.empty() ? LEVEL_ERROR : parseLevel(level);
+}
+
+LogFormat Logger::parseFormat(const std::string &format) {
+  const char *names[] = {"",
+                         "remote_addr",
+                         "time_local",
+                         "request",
+                         "request_method",
+                         "uri",
+                         "host",
+                         "status",
+                         "bytes_sent",
+                         "request_time",
+                         "http_referer",
+                         "http_user_agent"};
+  LogFormat tokens;
+  size_t pos = 0;
+
+  while (pos < format.size()) {
+    LogToken token = {VAR_NONE, ""};
+    if (format[pos] != '$') {
+      size_t end = format.find('$', pos);
+      token.text = format.substr(pos, end - pos);
+      pos = end == std::string::npos ? format.size() : end;
+    } else {
+      size_t end =
+          format.find_first_not_of("abcdefghijklmnopqrstuvwxyz_", pos + 1);
+      std::string var = format.substr(pos + 1, end - pos - 1);
+      for (int i = VAR_REMOTE_ADDR; i <= VAR_USER_AGENT; i++)
+        if (var == names[i]) token.var = static_cast<e_logVar>(i);
+      if (token.var == VAR_NONE)
+        throw std::runtime_error("log_format: unknown variable $" + var);
+      pos = end == std::string::npos ? format.size() : end;
+    }
+    tokens.push_back(token);
+  }
+  return tokens;
+}
+
+std::map<std::string, LogFormat> Logger::initFormats() {
+  std::map<std::string, LogFormat> formats;
+
+  formats["combined"] = parseFormat(
+      "$remote_addr - - [$time_local] \"$request\" $status $bytes_sent "
+      "\"$http_referer\" \"$http_user_agent\"");
+  return formats;
+}
+
+// log_format name '$remote_addr [$time_local] "$request" $status';
+void Logger::addFormat(const std::string &value) {
+  std::stringstream ss(value);
+  std::string name;
+  std::string format;
+
+  ss >> name;
+  std::getline(ss, format);
+  format.erase(0, format.find_first_not_of(" \t"));
+  if (format.size() >= 2 && (format[0] == '\'' || format[0] == '"') &&
+      format[format.size() - 1] == format[0])
+    format = format.substr(1, format.size() - 2);
+  if (name.empty() || format.empty())
+    throw std::runtime_error("log_format: invalid value " + value);
+  _formats[name] = parseFormat(format);
+}
+
+const LogFormat &Logger::getFormat(const std::string &name) {
+  std::map<std::string, LogFormat>::iterator it = _formats.find(name);
+
+  if (it == _formats.end())
+    throw std::runtime_error("access_log: unknown log_format " + name);
+  return it->second;
+}
+
+bool Logger::isLogged(e_logLevel level) { return level >= _errorLevel; }
+
+void Logger::log(e_logLevel level, const std::string &msg) {
+  if (level < _errorLevel) return;
+  pthread_mutex_lock(&g_logLock);
+  if (_errorLog == NULL) _errorLog = get("");
+  updateLogTime();
+  _errorLog->push(g_timeError + " [" + g_levelNames[level] + "] " + msg);
+  pthread_mutex_unlock(&g_logLock);
+}
+
+// the number is only formatted when the level is logged
+void Logger::log(e_logLevel level, const std::string &msg, int value) {
+  if (level < _errorLevel) return;
+  log(level, msg + ftItos(value));
+}
+
+// called by the event loop
+void Logger::flushAll(bool force) {
+  std::time_t now = std::time(NULL);
+
+  pthread_mutex_lock(&g_logLock);
+  for (std::map<std::string, Logger *>::iterator it = _loggers.begin();
+       it != _loggers.end(); it++)
+    if (force || now - it->second->_lastFlush >= LOG_FLUSH_INTERVAL)
+      it->second->flush();
+  pthread_mutex_unlock(&g_logLock);
+}
+
+bool Logger::hasPending() {
+  bool isPending = false;
+
+  pthread_mutex_lock(&g_logLock);
+  for (std::map<std::string, Logger *>::iterator it = _loggers.begin();
+       it != _loggers.end() && isPending == false; it++)
+    isPending = it->second->_buffer.empty() == false;
+  pthread_mutex_unlock(&g_logLock);
+  return isPending;
+}
+
+// for log rotation, the old files can be moved away before this
+void Logger::reopenAll() {
+  pthread_mutex_lock(&g_logLock);
+  for (std::map<std::string, Logger *>::iterator it = _loggers.begin();
+       it != _loggers.end(); it++) {
+    it->second->flush();
+    it->second->open();
+  }
+  pthread_mutex_unlock(&g_logLock);
+}
+
+std::string Logger::getTimeLocal() {
+  pthread_mutex_lock(&g_logLock);
+  updateLogTime();
+  std::string time = g_timeLocal;
+  pthread_mutex_unlock(&g_logLock);
+  return time;
+}
+
+void Logger::append(const std::string &line) {
+  pthread_mutex_lock(&g_logLock);
+  push(line);
+  pthread_mutex_unlock(&g_logLock);
+}
+
+void Logger::push(const std::string &line) {
+  _buffer += line;
+  _buffer += '\n';
+  if (_buffer.size() >= LOG_BUFFER_SIZE) flush();
+}
@@ -7,3 +7,9 @@ void Method::process(Request &request, Response &response) {
   response.setErrorRes(405);
   return;
 }
+
+// true if process() only works on files, it may then run on a file thread
+bool Method::isFileWork(Request &request) {
+  (void)request;
+  return false;
+}
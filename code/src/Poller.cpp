@@ -0,0 +1,260 @@
+#include "../includes/Poller.hpp"
+
+#ifdef __linux__
+#include <algorithm>
+#include <cstring>
+
+#include "../includes/Utils.hpp"
+
+#define EPOLL_BATCH 512  // events taken from one epoll_wait()
+
+static unsigned long getMonotonicMsec() { return getMonotonicUsec() / 1000; }
+
+Poller::Poller() : _signalFd(-1) { sigemptyset(&_signals); }
+
+Poller::~Poller() {
+  if (_signalFd != -1) close(_signalFd);
+}
+
+// method is empty, io_uring or epoll. empty takes io_uring when the kernel
+// allows it and epoll otherwise. NULL if the method cannot start
+Poller *Poller::create(const std::string &method) {
+#ifdef HAS_IO_URING
+  if (method == "" || method == "io_uring") {
+    UringPoller *uring = new UringPoller();
+    if (uring->init()) return uring;
+    delete uring;
+  }
+#endif
+  if (method != "" && method != "epoll") return NULL;
+  EpollPoller *epoll = new EpollPoller();
+  if (epoll->init()) return epoll;
+  delete epoll;
+  return NULL;
+}
+
+Poller::Filters &Poller::getFilters(int fd) {
+  if (static_cast<size_t>(fd) >= _fds.size()) {
+    Filters off = {{false, false}, {NULL, NULL}};
+    _fds.resize(std::max(static_cast<size_t>(fd) + 1, _fds.size() * 2), off);
+  }
+  return _fds[fd];
+}
+
+// an fd that cannot be watched comes back as an EV_ERROR event
+void Poller::setFilter(const struct kevent &change) {
+  Filters &filters = getFilters(change.ident);
+  int i = change.filter == EVFILT_READ ? 0 : 1;
+
+  if (change.flags & (EV_DELETE | EV_DISABLE)) {
+    filters.isOn[i] = false;
+  } else if (change.flags & (EV_ADD | EV_ENABLE)) {
+    filters.isOn[i] = true;
+    filters.udata[i] = change.udata;
+  }
+  int error = update(change.ident);
+  if (error == 0) return;
+  filters.isOn[i] = false;
+  struct kevent event = change;
+  event.flags = EV_ERROR;
+  event.data = error;
+  _errors.push_back(event);
+}
+
+// EV_ADD and EV_ENABLE start the timer again with data msec
+void Poller::setTimer(const struct kevent &change) {
+  std::map<uintptr_t, Timer>::iterator it = _timers.find(change.ident);
+
+  if (it != _timers.end())
+    _deadlines.erase(std::make_pair(it->second.deadline, change.ident));
+  if (change.flags & EV_DELETE) {
+    if (it != _timers.end()) _timers.erase(it);
+    return;
+  }
+  if ((change.flags & (EV_ADD | EV_ENABLE)) == 0 ||
+      (change.flags & EV_DISABLE))
+    return;
+  Timer &timer = _timers[change.ident];
+  timer.period = std::max(static_cast<intptr_t>(1), change.data);
+  timer.deadline = getMonotonicMsec() + timer.period;
+  timer.udata = change.udata;
+  _deadlines.insert(std::make_pair(timer.deadline, change.ident));
+}
+
+// the signal is blocked and read from the signalfd instead
+void Poller::addSignal(int sig) {
+  sigset_t one;
+
+  sigemptyset(&one);
+  sigaddset(&one, sig);
+  pthread_sigmask(SIG_BLOCK, &one, NULL);
+  sigaddset(&_signals, sig);
+  bool isNew = _signalFd == -1;
+  _signalFd = signalfd(_signalFd, &_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (isNew == false || _signalFd == -1) return;
+  getFilters(_signalFd).isOn[0] = true;
+  update(_signalFd);
+}
+
+int Poller::expireTimers(struct kevent *events, int size) {
+  unsigned long now = getMonotonicMsec();
+  int cnt = 0;
+
+  while (cnt < size && _deadlines.empty() == false &&
+         _deadlines.begin()->first <= now) {
+    uintptr_t ident = _deadlines.begin()->second;
+    Timer &timer = _timers[ident];
+    _deadlines.erase(_deadlines.begin());
+    EV_SET(&events[cnt++], ident, EVFILT_TIMER, 0, 0, 1, timer.udata);
+    timer.deadline = now + timer.period;
+    _deadlines.insert(std::make_pair(timer.deadline, ident));
+  }
+  return cnt;
+}
+
+int Poller::readSignals(struct kevent *events, int size) {
+  struct signalfd_siginfo info;
+  int cnt = 0;
+
+  while (cnt < size && read(_signalFd, &info, sizeof(info)) == sizeof(info))
+    EV_SET(&events[cnt++], info.ssi_signo, EVFILT_SIGNAL, 0, 0, 1, NULL);
+  return cnt;
+}
+
+// until the first timer is due, -1 waits for ever
+int Poller::getWaitMsec(const struct timespec *timeout) {
+  long msec = -1;
+
+  if (timeout != NULL)
+    msec = timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
+  if (_deadlines.empty() == false) {
+    unsigned long now = getMonotonicMsec();
+    unsigned long due = _deadlines.begin()->first;
+    long untilDue = due > now ? static_cast<long>(due - now) : 0;
+    if (msec == -1 || untilDue < msec) msec = untilDue;
+  }
+  return msec;
+}
+
+// kevent() of the BSDs for the filters the loop uses
+int Poller::kevent(const struct kevent *changes, int changeCnt,
+                   struct kevent *events, int eventCnt,
+                   const struct timespec *timeout) {
+  for (int i = 0; i < changeCnt; i++) {
+    const struct kevent &change = changes[i];
+    if (change.filter == EVFILT_READ || change.filter == EVFILT_WRITE)
+      setFilter(change);
+    else if (change.filter == EVFILT_TIMER)
+      setTimer(change);
+    else if (change.filter == EVFILT_SIGNAL && (change.flags & EV_ADD))
+      addSignal(change.ident);
+  }
+  // like kqueue, errors of the changes come back without waiting
+  if (_errors.empty() == false) {
+    int cnt = std::min(eventCnt, static_cast<int>(_errors.size()));
+    std::copy(_errors.begin(), _errors.begin() + cnt, events);
+    _errors.erase(_errors.begin(), _errors.begin() + cnt);
+    return cnt;
+  }
+  int cnt = wait(events, eventCnt, getWaitMsec(timeout));
+  if (cnt == -1) return -1;
+  // the signalfd is watched as a read filter, it becomes its signals
+  bool hasSignal = false;
+  for (int i = 0; i < cnt; i++) {
+    if (_signalFd == -1 || static_cast<int>(events[i].ident) != _signalFd)
+      continue;
+    events[i--] = events[--cnt];
+    hasSignal = true;
+  }
+  if (hasSignal) cnt += readSignals(events + cnt, eventCnt - cnt);
+  return cnt + expireTimers(events + cnt, eventCnt - cnt);
+}
+
+// called before the fd is closed, a forked cgi may still hold it open
+void Poller::forget(int fd) {
+  if (static_cast<size_t>(fd) >= _fds.size()) return;
+  _fds[fd].isOn[0] = false;
+  _fds[fd].isOn[1] = false;
+  update(fd);
+}
+
+// a socket the loop listens on
+void Poller::listen(int fd) { (void)fd; }
+
+int Poller::accept(int fd, struct sockaddr_in *addr) {
+  socklen_t len = sizeof(*addr);
+
+  return ::accept(fd, reinterpret_cast<struct sockaddr *>(addr), &len);
+}
+
+// true if the client socket does its i/o through the poller from now on,
+// it stays blocking then
+bool Poller::attach(int fd) {
+  (void)fd;
+  return false;
+}
+
+// heap bytes of the attached sockets, queued to send or received and not
+// read yet. the responses count them as sent already
+size_t Poller::getHeldSize() const { return 0; }
+
+EpollPoller::EpollPoller() : _epfd(-1) {}
+
+EpollPoller::~EpollPoller() {
+  if (_epfd != -1) close(_epfd);
+}
+
+bool EpollPoller::init() {
+  _epfd = epoll_create1(EPOLL_CLOEXEC);
+  return _epfd != -1;
+}
+
+const char *EpollPoller::getName() const { return "epoll"; }
+
+int EpollPoller::update(int fd) {
+  Filters &filters = getFilters(fd);
+  uint32_t mask = 0;
+  struct epoll_event event;
+
+  if (filters.isOn[0]) mask |= EPOLLIN | EPOLLRDHUP;
+  if (filters.isOn[1]) mask |= EPOLLOUT;
+  if (static_cast<size_t>(fd) >= _masks.size()) _masks.resize(fd + 1, 0);
+  if (mask == _masks[fd]) return 0;
+  memset(&event, 0, sizeof(event));
+  event.events = mask;
+  event.data.fd = fd;
+  int op = EPOLL_CTL_MOD;
+  if (mask == 0)
+    op = EPOLL_CTL_DEL;
+  else if (_masks[fd] == 0)
+    op = EPOLL_CTL_ADD;
+  int ret = epoll_ctl(_epfd, op, fd, &event);
+  // the number of an fd closed without forget() was taken again
+  if (ret == -1 && op == EPOLL_CTL_MOD && errno == ENOENT)
+    ret = epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &event);
+  else if (ret == -1 && op == EPOLL_CTL_ADD && errno == EEXIST)
+    ret = epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &event);
+  if (ret == -1 && op != EPOLL_CTL_DEL) return errno;
+  _masks[fd] = mask;
+  return 0;
+}
+
+int EpollPoller::wait(struct kevent *events, int size, int msec) {
+  struct epoll_event ready[EPOLL_BATCH];
+  int n = epoll_wait(_epfd, ready, std::min(size / 2, EPOLL_BATCH), msec);
+  int cnt = 0;
+
+  if (n == -1) return errno == EINTR ? 0 : -1;
+  for (int i = 0; i < n; i++) {
+    int fd = ready[i].data.fd;
+    uint32_t got = ready[i].events;
+    Filters &filters = _fds[fd];
+    if (filters.isOn[0] && (got & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+      EV_SET(&events[cnt++], fd, EVFILT_READ, 0, 0, 0, filters.udata[0]);
+    if (filters.isOn[1] && (got & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+      EV_SET(&events[cnt++], fd, EVFILT_WRITE, 0, 0, 0, filters.udata[1]);
+  }
+  return cnt;
+}
+
+#endif
@@ -27,29 +27,44 @@ std::string Post::generateRandomString() {
 void Post::createResource(Response &response, std::string &fileName,
                           std::string &fullUri) {
     fileName += generateRandomString();
-    std::ifstream tempif(fileName);
+    std::ifstream tempif(fileName.c_str());
     while (tempif.is_open() == true) {
         tempif.close();
         fileName = fullUri;
         fileName += generateRandomString();
-        std::ifstream tempif(fileName);
+        std::ifstream tempif(fileName.c_str());
     }
     response.setHeaders("Location", fileName);
     response.setStatusLine(201);
 }
 
 void Post::appendResource(const std::string &fileName, Request &request) {
-    std::ios::openmode mode = 0;
+    std::ios::openmode mode = std::ios::trunc;
     if (request.getMethod() == "POST")
         mode = std::ios::app;
-    else
-        mode = std::ios::trunc;
-    std::ofstream tempof(fileName, mode);
+    std::ofstream tempof(fileName.c_str(), mode);
     _path = fileName;
-    tempof << request.getBody();
+    if (request.getBodyFd() != -1) {
+        int fd = request.getBodyFd();
+        char buf[BUFFER_CHUNK];
+        ssize_t n;
+        off_t offset = 0;
+        while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+            tempof.write(buf, n);
+            offset += n;
+        }
+    } else
+        tempof << request.getBody();
     tempof.close();
 }
 
+// a cgi needs the loop for its pipes
+bool Post::isFileWork(Request &request) {
+    std::string fullUri = request.getHeaderByKey("RootDir");
+    fullUri += request.getHeaderByKey("CuttedURI");
+    return isCgi(fullUri, request) == false;
+}
+
 void Post::process(Request &request, Response &response) {
     try {
         std::string fullUri = request.getHeaderByKey("RootDir");
@@ -59,9 +74,9 @@ void Post::process(Request &request, Response &response) {
         if (isCgi(fullUri, request) == true) {
             Cgi cgi;
             cgi.reqToEnvp(request.getHeaderMap(), _clientFd);
-            cgi.execute(request.getBody(), _kq, _clientFd);
+            cgi.execute(request, response, _kq, _clientFd);
         } else {
-            if (fileName.back() == '/') {
+            if (fileName[fileName.size() - 1] == '/') {
                 if (request.getMime() != "directory") {
                     throw ErrorException(400);
                 }
@@ -73,7 +88,7 @@ void Post::process(Request &request, Response &response) {
                     response.setHeaders("Location", tmp);
                     throw ErrorException(301);
                 }
-                std::ifstream tempif(fileName);
+                std::ifstream tempif(fileName.c_str());
                 if (tempif.is_open() == false && request.getMethod() == "POST")
                     throw ErrorException(404);
                 tempif.close();
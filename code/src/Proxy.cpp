@@ -0,0 +1,358 @@
+#include "../includes/Proxy.hpp"
+
+// the value of a header in "Name: value\r\n" lines, uppercased. empty if
+// there is none
+static std::string findValue(const std::string &lines,
+                             const std::string &name) {
+  std::stringstream ss(lines);
+  std::string line;
+
+  while (std::getline(ss, line)) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string key = line.substr(0, colon);
+    ftToupper(key);
+    if (key != name) continue;
+    std::string value = line.substr(colon + 1);
+    ftToupper(value);
+    return value;
+  }
+  return "";
+}
+
+// a token of a comma separated list, both uppercased
+static bool hasToken(const std::string &list, const std::string &token) {
+  std::stringstream ss(list);
+  std::string item;
+
+  while (std::getline(ss, item, ',')) {
+    size_t start = item.find_first_not_of(" \t");
+    size_t end = item.find_last_not_of(" \t\r");
+    if (start != std::string::npos &&
+        item.compare(start, end + 1 - start, token) == 0)
+      return true;
+  }
+  return false;
+}
+
+// hop-by-hop headers (RFC 9110 7.6.1) and the ones Connection names are
+// for one connection only, they are not forwarded either way
+static bool isHopByHop(const std::string &name, const std::string &connection) {
+  return name == "CONNECTION" || name == "KEEP-ALIVE" ||
+         name == "PROXY-CONNECTION" || name == "TE" || name == "TRAILER" ||
+         name == "TRANSFER-ENCODING" || name == "UPGRADE" ||
+         name == "PROXY-AUTHENTICATE" || name == "PROXY-AUTHORIZATION" ||
+         hasToken(connection, name);
+}
+
+// splits "Name: value" without the CR, false if it has no colon
+static bool splitHeader(std::string line, std::string &name,
+                        std::string &value) {
+  if (line.empty() == false && line[line.size() - 1] == '\r')
+    line.erase(line.size() - 1);
+  size_t colon = line.find(':');
+  if (colon == std::string::npos || colon == 0) return false;
+  name = line.substr(0, colon);
+  size_t start = line.find_first_not_of(" \t", colon + 1);
+  size_t end = line.find_last_not_of(" \t");
+  value = start == std::string::npos ? "" : line.substr(start, end + 1 - start);
+  return true;
+}
+
+Proxy::Proxy(Request &req, Response &res, bool isTls, bool isReused)
+    : _req(req),
+      _res(res),
+      _outSent(0),
+      _isHeadRead(false),
+      _body(BODY_NONE),
+      _step(CHUNK_SIZE),
+      _remain(0),
+      _isEnd(false),
+      _isKeepAlive(false),
+      _isReused(isReused),
+      _hasReply(false),
+      _isPaused(false) {
+  makeHead(isTls);
+}
+
+// a nonblocking connect, the first write event tells how it went. -1 if it
+// fails right away
+int Proxy::connect(const struct sockaddr_in &addr) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+
+  if (fd == -1) return -1;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (::connect(fd, reinterpret_cast<const struct sockaddr *>(&addr),
+                sizeof(addr)) == -1 &&
+      errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// the request line with the path for the upstream, the headers of the
+// client but the hop-by-hop ones, then X-Forwarded-* and the length of the
+// body, which is no longer chunked
+void Proxy::makeHead(bool isTls) {
+  ServerBlock &locBlock = *_req.getLocBlock();
+  const std::string &raw = _req.getRawHeader();
+  std::string connection = findValue(raw, "CONNECTION");
+  std::string uri = _req.getUri();
+  std::string forwardedFor;
+  bool hasHost = false;
+
+  // absolute-form, only the path goes on
+  if (uri.empty() || uri[0] != '/') {
+    size_t scheme = uri.find("://");
+    size_t pos = uri.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+    uri = pos == std::string::npos ? "/" : uri.substr(pos);
+  }
+  // proxy_pass only exists in locations
+  if (locBlock.getProxyUri().empty() == false) {
+    const std::string &path = static_cast<LocationBlock &>(locBlock).getPath();
+    uri = locBlock.getProxyUri() +
+          uri.substr(std::min(path.size(), uri.size()));
+  }
+  _out = _req.getMethod() + " " + uri + " HTTP/1.1\r\n";
+  std::stringstream ss(raw);
+  std::string line;
+  while (std::getline(ss, line)) {
+    std::string name;
+    std::string value;
+    if (splitHeader(line, name, value) == false) continue;
+    std::string key = name;
+    ftToupper(key);
+    // the body is complete, nobody waits for 100 Continue
+    if (key == "CONTENT-LENGTH" || key == "EXPECT" ||
+        isHopByHop(key, connection))
+      continue;
+    if (key == "X-FORWARDED-FOR") {
+      forwardedFor = value + ", ";
+      continue;
+    }
+    if (key == "HOST") hasHost = true;
+    _out += name + ": " + value + "\r\n";
+  }
+  if (hasHost == false) _out += "Host: " + locBlock.getProxyUpstream() + "\r\n";
+  _out += "X-Forwarded-For: " + forwardedFor +
+          _req.getHeaderByKey("ClientIP") + "\r\n";
+  _out += std::string("X-Forwarded-Proto: ") + (isTls ? "https" : "http") +
+          "\r\n";
+  if (_req.getBodySize() > 0 || _req.getMethod() == "POST" ||
+      _req.getMethod() == "PUT")
+    _out += "Content-Length: " + ftUtos(_req.getBodySize()) + "\r\n";
+  _out += "\r\n";
+}
+
+// the head, then the body from memory or its temp file. bytes written, 0
+// if the socket is full, -1 if the upstream is gone or refused the connect
+ssize_t Proxy::send(int fd) {
+  size_t bodySize = _req.getBodySize();
+  size_t sent = _outSent > _out.size() ? _outSent - _out.size() : 0;
+  ssize_t n;
+
+  if (_req.getBodyFd() == -1) {
+    struct iovec iov[2];
+    int iovCnt = 0;
+    if (_outSent < _out.size()) {
+      iov[iovCnt].iov_base = const_cast<char *>(_out.c_str() + _outSent);
+      iov[iovCnt].iov_len = _out.size() - _outSent;
+      iovCnt++;
+    }
+    if (sent < bodySize) {
+      iov[iovCnt].iov_base = const_cast<char *>(_req.getBody().c_str() + sent);
+      iov[iovCnt].iov_len = bodySize - sent;
+      iovCnt++;
+    }
+    n = writev(fd, iov, iovCnt);
+  } else if (_outSent < _out.size())
+    n = write(fd, _out.c_str() + _outSent, _out.size() - _outSent);
+  else {
+    char buf[BUFFER_CHUNK];
+    ssize_t bytesRead = pread(_req.getBodyFd(), buf,
+                              std::min(sizeof(buf), bodySize - sent), sent);
+    if (bytesRead <= 0) return -1;
+    n = write(fd, buf, bytesRead);
+  }
+  if (n == -1) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+  _outSent += n;
+  return n;
+}
+
+bool Proxy::isSent() const {
+  return _outSent == _out.size() + _req.getBodySize();
+}
+
+// bytes read from the upstream. false if they are no response
+bool Proxy::receive(const char *data, size_t size) {
+  _hasReply = true;
+  if (_isHeadRead && _in.empty()) return readBody(data, size);
+  _in.append(data, size);
+  if (_isHeadRead == false && parseHead() == false) return false;
+  if (_isHeadRead == false) return true;
+  std::string rest;
+  rest.swap(_in);
+  return readBody(rest.data(), rest.size());
+}
+
+// the upstream closed. false if the response is not complete then
+bool Proxy::receiveEnd() {
+  _isKeepAlive = false;
+  if (_isHeadRead && _isEnd == false && _body == BODY_CLOSE) finish();
+  return _isEnd;
+}
+
+// status line and headers, interim 1xx ones are dropped. false if it is no
+// HTTP/1.x response or its head is too big
+bool Proxy::parseHead() {
+  size_t end;
+
+  while ((end = _in.find("\r\n\r\n")) != std::string::npos) {
+    if (_in.compare(0, 7, "HTTP/1.") != 0 || _in.size() < 12 || _in[8] != ' ')
+      return false;
+    int code = std::atoi(_in.c_str() + 9);
+    if (code < 100 || code > 599 || code == 101) return false;
+    if (code >= 200) break;
+    _in.erase(0, end + 4);
+  }
+  if (end == std::string::npos) return _in.size() < PROXY_HEAD_MAX;
+  size_t lineEnd = _in.find("\r\n");
+  int code = std::atoi(_in.c_str() + 9);
+  bool isHttp10 = _in[7] == '0';
+  std::string statusLine = "HTTP/1.1" + _in.substr(8, lineEnd - 8);
+  std::string head = _in.substr(lineEnd + 2, end - lineEnd);
+  _in.erase(0, end + 4);
+
+  std::string connection = findValue(head, "CONNECTION");
+  std::stringstream ss(head);
+  std::string line;
+  HeaderList headers;
+  bool isChunked = false;
+  bool hasLength = false;
+  while (std::getline(ss, line)) {
+    std::string name;
+    std::string value;
+    if (splitHeader(line, name, value) == false) return false;
+    std::string key = name;
+    ftToupper(key);
+    if (key == "TRANSFER-ENCODING") {
+      ftToupper(value);
+      isChunked = hasToken(value, "CHUNKED");
+    } else if (key == "CONTENT-LENGTH") {
+      if (value.empty() ||
+          value.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+      _remain = std::strtoul(value.c_str(), NULL, 10);
+      hasLength = true;
+    }
+    if (isHopByHop(key, connection) == false)
+      headers.push_back(std::make_pair(name, value));
+  }
+  _isHeadRead = true;
+  if (code == 204 || code == 304 || _req.getMethod() == "HEAD")
+    _body = BODY_NONE;
+  else if (isChunked)
+    _body = BODY_CHUNKED;
+  else if (hasLength)
+    _body = BODY_LENGTH;
+  else
+    _body = BODY_CLOSE;
+  // with Transfer-Encoding a Content-Length means nothing
+  if (_body == BODY_CHUNKED)
+    for (HeaderList::iterator it = headers.begin(); it != headers.end();) {
+      std::string key = it->first;
+      ftToupper(key);
+      it = key == "CONTENT-LENGTH" ? headers.erase(it) : it + 1;
+    }
+  _isKeepAlive = _body != BODY_CLOSE &&
+                 hasToken(connection, "CLOSE") == false &&
+                 (isHttp10 == false || hasToken(connection, "KEEP-ALIVE"));
+  // HTTP/1.0 clients get a body of unknown length until the close
+  bool isKnown = _body == BODY_NONE || _body == BODY_LENGTH;
+  bool isHttp11 = _req.getHeaderByKey("protocol") == "HTTP/1.1";
+  _res.setRelay(statusLine, headers, isKnown == false && isHttp11, isKnown);
+  if (_body == BODY_NONE || (_body == BODY_LENGTH && _remain == 0)) finish();
+  return true;
+}
+
+// the body bytes, unframed into the response. a chunk size line or trailer
+// that is not complete waits in _in. bytes after the response are no
+// response, the connection is not reused then
+bool Proxy::readBody(const char *data, size_t size) {
+  const char *end = data + size;
+
+  while (data < end && _isEnd == false) {
+    if (_body != BODY_CHUNKED || _step == CHUNK_DATA) {
+      size_t n = end - data;
+      if (_body != BODY_CLOSE && n > _remain) n = _remain;
+      _res.addRelay(data, n);
+      data += n;
+      if (_body == BODY_CLOSE) continue;
+      _remain -= n;
+      if (_remain > 0) continue;
+      if (_body == BODY_LENGTH)
+        finish();
+      else
+        _step = CHUNK_DATA_END;
+      continue;
+    }
+    const char *lf = std::find(data, end, '\n');
+    if (lf == end) {
+      _in.assign(data, end);
+      return _in.size() < PROXY_LINE_MAX;
+    }
+    std::string line(data, lf);
+    data = lf + 1;
+    if (line.empty() == false && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (_step == CHUNK_SIZE) {
+      size_t digits = line.find_first_not_of("0123456789abcdefABCDEF");
+      if (digits == std::string::npos) digits = line.size();
+      if (digits == 0 || digits > 15) return false;
+      _remain = std::strtoul(line.c_str(), NULL, 16);
+      _step = _remain == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+    } else if (_step == CHUNK_DATA_END) {
+      if (line.empty() == false) return false;
+      _step = CHUNK_SIZE;
+    } else if (line.empty())
+      finish();
+  }
+  if (data < end) _isKeepAlive = false;
+  return true;
+}
+
+// the client gets the end of the body. a connection is only reused once
+// the whole request went out
+void Proxy::finish() {
+  _isEnd = true;
+  if (isSent() == false) _isKeepAlive = false;
+  _res.endRelay(true);
+}
+
+bool Proxy::isEnd() const { return _isEnd; }
+
+bool Proxy::isKeepAlive() const { return _isKeepAlive; }
+
+// a pooled connection that closed before any reply may have been closed by
+// the upstream while idle, the request then goes out again on another one.
+// like nginx only an idempotent method whose body did not go out, the
+// upstream may have acted on any other
+bool Proxy::isRetryable() const {
+  const std::string &method = _req.getMethod();
+
+  if (_isReused == false || _hasReply || _outSent > _out.size()) return false;
+  return method == "GET" || method == "HEAD" || method == "PUT" ||
+         method == "DELETE" || method == "OPTIONS";
+}
+
+bool Proxy::isPaused() const { return _isPaused; }
+
+void Proxy::setPaused(bool isPaused) { _isPaused = isPaused; }
+
+Request &Proxy::getRequest() { return _req; }
+
+Response &Proxy::getResponse() { return _res; }
@@ -1,32 +1,53 @@
 #include "../includes/Request.hpp"
 
 Request::Request()
-    : _mime("text/html"),
+    : _bodySize(0),
+      _bodyFd(-1),
+      _mime("text/html"),
       _status(200),
       _isFullHeader(false),
       _isChunked(false),
       _chunkedSize(0),
       _isFullReq(false),
+      _isBodyLeft(false),
       _locList(NULL),
-      _locBlock(NULL) {
-  _mimeTypes["html"] = "text/html";
-  _mimeTypes["css"] = "text/css";
-  _mimeTypes["js"] = "text/javascript";
-  _mimeTypes["jpg"] = "image/jpeg";
-  _mimeTypes["png"] = "image/png";
-  _mimeTypes["gif"] = "image/gif";
-  _mimeTypes["txt"] = "text/plain";
-  _mimeTypes["pdf"] = "application/pdf";
-  _mimeTypes["json"] = "application/json";
-  _mimeTypes["ttf"] = "font/ttf";
-  _mimeTypes["woff"] = "font/woff";
-  _mimeTypes["woff2"] = "font/woff2";
-  _mimeTypes["otf"] = "font/otf";
-  _mimeTypes["else"] = "application/octet-stream";
-  _mimeTypes["directory"] = "directory";
+      _locBlock(NULL),
+      _phaseStart(0),
+      _arrival(0),
+      _limiter(NULL),
+      _limitHash(0),
+      _delayUntil(0) {
+  for (int i = 0; i < PHASE_CNT; i++) _phaseUsec[i] = -1;
 }
 
-Request::~Request() {}
+std::map<std::string, std::string> Request::_mimeTypes =
+    Request::initMimeTypes();
+
+std::map<std::string, std::string> Request::initMimeTypes() {
+  std::map<std::string, std::string> mimeTypes;
+
+  mimeTypes["html"] = "text/html";
+  mimeTypes["css"] = "text/css";
+  mimeTypes["js"] = "text/javascript";
+  mimeTypes["jpg"] = "image/jpeg";
+  mimeTypes["png"] = "image/png";
+  mimeTypes["gif"] = "image/gif";
+  mimeTypes["txt"] = "text/plain";
+  mimeTypes["pdf"] = "application/pdf";
+  mimeTypes["json"] = "application/json";
+  mimeTypes["ttf"] = "font/ttf";
+  mimeTypes["woff"] = "font/woff";
+  mimeTypes["woff2"] = "font/woff2";
+  mimeTypes["otf"] = "font/otf";
+  mimeTypes["else"] = "application/octet-stream";
+  mimeTypes["directory"] = "directory";
+  return mimeTypes;
+}
+
+Request::~Request() {
+  if (_bodyFd != -1) close(_bodyFd);
+  if (_limiter != NULL) _limiter->release(_limitHash);
+}
 
 void Request::parseUrl() {
   std::string uri = _header["URI"];
@@ -41,8 +62,7 @@ void Request::parseUrl() {
   try {
     _header["RawURI"] = uri.substr(pos, uri.find('?', pos) - pos);
   } catch (const std::exception &e) {
-    std::cerr << e.what() << '\n';
-    std::cerr << "substr error" << std::endl;
+    Logger::log(LEVEL_ERROR, std::string("substr error: ") + e.what());
   }
 }
 
@@ -84,20 +104,35 @@ void Request::setHeader() {
   _isFullHeader = true;
 }
 
-void Request::parsing(SPSBList *serverBlockList, LocationMap &locationMap) {
+void Request::parsing(SPSBList *serverBlockList, LocationMap &locationMap,
+                      Limiter &limiter) {
   if (_isFullHeader == false &&
       _rawContents.find("\r\n\r\n") == std::string::npos)
     return;
   else if (_isFullHeader == false) {
+    size_t headerEnd = _rawContents.find("\r\n\r\n") + 4;
+    startPhase();
     setHeader();
-    _rawContents.erase(0, _rawContents.find("\r\n\r\n") + 4);
+    endPhase(PHASE_PARSE);
+    startPhase();
     setLocBlock(serverBlockList, locationMap);
-    setMime();
-  } else if (_header.find("Content-Length") != _header.end() &&
-             static_cast<int>(_rawContents.size()) !=
-                 ftStoi(_header["Content-Length"]))
-    return;
-  else if (_isChunked == true && _rawContents.size() < _chunkedSize)
+    // a request over limit_req or limit_conn goes no further, a body is not
+    // read and the connection closes after the response. proxy_pass looks
+    // at no file, it forwards the header lines as they came
+    if (_status == 200 && limit(limiter) == false) {
+      if (_isChunked || ftStoi(getHeaderByKey("Content-Length")) > 0) {
+        _isFullReq = true;
+        _isBodyLeft = true;
+      }
+    } else if (_locBlock->getProxyPass().empty())
+      setMime();
+    else if (_status == 200) {
+      size_t lineEnd = _rawContents.find("\r\n") + 2;
+      _rawHeader = _rawContents.substr(lineEnd, headerEnd - 2 - lineEnd);
+    }
+    endPhase(PHASE_ROUTE);
+    _rawContents.erase(0, headerEnd);
+  } else if (_isChunked == true && _rawContents.size() < _chunkedSize)
     return;
 
   if (_isFullHeader == true && _isFullReq == false) {
@@ -109,7 +144,7 @@ void Request::parsing(SPSBList *serverBlockList, LocationMap &locationMap) {
         _rawContents.erase(0, _rawContents.find("\r\n") + 2);
       }
       while (_rawContents.size() >= _chunkedSize) {
-        _body.append(_rawContents.c_str(), _chunkedSize - 2);  // CRLF 제외
+        appendBody(_rawContents.c_str(), _chunkedSize - 2);  // CRLF 제외
         _rawContents.erase(0, _chunkedSize);
         if (_chunkedSize == 2) {
           _isFullReq = true;
@@ -125,7 +160,7 @@ void Request::parsing(SPSBList *serverBlockList, LocationMap &locationMap) {
           break;
         }
       }
-      if (_body.size() > _locBlock->getClientMaxBodySize()) {
+      if (_bodySize > _locBlock->getClientMaxBodySize()) {
         _status = 413;
         _isFullReq = true;
       }
@@ -135,10 +170,72 @@ void Request::parsing(SPSBList *serverBlockList, LocationMap &locationMap) {
         _status = 413;
         _isFullReq = true;
       }
-      _body += _rawContents;
-      if (_body.size() == conLen) _isFullReq = true;
-      _rawContents.clear();
+      // only this request's body, the next pipelined request stays in place
+      size_t need = conLen - _bodySize;
+      if (need > _rawContents.size()) need = _rawContents.size();
+      appendBody(_rawContents.c_str(), need);
+      _rawContents.erase(0, need);
+      if (_bodySize == conLen) _isFullReq = true;
+    }
+  }
+}
+
+// limit_conn, then limit_req of the location. false if it is turned away,
+// its status is 503 or 429 then. within the burst it may be held back
+bool Request::limit(Limiter &limiter) {
+  ServerBlock &block = *_locBlock;
+
+  if (block.getLimitConn() == 0 && block.getLimitRate() == 0) return true;
+  std::string key = getLimitKey();
+  if (key.empty()) return true;  // like nginx, an empty key is not limited
+  if (block.getLimitConn() > 0) {
+    uint64_t hash = Limiter::makeHash(block.getLimitConnZone(), key);
+    if (limiter.acquire(hash, block.getLimitConn()) == false) {
+      _status = 503;
+      return false;
+    }
+    _limiter = &limiter;
+    _limitHash = hash;
+  }
+  if (block.getLimitRate() > 0) {
+    unsigned long now = getMonotonicUsec();
+    uint64_t wait;
+    if (limiter.take(Limiter::makeHash(block.getLimitReqZone(), key),
+                     block.getLimitRate(), block.getLimitBurst(),
+                     block.isLimitNodelay(), now, wait) == false) {
+      _status = 429;
+      return false;
     }
+    if (wait > 0) _delayUntil = now + wait;
+  }
+  return true;
+}
+
+// the client address or the limit_key header, its name in any case
+std::string Request::getLimitKey() {
+  const std::string &name = _locBlock->getLimitKey();
+
+  if (name.empty()) return getHeaderByKey("ClientIP");
+  for (std::map<std::string, std::string>::iterator it = _header.begin();
+       it != _header.end(); it++)
+    if (strcasecmp(it->first.c_str(), name.c_str()) == 0) return it->second;
+  return "";
+}
+
+void Request::appendBody(const char *data, size_t size) {
+  _bodySize += size;
+  if (_bodyFd == -1) {
+    _body.append(data, size);
+    return;
+  }
+  for (size_t written = 0; written < size;) {
+    ssize_t n = write(_bodyFd, data + written, size - written);
+    if (n <= 0) {
+      _status = 500;
+      _isFullReq = true;
+      return;
+    }
+    written += n;
   }
 }
 
@@ -159,9 +256,9 @@ void Request::setLocBlock(SPSBList *serverBlockList, LocationMap &locationMap) {
   // 요청 호스트와 일치하는 가상호스트가 있다면 그 가상호스트에 있는
   // 로케이션블락을 찾아옴, 해당되는 로케이션 블락이 없으면 서버블락
   // 받아옴
-  if (locationMap.find(sb) == locationMap.end())
-    _locBlock = sb;
-  else {
+  // an unmatched uri, or none at all after a 414, stays on the server block
+  _locBlock = sb;
+  if (locationMap.find(sb) != locationMap.end()) {
     _locList = locationMap[sb];
     for (LocationList::iterator it = _locList->begin(); it != _locList->end();
          it++) {
@@ -184,25 +281,62 @@ void Request::setLocBlock(SPSBList *serverBlockList, LocationMap &locationMap) {
 
 void Request::setAutoindex(std::string &value) { _autoindex = value; }
 
-void Request::clear() {
-  _rawContents.clear();
-  std::string clientIp = _header["ClientIP"];
-  _header.clear();
-  _header["ClientIP"] = clientIp;
-  _body.clear();
-  _host.clear();
-  _mime = "text/html";
-  _status = 200;
-  _isFullReq = false;
-  _isChunked = false;
-  _chunkedSize = 0;
-  _isFullHeader = false;
+// hands the bytes after this request over to the next one
+void Request::moveRawContents(Request &next) {
+  next._rawContents.swap(_rawContents);
+  if (next._rawContents.empty() == false) next._arrival = getMonotonicUsec();
 }
 
+// an http2 connection keeps its frames in the raw contents, read ones go
+void Request::consumeRaw(size_t size) { _rawContents.erase(0, size); }
+
 void Request::addRawContents(const char *raw, size_t size) {
+  if (_arrival == 0) _arrival = getMonotonicUsec();
   _rawContents.append(raw, size);
 }
 
+// BUFFER_CHUNK bytes at the end of the raw contents to read() into,
+// commitRaw keeps the ones that were read
+char *Request::prepareRaw(BufferPool &pool) {
+  size_t size = _rawContents.size();
+
+  pool.acquire(_rawContents);
+  _rawContents.resize(size + BUFFER_CHUNK);
+  return &_rawContents[size];
+}
+
+void Request::commitRaw(size_t size) {
+  _rawContents.resize(_rawContents.size() - BUFFER_CHUNK + size);
+  if (size > 0 && _arrival == 0) _arrival = getMonotonicUsec();
+}
+
+// heap bytes held for the raw contents and the body
+size_t Request::getMemorySize() const {
+  return _rawContents.capacity() + _body.capacity() + _rawHeader.capacity();
+}
+
+// moves the body read so far into a temp file, the rest is written there
+// too. only a body still being read is moved
+bool Request::spillBody() {
+  if (_bodyFd != -1 || _isFullHeader == false || _isFullReq) return false;
+  _bodyFd = openSpillFile();
+  if (_bodyFd == -1) return false;
+  _bodySize -= _body.size();
+  appendBody(_body.c_str(), _body.size());
+  std::string().swap(_body);
+  return true;
+}
+
+int Request::getBodyFd() const { return _bodyFd; }
+
+size_t Request::getBodySize() const { return _bodySize; }
+
+// drops what is left to parse, the buffer goes back to the pool
+void Request::releaseRaw(BufferPool &pool) {
+  _rawContents.clear();
+  pool.release(_rawContents);
+}
+
 void Request::setMime() {
   struct stat info;
   std::string fullUri = _locBlock->getRoot();
@@ -217,13 +351,13 @@ void Request::setMime() {
       _mime = _mimeTypes["else"];
   } else {
     if (stat(fullUri.c_str(), &info) != 0) {
-      if (fullUri.back() != '/') {
+      if (fullUri[fullUri.size() - 1] != '/') {
         std::string requestURI = _header["RawURI"].substr(0).append("/");
         for (LocationList::iterator it = _locList->begin();
              it != _locList->end(); it++) {
           if (requestURI.find((*it)->getPath()) != requestURI.npos) {
             requestURI.erase(1, (*it)->getPath().length() - 1);
-            if (requestURI.back() == '/')
+            if (requestURI[requestURI.size() - 1] == '/')
               requestURI.erase(requestURI.length() - 1);
             addHeader("CuttedURI", requestURI);
             _locBlock = *it;
@@ -245,6 +379,18 @@ void Request::setMime() {
   }
 }
 
+// mime type of a file by its extension
+const std::string &Request::findMime(const std::string &path) {
+  size_t lastDotPos = path.rfind('.');
+
+  if (lastDotPos != std::string::npos) {
+    std::map<std::string, std::string>::iterator it =
+        _mimeTypes.find(path.substr(lastDotPos + 1));
+    if (it != _mimeTypes.end()) return it->second;
+  }
+  return _mimeTypes["else"];
+}
+
 void Request::addHeader(std::string key, std::string value) {
   _header[key] = value;
 }
@@ -255,6 +401,8 @@ const std::string &Request::getHost() { return _host; }
 
 std::string &Request::getBody() { return _body; }
 
+const std::string &Request::getRawHeader() const { return _rawHeader; }
+
 ServerBlock *Request::getLocBlock() const { return _locBlock; }
 
 const std::string &Request::getAutoindex() const { return _autoindex; }
@@ -269,6 +417,31 @@ const std::string &Request::getMethod() { return _header["Method"]; }
 
 bool Request::isFullReq() const { return _isFullReq; }
 
+bool Request::isBodyLeft() const { return _isBodyLeft; }
+
+unsigned long Request::getDelayUntil() const { return _delayUntil; }
+
+void Request::clearDelay() { _delayUntil = 0; }
+
+// nothing of this request has arrived yet
+bool Request::isEmpty() const {
+  return _isFullHeader == false && _rawContents.empty();
+}
+
+// HTTP/1.1 keeps the connection unless asked to close, HTTP/1.0 only on request
+bool Request::isKeepAlive() const {
+  std::map<std::string, std::string>::const_iterator it;
+  std::string connection;
+  std::string protocol;
+
+  if ((it = _header.find("Connection")) != _header.end())
+    connection = it->second;
+  if ((it = _header.find("protocol")) != _header.end()) protocol = it->second;
+  ftToupper(connection);
+  if (protocol == "HTTP/1.0") return connection == "KEEP-ALIVE";
+  return connection != "CLOSE";
+}
+
 const std::string &Request::getRawContents() const { return _rawContents; }
 
 const std::string &Request::getHeaderByKey(std::string key) {
@@ -278,3 +451,18 @@ const std::string &Request::getHeaderByKey(std::string key) {
 std::map<std::string, std::string> Request::getHeaderMap() const {
   return _header;
 }
+
+void Request::startPhase() { _phaseStart = getMonotonicUsec(); }
+
+// time since the last startPhase
+void Request::endPhase(e_phase phase) {
+  _phaseUsec[phase] = getMonotonicUsec() - _phaseStart;
+}
+
+void Request::setPhaseTime(e_phase phase, unsigned long usec) {
+  _phaseUsec[phase] = usec;
+}
+
+long Request::getPhaseTime(int phase) const { return _phaseUsec[phase]; }
+
+unsigned long Request::getArrival() const { return _arrival; }
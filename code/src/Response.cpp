@@ -1,43 +1,177 @@
 #include "../includes/Response.hpp"
 
-Response::Response() : _result(NULL), _resultSize(0), _sendCnt(0) {
-  _statusCodes[200] = " OK";
-  _statusCodes[201] = " Created";
-  _statusCodes[202] = " Accepted";
-  _statusCodes[204] = " No Content";
-  _statusCodes[300] = " Multiple Choice";
-  _statusCodes[301] = " Moved Permanently";
-  _statusCodes[303] = " See Other";
-  _statusCodes[304] = " Not Modified";
-  _statusCodes[307] = " Temporary Redirect";
-  _statusCodes[400] = " Bad Request";
-  _statusCodes[401] = " Unauthorized";
-  _statusCodes[403] = " Forbidden";
-  _statusCodes[404] = " Not Found";
-  _statusCodes[405] = " Method Not Allowed";
-  _statusCodes[406] = " Not Acceptable";
-  _statusCodes[408] = " Request Timeout";
-  _statusCodes[409] = " Conflict";
-  _statusCodes[410] = " Gone";
-  _statusCodes[412] = " Precondition Failed";
-  _statusCodes[413] = " Request Entity Too Large";
-  _statusCodes[414] = " URI Too Long";
-  _statusCodes[415] = " Unsupported Media Type";
-  _statusCodes[500] = " Server Error";
+std::map<int, std::string> Response::_statusCodes =
+    Response::initStatusCodes();
+
+std::map<int, std::string> Response::initStatusCodes() {
+  std::map<int, std::string> statusCodes;
+
+  statusCodes[200] = " OK";
+  statusCodes[201] = " Created";
+  statusCodes[202] = " Accepted";
+  statusCodes[204] = " No Content";
+  statusCodes[206] = " Partial Content";
+  statusCodes[300] = " Multiple Choice";
+  statusCodes[301] = " Moved Permanently";
+  statusCodes[303] = " See Other";
+  statusCodes[304] = " Not Modified";
+  statusCodes[307] = " Temporary Redirect";
+  statusCodes[400] = " Bad Request";
+  statusCodes[401] = " Unauthorized";
+  statusCodes[403] = " Forbidden";
+  statusCodes[404] = " Not Found";
+  statusCodes[405] = " Method Not Allowed";
+  statusCodes[406] = " Not Acceptable";
+  statusCodes[408] = " Request Timeout";
+  statusCodes[409] = " Conflict";
+  statusCodes[410] = " Gone";
+  statusCodes[412] = " Precondition Failed";
+  statusCodes[413] = " Request Entity Too Large";
+  statusCodes[414] = " URI Too Long";
+  statusCodes[415] = " Unsupported Media Type";
+  statusCodes[416] = " Range Not Satisfiable";
+  statusCodes[429] = " Too Many Requests";
+  statusCodes[500] = " Server Error";
+  statusCodes[502] = " Bad Gateway";
+  statusCodes[503] = " Service Unavailable";
+  return statusCodes;
+}
+
+std::map<int, std::string> Response::_statusLines =
+    Response::initStatusLines();
+
+std::map<int, std::string> Response::initStatusLines() {
+  std::map<int, std::string> statusLines;
+
+  for (std::map<int, std::string>::iterator it = _statusCodes.begin();
+       it != _statusCodes.end(); it++)
+    statusLines[it->first] = "HTTP/1.1 " + ftItos(it->first) + it->second;
+  return statusLines;
+}
+
+// the tables are only read once they are made, a code they do not have
+// gets the line of 500
+const std::string &Response::getStatusMessage(int code) {
+  std::map<int, std::string>::const_iterator it = _statusCodes.find(code);
+
+  if (it == _statusCodes.end()) it = _statusCodes.find(500);
+  return it->second;
 }
 
+const std::string &Response::getStatusLine(int code) {
+  std::map<int, std::string>::const_iterator it = _statusLines.find(code);
+
+  if (it == _statusLines.end()) it = _statusLines.find(500);
+  return it->second;
+}
+
+char *Response::writeBytes(char *pos, const std::string &str) {
+  memcpy(pos, str.c_str(), str.size());
+  return pos + str.size();
+}
+
+HeaderList::iterator Response::findHeader(const std::string &key) {
+  HeaderList::iterator it = _headers.begin();
+
+  while (it != _headers.end() && it->first != key) it++;
+  return it;
+}
+
+Response::Response()
+    : _result(NULL),
+      _resultSize(0),
+      _sendCnt(0),
+      _locBlock(NULL),
+      _fileFd(-1),
+      _partIdx(0),
+      _partSent(0),
+      _autoIndex(NULL),
+      _isJson(false),
+      _isChunked(true),
+      _indexPos(0),
+      _chunkSent(0),
+      _isIndexEnd(false),
+      _isRelay(false),
+      _isRelayEnd(false),
+      _gzip(NULL),
+      _gzipIn(0),
+      _isGzipEnd(false),
+      _bodySent(0) {}
+
+Response::Response(ServerBlock *locBlock)
+    : _result(NULL),
+      _resultSize(0),
+      _sendCnt(0),
+      _locBlock(locBlock),
+      _fileFd(-1),
+      _partIdx(0),
+      _partSent(0),
+      _autoIndex(NULL),
+      _isJson(false),
+      _isChunked(true),
+      _indexPos(0),
+      _chunkSent(0),
+      _isIndexEnd(false),
+      _isRelay(false),
+      _isRelayEnd(false),
+      _gzip(NULL),
+      _gzipIn(0),
+      _isGzipEnd(false),
+      _bodySent(0) {}
+
 Response::~Response() {
   if (_result != NULL) delete[] _result;
+  if (_fileFd != -1) fileClose(_fileFd);
+  if (_autoIndex != NULL) AutoIndex::release(_autoIndex);
+  if (_gzip != NULL) {
+    deflateEnd(_gzip);
+    delete _gzip;
+  }
+}
+
+// moves a large body into an unlinked temp file, it is sent from there like
+// a static file. false if it stays in memory
+bool Response::spillBody() {
+  if (_body.size() < SPILL_MIN || _sendCnt > 0 || hasStreamBody() ||
+      isInHeader("Content-Length") == false)
+    return false;
+  int fd = openSpillFile();
+  if (fd == -1) return false;
+  for (size_t written = 0; written < _body.size();) {
+    ssize_t n = write(fd, _body.c_str() + written, _body.size() - written);
+    if (n <= 0) {
+      close(fd);
+      return false;
+    }
+    written += n;
+  }
+  FilePart part;
+  part.offset = 0;
+  part.size = _body.size();
+  setFileBody(fd, std::vector<FilePart>(1, part));
+  std::string().swap(_body);
+  setResult();
+  return true;
+}
+
+// heap bytes held for the response, a streamed body is not counted but the
+// deflate state of one is
+size_t Response::getMemorySize() const {
+  size_t size = _body.capacity() + _resultSize + _chunk.capacity();
+
+  if (_gzip != NULL && _isGzipEnd == false) size += GZIP_STATE_SIZE;
+  return size;
 }
 
+// a cgi that gave no header, or could not be run at all, is a 502
 void Response::convertCGI(const std::string &cgiResult) {
   size_t bodystart = cgiResult.find("\r\n\r\n");
   if (bodystart == std::string::npos) {
-    std::cerr << "CGI result error" << std::endl;
-    setStatusLine(500);
-  } else {
-    bodystart += 4;
+    Logger::log(LEVEL_ERROR, "CGI result error");
+    setErrorRes(502);
+    return;
   }
+  bodystart += 4;
 
   std::stringstream headerStream(cgiResult.substr(0, bodystart));
   std::string line;
@@ -52,62 +186,160 @@ void Response::convertCGI(const std::string &cgiResult) {
       if (pos == line.npos) break;
       size_t valueStartPos = line.find_first_not_of(" ", pos + 1);
       size_t keyStartPos = line.find_first_not_of("\n", 0);
-      _headers[line.substr(keyStartPos, pos - keyStartPos)] =
-          line.substr(valueStartPos);
+      setHeaders(line.substr(keyStartPos, pos - keyStartPos),
+                 line.substr(valueStartPos));
     }
   }
   _body = cgiResult.substr(bodystart);
 
   if (_statusLine == "") {
-    if (_headers.find("Status") != _headers.end()) {
+    HeaderList::iterator status = findHeader("Status");
+    if (status != _headers.end()) {
       _statusLine += "HTTP/1.1 ";
-      _statusLine += _headers["Status"];
-      _headers.erase("Status");
+      _statusLine += status->second;
+      _headers.erase(status);
     } else {
       setStatusLine(200);
     }
   }
-  if (_headers.find("Content-Length") == _headers.end()) {
+  if (isInHeader("Content-Length") == false) {
     setHeaders("Content-Length", ftItos(_body.size()));
   }
   setResult();
 }
 
-void Response::directoryListing(std::string path) {
-  DIR *dir;
-  struct dirent *ent;
-
-  if ((dir = opendir(path.c_str())) != NULL) {
-    /* print all the files and directories within directory */
-    while ((ent = readdir(dir)) != NULL) {
-      _body += "<a href=\"";
-      _body += ent->d_name;
-      if (ent->d_type == DT_DIR)
-        _body += "/\">";
-      else if (std::string(&ent->d_name[ent->d_namlen - 5]) != ".html")
-        _body += "\" download>";
-      else
-        _body += "\">";
-      _body += ent->d_name;
-      _body += "</a><br>";
-    }
-    closedir(dir);
-  } else {
-    std::cout << "directory error : " << path.c_str() << std::endl;
-    /* could not open directory */
+// only the header and the first chunk are made here, the rest of the listing
+// is generated while the socket drains
+void Response::directoryListing(const std::string &path,
+                                const std::string &uri, bool isJson,
+                                bool isChunked) {
+  _autoIndex = AutoIndex::acquire(path);
+  if (_autoIndex == NULL) {
+    Logger::log(LEVEL_ERROR, "directory error : " + path);
     return;
   }
-  _headers["Content-Type"] = "text/html";
-  _headers["Content-Length"] = ftItos(_body.size());
+  _isJson = isJson;
+  _isChunked = isChunked;
+  if (isJson)
+    setHeaders("Content-Type", "application/json");
+  else
+    setHeaders("Content-Type", "text/html");
+  if (isChunked)
+    setHeaders("Transfer-Encoding", "chunked");
+  else
+    _connection = "close";  // HTTP/1.0, the end of the body is the close
   setStatusLine(200);
   setResult();
+  makeIndexChunk(_autoIndex->makeHead(uri, isJson));
+}
+
+void Response::makeIndexChunk(std::string data) {
+  _indexPos = _autoIndex->makeEntries(data, _indexPos, _isJson);
+  if (_indexPos == _autoIndex->size()) {
+    data += _autoIndex->makeTail(_isJson);
+    _isIndexEnd = true;
+  }
+  setChunk(data, _isIndexEnd);
 }
 
-int Response::sendResponse(int clientSocket) {
+// the next GZIP_CHUNK of the file deflated into a chunk, empty ones are
+// skipped as they would end the body. false if the file can not be read
+bool Response::makeGzipChunk() {
+  char in[GZIP_CHUNK];
+  char out[GZIP_CHUNK];
+  std::string data;
+
+  while (data.empty() && _isGzipEnd == false) {
+    ssize_t n = pread(_fileFd, in, sizeof(in), _gzipIn);
+    if (n == -1) return false;
+    int flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+    _gzip->next_in = reinterpret_cast<Bytef *>(in);
+    _gzip->avail_in = n;
+    do {
+      _gzip->next_out = reinterpret_cast<Bytef *>(out);
+      _gzip->avail_out = sizeof(out);
+      if (deflate(_gzip, flush) == Z_STREAM_ERROR) return false;
+      data.append(out, sizeof(out) - _gzip->avail_out);
+    } while (_gzip->avail_out == 0);
+    _gzipIn += n;
+    if (flush == Z_FINISH) {
+      deflateEnd(_gzip);
+      _isGzipEnd = true;
+    }
+  }
+  setChunk(data, _isGzipEnd);
+  return true;
+}
+
+// a generated piece of the body to send, framed if the body is chunked
+void Response::setChunk(std::string &data, bool isEnd) {
+  _chunkSent = 0;
+  if (_isChunked == false) {
+    _chunk.swap(data);
+    return;
+  }
+  std::stringstream ss;
+  ss << std::hex << data.size() << "\r\n";
+  _chunk = data.empty() ? "" : ss.str() + data + "\r\n";
+  if (isEnd) _chunk += "0\r\n\r\n";
+}
+
+// the head of an upstream response, its body follows with addRelay(). a
+// body of unknown length is chunked again, or ends with the close
+void Response::setRelay(const std::string &statusLine,
+                        const HeaderList &headers, bool isChunked,
+                        bool hasLength) {
+  _statusLine = statusLine;
+  _headers = headers;  // repeated names like Set-Cookie stay apart
+  _isRelay = true;
+  _isChunked = isChunked;
+  if (isChunked)
+    setHeaders("Transfer-Encoding", "chunked");
+  else if (hasLength == false)
+    _connection = "close";
+  setResult();
+}
+
+// body bytes of the upstream. the sent part of the buffer is dropped once
+// it is half of it
+void Response::addRelay(const char *data, size_t size) {
+  if (size == 0) return;
+  if (_chunkSent > 0 && _chunkSent * 2 >= _chunk.size()) {
+    _chunk.erase(0, _chunkSent);
+    _chunkSent = 0;
+  }
+  if (_isChunked) {
+    std::stringstream ss;
+    ss << std::hex << size << "\r\n";
+    _chunk += ss.str();
+  }
+  _chunk.append(data, size);
+  if (_isChunked) _chunk += "\r\n";
+}
+
+// a body cut short by the upstream is cut short for the client too, the
+// connection closes after it without the last chunk
+void Response::endRelay(bool isComplete) {
+  if (isComplete && _isChunked) _chunk += "0\r\n\r\n";
+  if (isComplete == false) _connection = "close";
+  _isRelayEnd = true;
+}
+
+// relayed bytes not sent yet
+size_t Response::getRelaySize() const { return _chunk.size() - _chunkSent; }
+
+// the head is out and the upstream has not sent more of the body yet
+bool Response::isStalled() const {
+  return _isRelay && _isRelayEnd == false && _sendCnt == _resultSize &&
+         _chunkSent == _chunk.size();
+}
+
+int Response::sendResponse(int clientSocket, Tls *tls) {
   size_t chunk = 32768;
 
   if (_resultSize < chunk + _sendCnt) chunk = _resultSize - _sendCnt;
-  ssize_t bytesWritten = write(clientSocket, _result + _sendCnt, chunk);
+  ssize_t bytesWritten =
+      sockWrite(clientSocket, tls, _result + _sendCnt, chunk);
   if (bytesWritten == -1) {
     // std::cerr << "client write error!" << std::endl;
     return EXIT_FAILURE;
@@ -117,120 +349,329 @@ int Response::sendResponse(int clientSocket) {
   return EXIT_SUCCESS;
 }
 
+ssize_t Response::sendFileRange(int clientSocket, Tls *tls, off_t offset,
+                                size_t size) {
+  if (size > SENDFILE_CHUNK) size = SENDFILE_CHUNK;
+  return sockSendFile(clientSocket, tls, _fileFd, offset, size);
+}
+
+int Response::sendIndexBody(int clientSocket, Tls *tls) {
+  if (_chunkSent == _chunk.size()) makeIndexChunk("");
+  ssize_t bytesWritten =
+      sockWrite(clientSocket, tls, _chunk.c_str() + _chunkSent,
+                _chunk.size() - _chunkSent);
+  if (bytesWritten == -1) return EXIT_FAILURE;
+  _chunkSent += bytesWritten;
+  _bodySent += bytesWritten;
+  return EXIT_SUCCESS;
+}
+
+// a read error cuts the body short, the connection closes
+int Response::sendGzipBody(int clientSocket, Tls *tls) {
+  if (_chunkSent == _chunk.size() && makeGzipChunk() == false) {
+    Logger::log(LEVEL_ERROR, "gzip: cannot read the file");
+    return EXIT_FAILURE;
+  }
+  ssize_t bytesWritten =
+      sockWrite(clientSocket, tls, _chunk.c_str() + _chunkSent,
+                _chunk.size() - _chunkSent);
+  if (bytesWritten == -1) return EXIT_FAILURE;
+  _chunkSent += bytesWritten;
+  _bodySent += bytesWritten;
+  return EXIT_SUCCESS;
+}
+
+int Response::sendRelayBody(int clientSocket, Tls *tls) {
+  ssize_t bytesWritten =
+      sockWrite(clientSocket, tls, _chunk.c_str() + _chunkSent,
+                _chunk.size() - _chunkSent);
+  if (bytesWritten == -1) return EXIT_FAILURE;
+  _chunkSent += bytesWritten;
+  _bodySent += bytesWritten;
+  return EXIT_SUCCESS;
+}
+
+// the body after the header, from the file, the directory listing, the
+// upstream or the file deflated
+int Response::sendStreamBody(int clientSocket, Tls *tls) {
+  if (_isRelay) return sendRelayBody(clientSocket, tls);
+  if (_autoIndex != NULL) return sendIndexBody(clientSocket, tls);
+  if (_gzip != NULL) return sendGzipBody(clientSocket, tls);
+  return sendFileBody(clientSocket, tls);
+}
+
+// sends the file parts after the header, straight from the file offsets
+int Response::sendFileBody(int clientSocket, Tls *tls) {
+  FilePart &part = _fileParts[_partIdx];
+  ssize_t bytesWritten;
+
+  if (_partSent < part.head.size())
+    bytesWritten = sockWrite(clientSocket, tls, part.head.c_str() + _partSent,
+                             part.head.size() - _partSent);
+  else {
+    size_t sent = _partSent - part.head.size();
+    bytesWritten = sendFileRange(clientSocket, tls, part.offset + sent,
+                                 part.size - sent);
+  }
+  if (bytesWritten == -1) return EXIT_FAILURE;
+  _partSent += bytesWritten;
+  _bodySent += bytesWritten;
+  if (_partSent == part.head.size() + part.size) {
+    _partIdx++;
+    _partSent = 0;
+  }
+  return EXIT_SUCCESS;
+}
+
+// http2: the head goes into HEADERS, the body is read after it
+std::string Response::takeHead() {
+  const char *crlf = "\r\n\r\n";
+  char *end = std::search(_result, _result + _resultSize, crlf, crlf + 4);
+  std::string head(_result, end);
+
+  _sendCnt = end + 4 - _result;
+  return head;
+}
+
+// http2: the next body bytes for a DATA frame, from the result, the listing,
+// the upstream, the deflated file or the file parts. -1 if the file can not
+// be read
+ssize_t Response::readBody(char *buf, size_t size) {
+  size_t n;
+
+  if (_sendCnt < _resultSize) {
+    n = std::min(size, _resultSize - _sendCnt);
+    memcpy(buf, _result + _sendCnt, n);
+    _sendCnt += n;
+    return n;
+  }
+  if (_isRelay) {
+    n = std::min(size, _chunk.size() - _chunkSent);
+    memcpy(buf, _chunk.c_str() + _chunkSent, n);
+    _chunkSent += n;
+    _bodySent += n;
+    return n;
+  }
+  if (_autoIndex != NULL) {
+    while (_chunkSent == _chunk.size() && _isIndexEnd == false)
+      makeIndexChunk("");
+    n = std::min(size, _chunk.size() - _chunkSent);
+    memcpy(buf, _chunk.c_str() + _chunkSent, n);
+    _chunkSent += n;
+    _bodySent += n;
+    return n;
+  }
+  if (_gzip != NULL) {
+    if (_chunkSent == _chunk.size() && _isGzipEnd == false &&
+        makeGzipChunk() == false)
+      return -1;
+    n = std::min(size, _chunk.size() - _chunkSent);
+    memcpy(buf, _chunk.c_str() + _chunkSent, n);
+    _chunkSent += n;
+    _bodySent += n;
+    return n;
+  }
+  if (_partIdx == _fileParts.size()) return 0;
+  FilePart &part = _fileParts[_partIdx];
+  if (_partSent < part.head.size()) {
+    n = std::min(size, part.head.size() - _partSent);
+    memcpy(buf, part.head.c_str() + _partSent, n);
+  } else {
+    size_t sent = _partSent - part.head.size();
+    ssize_t bytesRead = pread(_fileFd, buf, std::min(size, part.size - sent),
+                              part.offset + sent);
+    if (bytesRead <= 0) return -1;
+    n = bytesRead;
+  }
+  _partSent += n;
+  _bodySent += n;
+  if (_partSent == part.head.size() + part.size) {
+    _partIdx++;
+    _partSent = 0;
+  }
+  return n;
+}
+
 const std::string &Response::getBody() const { return _body; }
 
-void Response::setRedirectRes(int statusCode) {
-  std::string location = _headers["Location"];
-  _statusLine.clear();
+// copies the preloaded page, only Date and Content-Length are made here
+void Response::setPreparedRes(const ErrorPage &page) {
+  const char *keep[] = {"Location", "Content-Range"};
+  std::string extraHeader;
+  for (size_t i = 0; i < sizeof(keep) / sizeof(keep[0]); i++) {
+    HeaderList::iterator it = findHeader(keep[i]);
+    if (it != _headers.end())
+      extraHeader += it->first + ": " + it->second + "\r\n";
+  }
+  const std::string &date = getCachedTime();
+  std::string length = ftItos(page.getBody().size());
+  const std::string &head = page.getHead();
+  const std::string &body = page.getBody();
+
+  std::string connection;
+
+  if (_connection.empty() == false)
+    connection = "Connection: " + _connection + "\r\n";
+  _statusLine = head.substr(0, head.find("\r\n"));  // kept for the stats
   _headers.clear();
   _body.clear();
+  setHeaders("Content-Length", length);
+  if (_result != NULL) delete[] _result;
+  _sendCnt = 0;
+  _resultSize = head.size() + extraHeader.size() + connection.size() + 6 +
+                date.size() + 18 + length.size() + 4 + body.size();
+  _result = new char[_resultSize + 1];
 
-  _statusLine += "HTTP/1.1 ";
-  _statusLine += ftItos(statusCode).c_str();
-  _statusLine += _statusCodes[statusCode];
-  _headers["Content-Type"] = "text/html";
-  _headers["Location"] = location;
-  _body += "<html>\n<head><title>";
-  _body += ftItos(statusCode);
-  _body += _statusCodes[statusCode];
-  _body += "</title></head>\n<body>\n<center><h1>";
-  _body += ftItos(statusCode);
-  _body += _statusCodes[statusCode];
-  _body +=
-      "</h1></center>\n<hr><center>webserver/1.0.0</center>\n</body>\n</"
-      "html>";
-  _headers["Content-Length"] = ftItos(_body.size());
-  setResult();
+  char *pos = writeBytes(_result, head);
+  pos = writeBytes(pos, extraHeader);
+  pos = writeBytes(pos, connection);
+  memcpy(pos, "Date: ", 6);
+  pos = writeBytes(pos + 6, date);
+  memcpy(pos, "\r\nContent-Length: ", 18);
+  pos = writeBytes(pos + 18, length);
+  memcpy(pos, "\r\n\r\n", 4);
+  pos = writeBytes(pos + 4, body);
+  *pos = '\0';
 }
 
-void Response::setErrorRes(int statusCode) {
-  std::ifstream tmp;
-  std::stringstream ss;
+void Response::setRedirectRes(int statusCode) {
+  setPreparedRes(ErrorPage::getDefault(statusCode));
+}
 
-  _statusLine.clear();
-  _headers.clear();
-  _body.clear();
+void Response::setErrorRes(int statusCode) {
+  const ErrorPage *page = NULL;
 
-  _statusLine += "HTTP/1.1 ";
-  _statusLine += ftItos(statusCode);
-  _statusLine += _statusCodes[statusCode];
-  _headers["Content-Type"] = "text/html";
-  if (statusCode == 404) {
-    tmp.open("./error404.html");
-  } else if (statusCode == 405) {
-    tmp.open("./error405.html");
-  } else if (statusCode == 408) {
-    tmp.open("./error408.html");
-  } else if (statusCode == 413) {
-    tmp.open("./error413.html");
-  } else if (statusCode == 414) {
-    tmp.open("./error414.html");
-  } else if (statusCode == 500) {
-    tmp.open("./error500.html");
-  } else {
-    tmp.open("./error.html");
-  }
-  if (tmp.is_open()) {
-    ss << tmp.rdbuf();
-    setBody(ss);
-  } else {
-    _statusLine.clear();
-    statusCode = 500;
-    _statusLine += "HTTP/1.1 ";
-    _statusLine += ftItos(statusCode);
-    _statusLine += _statusCodes[statusCode];
-    _headers["Content-Type"] = "text/plain";
-    _body += _statusCodes[statusCode];
-    _body += ": Error";
-  }
-  if (statusCode == 408) {
-    _headers["Connection"] = "close";
-  }
-  _headers["Content-Length"] = ftItos(_body.size());
-  setResult();
+  if (_locBlock != NULL) page = _locBlock->getErrorPage(statusCode);
+  if (page == NULL) page = &ErrorPage::getDefault(statusCode);
+  setPreparedRes(*page);
 }
 
 bool Response::isInHeader(const std::string &key) {
-  if (_headers.find(key) == _headers.end()) return false;
-  return true;
+  return findHeader(key) != _headers.end();
 }
 
+// status line, Date, then headers in the order they were set
 void Response::setResult() {
-  _headers["Date"] = getCurrentTime();
-  std::string resultHeader;
+  if (_connection.empty() == false) setHeaders("Connection", _connection);
+  const std::string &date = getCachedTime();
+  bool hasDate = isInHeader("Date");
+  size_t headerSize = _statusLine.size() + 2 + 2;
 
-  resultHeader += _statusLine;
-  resultHeader += "\r\n";
-
-  std::map<std::string, std::string>::iterator it;
-  for (it = _headers.begin(); _headers.end() != it; it++) {
-    resultHeader += it->first;
-    resultHeader += ": ";
-    resultHeader += it->second;
-    resultHeader += "\r\n";
-  }
-  resultHeader += "\r\n";
+  if (hasDate == false) headerSize += 6 + date.size() + 2;
+  for (HeaderList::iterator it = _headers.begin(); it != _headers.end(); it++)
+    headerSize += it->first.size() + 2 + it->second.size() + 2;
 
-  _resultSize = resultHeader.size() + _body.size();
+  if (_result != NULL) delete[] _result;
+  _sendCnt = 0;
+  _resultSize = headerSize + _body.size();
   _result = new char[_resultSize + 1];
-  memcpy(_result, resultHeader.c_str(), resultHeader.size());
-  memcpy(_result + resultHeader.size(), _body.c_str(), _body.size());
-  _result[_resultSize] = '\0';
-}
 
-void Response::setStatusLine(int code) {
-  _statusLine += "HTTP/1.1 ";
-  _statusLine += ftItos(code);
-  _statusLine += _statusCodes[code];
+  char *pos = writeBytes(_result, _statusLine);
+  memcpy(pos, "\r\n", 2);
+  pos += 2;
+  if (hasDate == false) {
+    memcpy(pos, "Date: ", 6);
+    pos = writeBytes(pos + 6, date);
+    memcpy(pos, "\r\n", 2);
+    pos += 2;
+  }
+  for (HeaderList::iterator it = _headers.begin(); it != _headers.end();
+       it++) {
+    pos = writeBytes(pos, it->first);
+    memcpy(pos, ": ", 2);
+    pos = writeBytes(pos + 2, it->second);
+    memcpy(pos, "\r\n", 2);
+    pos += 2;
+  }
+  memcpy(pos, "\r\n", 2);
+  pos = writeBytes(pos + 2, _body);
+  *pos = '\0';
 }
 
+void Response::setStatusLine(int code) { _statusLine = getStatusLine(code); }
+
 void Response::setHeaders(const std::string &key, const std::string &value) {
-  _headers[key] = value;
+  HeaderList::iterator it = findHeader(key);
+
+  if (it != _headers.end())
+    it->second = value;
+  else
+    _headers.push_back(std::make_pair(key, value));
 }
 
 void Response::setBody(std::stringstream &buffer) { _body = buffer.str(); }
 
+void Response::setBody(std::string &body) { _body.swap(body); }
+
 bool Response::isFullWrite() const {
-  if (_sendCnt == _resultSize) return true;
-  return false;
+  if (_sendCnt != _resultSize || _partIdx != _fileParts.size()) return false;
+  if (_isRelay) return _isRelayEnd && _chunkSent == _chunk.size();
+  if (_gzip != NULL) return _isGzipEnd && _chunkSent == _chunk.size();
+  return _autoIndex == NULL || (_isIndexEnd && _chunkSent == _chunk.size());
+}
+
+bool Response::hasResult() const { return _result != NULL; }
+
+// must be set before the result is made
+void Response::setConnection(const std::string &value) { _connection = value; }
+
+bool Response::isKeepAlive() const { return _connection != "close"; }
+
+// takes the fd, closed with the response. Content-Length is set by the caller
+void Response::setFileBody(int fd, const std::vector<FilePart> &parts) {
+  if (_fileFd != -1) fileClose(_fileFd);
+  _fileFd = fd;
+  _fileParts.clear();
+  for (size_t i = 0; i < parts.size(); i++)
+    if (parts[i].head.empty() == false || parts[i].size > 0)
+      _fileParts.push_back(parts[i]);
+  _partIdx = 0;
+  _partSent = 0;
+}
+
+// the fd is deflated while the body is sent, a chunk at a time. HTTP/1.0
+// has no chunks, its body ends with the close. false if deflate does not
+// start, the fd stays the caller's then
+bool Response::setGzipBody(int fd, int level, bool isChunked) {
+  _gzip = new z_stream;
+  memset(_gzip, 0, sizeof(*_gzip));
+  if (deflateInit2(_gzip, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK) {
+    delete _gzip;
+    _gzip = NULL;
+    return false;
+  }
+  _fileFd = fd;
+  _isChunked = isChunked;
+  setHeaders("Content-Encoding", "gzip");
+  if (isChunked)
+    setHeaders("Transfer-Encoding", "chunked");
+  else
+    _connection = "close";
+  return true;
+}
+
+bool Response::hasStreamBody() const {
+  return _fileFd != -1 || _autoIndex != NULL || _isRelay;
+}
+
+// "HTTP/1.1 200 OK", 0 if the status line is not made yet
+int Response::getStatusCode() const {
+  if (_statusLine.size() < 12) return 0;
+  return std::atoi(_statusLine.c_str() + 9);
+}
+
+size_t Response::getSentSize() const { return _sendCnt + _bodySent; }
+
+const char *Response::getRemainData() const { return _result + _sendCnt; }
+
+size_t Response::getRemainSize() const { return _resultSize - _sendCnt; }
+
+// consumes up to the remaining size, returns what is left for the next one
+size_t Response::addSendCnt(size_t cnt) {
+  size_t remain = _resultSize - _sendCnt;
+
+  if (cnt < remain) remain = cnt;
+  _sendCnt += remain;
+  return cnt - remain;
 }
\ No newline at end of file
@@ -5,7 +5,12 @@ RootBlock::RootBlock()
       _workerRlimitNofile(0),
       _workerConnections(0),
       _clientMaxBodySize(4096),
-      _keepAliveTime(0) {}
+      _keepAliveTime(0),
+      _keepAliveRequests(100),
+      _slowHandlerThreshold(0),
+      _memoryBudget(0),
+      _fileThreads(0),
+      _limitZoneSize(1048576) {}
 
 RootBlock::RootBlock(RootBlock &copy)
     : _user(copy._user),
@@ -17,7 +22,15 @@ RootBlock::RootBlock(RootBlock &copy)
       _workerConnections(copy._workerConnections),
       _include(copy._include),
       _clientMaxBodySize(copy._clientMaxBodySize),
-      _keepAliveTime(copy._keepAliveTime) {}
+      _keepAliveTime(copy._keepAliveTime),
+      _keepAliveRequests(copy._keepAliveRequests),
+      _statsFile(copy._statsFile),
+      _slowHandlerThreshold(copy._slowHandlerThreshold),
+      _captureFile(copy._captureFile),
+      _memoryBudget(copy._memoryBudget),
+      _fileThreads(copy._fileThreads),
+      _eventMethod(copy._eventMethod),
+      _limitZoneSize(copy._limitZoneSize) {}
 
 RootBlock::~RootBlock() {}
 
@@ -37,7 +50,10 @@ void RootBlock::setWorkerProcesses(std::string value) {
   _workerProcesses = atoi(value.c_str());
 }
 
-void RootBlock::setErrorLog(std::string value) { _errorLog = value; }
+void RootBlock::setErrorLog(std::string value) {
+  _errorLog = value;
+  Logger::setErrorLog(value);
+}
 
 void RootBlock::setPid(std::string value) { _pid = value; }
 
@@ -55,6 +71,47 @@ void RootBlock::setKeepAliveTime(std::string value) {
   _keepAliveTime = convertTimeUnits(value);
 }
 
+void RootBlock::setKeepAliveRequests(std::string value) {
+  _keepAliveRequests = atoi(value.c_str());
+}
+
+void RootBlock::setStatsFile(std::string value) { _statsFile = value; }
+
+void RootBlock::setLogFormat(std::string value) { Logger::addFormat(value); }
+
+// slow_handler_threshold 50ms | 1s, plain numbers are msec
+void RootBlock::setSlowHandlerThreshold(std::string value) {
+  std::stringstream ss(value);
+  std::string unit;
+
+  ss >> _slowHandlerThreshold >> unit;
+  ftToupper(unit);
+  if (unit == "S")
+    _slowHandlerThreshold *= 1000;
+  else if (unit != "" && unit != "MS")
+    throw std::runtime_error("slow_handler_threshold: invalid value " + value);
+}
+
+void RootBlock::setCaptureFile(std::string value) { _captureFile = value; }
+
+void RootBlock::setMemoryBudget(std::string value) {
+  _memoryBudget = convertByteUnits(value);
+}
+
+void RootBlock::setFileThreads(std::string value) {
+  _fileThreads = atoi(value.c_str());
+}
+
+// use kqueue | io_uring | epoll, what the system has
+void RootBlock::setEventMethod(std::string value) { _eventMethod = value; }
+
+// limit_zone_size 1m, keys over it evict the least recently used ones
+void RootBlock::setLimitZoneSize(std::string value) {
+  _limitZoneSize = convertByteUnits(value);
+  if (_limitZoneSize == 0)
+    throw std::runtime_error("limit_zone_size: invalid value " + value);
+}
+
 void RootBlock::setClientMaxBodySize(std::string value) {
   _clientMaxBodySize = convertByteUnits(value);
 }
@@ -72,6 +129,15 @@ void RootBlock::setKeyVal(std::string key, std::string value) {
   funcmap["include"] = &RootBlock::setInclude;
   funcmap["client_max_body_size"] = &RootBlock::setClientMaxBodySize;
   funcmap["keepalive_timeout"] = &RootBlock::setKeepAliveTime;
+  funcmap["keepalive_requests"] = &RootBlock::setKeepAliveRequests;
+  funcmap["stats_file"] = &RootBlock::setStatsFile;
+  funcmap["log_format"] = &RootBlock::setLogFormat;
+  funcmap["slow_handler_threshold"] = &RootBlock::setSlowHandlerThreshold;
+  funcmap["capture_file"] = &RootBlock::setCaptureFile;
+  funcmap["memory_budget"] = &RootBlock::setMemoryBudget;
+  funcmap["file_threads"] = &RootBlock::setFileThreads;
+  funcmap["use"] = &RootBlock::setEventMethod;
+  funcmap["limit_zone_size"] = &RootBlock::setLimitZoneSize;
 
   if (funcmap.find(key) != funcmap.end()) (this->*(funcmap[key]))(value);
 }
@@ -96,4 +162,23 @@ const size_t &RootBlock::getClientMaxBodySize() const {
   return _clientMaxBodySize;
 }
 
-const size_t &RootBlock::getKeepAliveTime() const { return _keepAliveTime; }
\ No newline at end of file
+const size_t &RootBlock::getKeepAliveTime() const { return _keepAliveTime; }
+
+const size_t &RootBlock::getKeepAliveRequests() const {
+  return _keepAliveRequests;
+}
+const std::string &RootBlock::getStatsFile() const { return _statsFile; }
+
+size_t RootBlock::getSlowHandlerThreshold() const {
+  return _slowHandlerThreshold;
+}
+
+const std::string &RootBlock::getCaptureFile() const { return _captureFile; }
+
+size_t RootBlock::getMemoryBudget() const { return _memoryBudget; }
+
+size_t RootBlock::getFileThreads() const { return _fileThreads; }
+
+const std::string &RootBlock::getEventMethod() const { return _eventMethod; }
+
+size_t RootBlock::getLimitZoneSize() const { return _limitZoneSize; }
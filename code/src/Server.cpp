@@ -1,11 +1,16 @@
 #include "../includes/Server.hpp"
 
 Server::Server(const int port, SPSBList *sbList)
-    : _socket(-1), _listenPort(port), _sbList(sbList) {
+    : _socket(-1), _listenPort(port), _sbList(sbList), _sslCtx(NULL) {
   _keepAliveTime = sbList->front()->getKeepAliveTime();
 }
 
-Server::~Server() {}
+Server::~Server() {
+  for (std::map<std::string, SSL_CTX *>::iterator it = _sslCtxs.begin();
+       it != _sslCtxs.end(); it++)
+    if (it->second != _sslCtx) SSL_CTX_free(it->second);
+  SSL_CTX_free(_sslCtx);
+}
 
 int Server::init() {
   if ((_socket = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
@@ -14,11 +19,22 @@ int Server::init() {
   }
 
   fcntl(_socket, F_SETFL, O_NONBLOCK, FD_CLOEXEC);
+  int on = 1;  // restarts do not wait for TIME_WAIT to pass
+  setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 
   struct sockaddr_in serverAddr;
   memset(&serverAddr, 0, sizeof(serverAddr));
   serverAddr.sin_family = AF_INET;
   serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  // listen 127.0.0.1:8080; binds the address of the first server block
+  const std::string &host = _sbList->front()->getListenHost();
+  if (host == "localhost")
+    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  else if (host.empty() == false &&
+           inet_pton(AF_INET, host.c_str(), &serverAddr.sin_addr) != 1) {
+    std::cout << "listen: invalid address " << host << std::endl;
+    return EXIT_FAILURE;
+  }
   serverAddr.sin_port = htons(this->_listenPort);
   std::cout << "listen port: " << this->_listenPort << std::endl;
 
@@ -31,10 +47,43 @@ int Server::init() {
     std::cerr << "listen() error\n" << std::endl;
     return EXIT_FAILURE;
   }
+  return initSsl();
+}
+
+// listen ... ssl on the first server of a port: every server with its own
+// certificate gets a context, the others use the one of the first
+int Server::initSsl() {
+  if (_sbList->front()->isSsl() == false) return EXIT_SUCCESS;
+  for (SPSBList::iterator it = _sbList->begin(); it != _sbList->end(); it++) {
+    if ((*it)->getSslCertificate().empty()) {
+      if (it != _sbList->begin()) continue;
+      std::cout << "ssl_certificate is not set for port " << _listenPort
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    SSL_CTX *ctx = Tls::createContext(**it, this);
+    if (ctx == NULL) {
+      std::cout << "ssl: certificate, key or ticket key of "
+                << (*it)->getSslCertificate() << " does not load "
+                << Tls::popErrors() << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (_sslCtx == NULL) _sslCtx = ctx;
+    _sslCtxs[(*it)->getServerName()] = ctx;
+  }
   return EXIT_SUCCESS;
 }
 
 int Server::getSocket() const { return _socket; }
 int Server::getListenPort() const { return _listenPort; }
 SPSBList *Server::getSPSBList() const { return _sbList; }
-size_t Server::getkeepAliveTime() const { return _keepAliveTime; }
\ No newline at end of file
+size_t Server::getkeepAliveTime() const { return _keepAliveTime; }
+SSL_CTX *Server::getSslCtx() const { return _sslCtx; }
+
+SSL_CTX *Server::findSslCtx(const std::string &serverName) const {
+  std::map<std::string, SSL_CTX *>::const_iterator it =
+      _sslCtxs.find(serverName);
+
+  if (it == _sslCtxs.end()) return NULL;
+  return it->second;
+}
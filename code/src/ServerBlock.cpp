@@ -1,5 +1,23 @@
 #include "../includes/ServerBlock.hpp"
 
+static int g_limitZoneCnt = 0;  // limit_req and limit_conn directives
+
+BlockStats::BlockStats() : requests(0), bytes(0) {
+  for (size_t i = 0; i < 6; i++) statusClass[i] = 0;
+}
+
+void BlockStats::addResponse(int statusCode, size_t size) {
+  requests++;
+  bytes += size;
+  if (statusCode >= 100 && statusCode < 600) statusClass[statusCode / 100]++;
+}
+
+const char *BlockStats::getPhaseName(int phase) {
+  const char *names[PHASE_CNT] = {"first_byte", "parse",    "route", "handler",
+                                  "cgi",        "upstream", "flush"};
+  return names[phase];
+}
+
 ServerBlock::ServerBlock(RootBlock &rootBlock)
     : RootBlock(rootBlock),
       _listenPort(0),
@@ -7,7 +25,31 @@ ServerBlock::ServerBlock(RootBlock &rootBlock)
       _root(),
       _index(),
       _serverName(),
-      _autoindex("off") {}
+      _autoindex("off"),
+      _autoindexFormat("html"),
+      _gzip("off"),
+      _gzipStatic("off"),
+      _gzipCompLevel(1),
+      _gzipMinLength(20),
+      _gzipTypes("text/html"),
+      _isExpires(false),
+      _expires(0),
+      _stubStatus("off"),
+      _accessLog(NULL),
+      _http2("off"),
+      _isSsl(false),
+      _sslSessionCache(0),
+      _sslSessionTickets("on"),
+      _sslKtls("off"),
+      _proxyKeepalive(16),
+      _limitRate(0),
+      _limitBurst(0),
+      _isLimitNodelay(false),
+      _limitConn(0),
+      _limitReqZone(0),
+      _limitConnZone(0) {
+  memset(&_proxyAddr, 0, sizeof(_proxyAddr));
+}
 
 ServerBlock::ServerBlock(ServerBlock &copy)
     : RootBlock(copy),
@@ -15,14 +57,52 @@ ServerBlock::ServerBlock(ServerBlock &copy)
       _listenHost(copy._listenHost),
       _root(copy._root),
       _index(copy._index),
-      _serverName(copy._serverName) {}
+      _serverName(copy._serverName),
+      _autoindexFormat(copy._autoindexFormat),
+      _errorPages(copy._errorPages),
+      _gzip(copy._gzip),
+      _gzipStatic(copy._gzipStatic),
+      _gzipCompLevel(copy._gzipCompLevel),
+      _gzipMinLength(copy._gzipMinLength),
+      _gzipTypes(copy._gzipTypes),
+      _isExpires(copy._isExpires),
+      _expires(copy._expires),
+      _stubStatus("off"),
+      _accessLog(copy._accessLog),
+      _accessLogFormat(copy._accessLogFormat),
+      _http2(copy._http2),
+      _isSsl(copy._isSsl),
+      _sslCertificate(copy._sslCertificate),
+      _sslCertificateKey(copy._sslCertificateKey),
+      _sslSessionCache(copy._sslSessionCache),
+      _sslSessionTickets(copy._sslSessionTickets),
+      _sslSessionTicketKey(copy._sslSessionTicketKey),
+      _sslKtls(copy._sslKtls),
+      _proxyAddr(copy._proxyAddr),
+      _proxyKeepalive(copy._proxyKeepalive),
+      _limitRate(copy._limitRate),
+      _limitBurst(copy._limitBurst),
+      _isLimitNodelay(copy._isLimitNodelay),
+      _limitConn(copy._limitConn),
+      _limitKey(copy._limitKey),
+      _limitReqZone(copy._limitReqZone),
+      _limitConnZone(copy._limitConnZone) {}
 
 ServerBlock::~ServerBlock() {}
 
+// listen [host:]port [ssl];
 void ServerBlock::setListen(std::string value) {
+  std::stringstream ss(value);
+  std::string param;
+
+  ss >> value >> param;
+  if (param == "ssl")
+    _isSsl = true;
+  else if (param.empty() == false)
+    throw std::runtime_error("listen: invalid parameter " + param);
   size_t tmp = value.find_first_of(":");
   if (tmp != std::string::npos) {
-    _listenHost = value.substr(0, tmp - 1);
+    _listenHost = value.substr(0, tmp);
     _listenPort =
         std::atoi(value.substr(tmp + 1, value.size() - tmp - 1).c_str());
   } else {
@@ -43,10 +123,249 @@ void ServerBlock::setServerName(std::string value) { _serverName = value; }
 
 void ServerBlock::setAutoindex(std::string value) { _autoindex = value; }
 
+void ServerBlock::setAutoindexFormat(std::string value) {
+  if (value != "html" && value != "json")
+    throw std::runtime_error("autoindex_format: invalid value " + value);
+  _autoindexFormat = value;
+}
+
 void ServerBlock::setCgi(std::string value) { _cgi = value; }
 
 void ServerBlock::setCgiRedir(std::string value) { _cgiRedir = value; }
 
+// error_page code [code ...] path;
+void ServerBlock::setErrorPage(std::string value) {
+  std::stringstream ss(value);
+  std::vector<std::string> tokens;
+  std::string token;
+
+  while (ss >> token) tokens.push_back(token);
+  if (tokens.size() < 2)
+    throw std::runtime_error("error_page: invalid value " + value);
+  const std::string &path = tokens.back();
+  for (size_t i = 0; i + 1 < tokens.size(); i++) {
+    int code = ftStoi(tokens[i]);
+    if (code < 300 || code > 599)
+      throw std::runtime_error("error_page: invalid code " + tokens[i]);
+    _errorPages[code] = ErrorPage::load(code, path);
+  }
+}
+
+void ServerBlock::setGzip(std::string value) { _gzip = value; }
+
+void ServerBlock::setGzipStatic(std::string value) { _gzipStatic = value; }
+
+void ServerBlock::setGzipCompLevel(std::string value) {
+  _gzipCompLevel = ftStoi(value);
+  if (_gzipCompLevel < 1 || _gzipCompLevel > 9)
+    throw std::runtime_error("gzip_comp_level: invalid value " + value);
+}
+
+void ServerBlock::setGzipMinLength(std::string value) {
+  _gzipMinLength = convertByteUnits(value);
+}
+
+// text/html is always compressed
+void ServerBlock::setGzipTypes(std::string value) {
+  _gzipTypes = "text/html " + value;
+}
+
+// expires off | epoch | max | [-]time[s|m|h|d]
+void ServerBlock::setExpires(std::string value) {
+  _isExpires = true;
+  if (value == "off")
+    _isExpires = false;
+  else if (value == "epoch")
+    _expires = -1;
+  else if (value == "max")
+    _expires = 315360000;
+  else {
+    std::stringstream ss(value);
+    std::string unit;
+    ss >> _expires >> unit;
+    if (ss.fail() && ss.eof() == false)
+      throw std::runtime_error("expires: invalid value " + value);
+    if (unit == "m")
+      _expires *= 60;
+    else if (unit == "h")
+      _expires *= 3600;
+    else if (unit == "d")
+      _expires *= 86400;
+    else if (unit != "" && unit != "s")
+      throw std::runtime_error("expires: invalid value " + value);
+  }
+}
+
+// stub_status off | on | prometheus
+void ServerBlock::setStubStatus(std::string value) {
+  if (value != "off" && value != "on" && value != "prometheus")
+    throw std::runtime_error("stub_status: invalid value " + value);
+  _stubStatus = value;
+}
+
+// access_log off | path [format];
+void ServerBlock::setAccessLog(std::string value) {
+  std::stringstream ss(value);
+  std::string path;
+  std::string format;
+
+  ss >> path >> format;
+  if (path == "off") {
+    _accessLog = NULL;
+    return;
+  }
+  _accessLogFormat = format.empty() ? "combined" : format;
+  Logger::getFormat(_accessLogFormat);  // throws if it is not defined
+  _accessLog = Logger::get(path);
+}
+
+// http2 on | off, read from the first server of a port
+void ServerBlock::setHttp2(std::string value) {
+  if (value != "off" && value != "on")
+    throw std::runtime_error("http2: invalid value " + value);
+  _http2 = value;
+}
+
+void ServerBlock::setSslCertificate(std::string value) {
+  _sslCertificate = value;
+}
+
+void ServerBlock::setSslCertificateKey(std::string value) {
+  _sslCertificateKey = value;
+}
+
+// ssl_session_cache off | sessions
+void ServerBlock::setSslSessionCache(std::string value) {
+  if (value == "off") {
+    _sslSessionCache = 0;
+    return;
+  }
+  if (value.find_first_not_of("0123456789") != std::string::npos)
+    throw std::runtime_error("ssl_session_cache: invalid value " + value);
+  _sslSessionCache = ftStoi(value);
+}
+
+void ServerBlock::setSslSessionTickets(std::string value) {
+  if (value != "off" && value != "on")
+    throw std::runtime_error("ssl_session_tickets: invalid value " + value);
+  _sslSessionTickets = value;
+}
+
+// a file of 80 random bytes, e.g. openssl rand 80 > ticket.key
+void ServerBlock::setSslSessionTicketKey(std::string value) {
+  _sslSessionTicketKey = value;
+}
+
+// ssl_ktls on | off, records are encrypted by the kernel where it can
+void ServerBlock::setSslKtls(std::string value) {
+  if (value != "off" && value != "on")
+    throw std::runtime_error("ssl_ktls: invalid value " + value);
+  _sslKtls = value;
+}
+
+// proxy_pass http://host[:port][/uri]; the name is resolved once, here
+void ServerBlock::setProxyPass(std::string value) {
+  if (value.compare(0, 7, "http://") != 0)
+    throw std::runtime_error("proxy_pass: only http:// is supported " + value);
+  size_t slash = value.find('/', 7);
+  std::string host = value.substr(7, slash == std::string::npos
+                                         ? std::string::npos
+                                         : slash - 7);
+  std::string port = "80";
+  size_t colon = host.find(':');
+  if (colon != std::string::npos) {
+    port = host.substr(colon + 1);
+    host.erase(colon);
+  }
+  struct addrinfo hints;
+  struct addrinfo *addrs;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (host.empty() || port.empty() ||
+      port.find_first_not_of("0123456789") != std::string::npos ||
+      getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0)
+    throw std::runtime_error("proxy_pass: invalid upstream " + value);
+  memcpy(&_proxyAddr, addrs->ai_addr, sizeof(_proxyAddr));
+  freeaddrinfo(addrs);
+  _proxyPass = value;
+  _proxyUpstream = ftInetNtoa(_proxyAddr.sin_addr) + ":" + port;
+  _proxyUri = slash == std::string::npos ? "" : value.substr(slash);
+}
+
+// proxy_keepalive connections; 0 closes every upstream connection after use
+void ServerBlock::setProxyKeepalive(std::string value) {
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos)
+    throw std::runtime_error("proxy_keepalive: invalid value " + value);
+  _proxyKeepalive = ftStoi(value);
+}
+
+// limit_req off | rate=Nr/s|Nr/m [burst=N] [nodelay]; the locations that
+// inherit it share its buckets, one that sets its own has its own
+void ServerBlock::setLimitReq(std::string value) {
+  std::stringstream ss(value);
+  std::string token;
+  size_t rate = 0;
+  size_t burst = 0;
+  bool isNodelay = false;
+
+  if (value == "off") {
+    _limitRate = 0;
+    return;
+  }
+  while (ss >> token) {
+    if (token.compare(0, 5, "rate=") == 0) {
+      std::stringstream num(token.substr(5));
+      std::string unit;
+      num >> rate >> unit;
+      if (num.fail() || rate == 0 || rate > LIMIT_RATE_MAX ||
+          (unit != "r/s" && unit != "r/m"))
+        throw std::runtime_error("limit_req: invalid rate " + token);
+      rate = unit == "r/s" ? rate * 1000 : rate * 1000 / 60;
+    } else if (token.compare(0, 6, "burst=") == 0) {
+      std::stringstream num(token.substr(6));
+      num >> burst;
+      if (num.fail() || num.eof() == false || burst > LIMIT_RATE_MAX)
+        throw std::runtime_error("limit_req: invalid burst " + token);
+    } else if (token == "nodelay") {
+      isNodelay = true;
+    } else
+      throw std::runtime_error("limit_req: invalid parameter " + token);
+  }
+  if (rate == 0) throw std::runtime_error("limit_req: no rate " + value);
+  _limitRate = rate;
+  _limitBurst = burst;
+  _isLimitNodelay = isNodelay;
+  _limitReqZone = ++g_limitZoneCnt;
+}
+
+// limit_conn off | requests; counted from routing to the last byte sent
+void ServerBlock::setLimitConn(std::string value) {
+  if (value == "off") {
+    _limitConn = 0;
+    return;
+  }
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos ||
+      ftStoi(value) == 0)
+    throw std::runtime_error("limit_conn: invalid value " + value);
+  _limitConn = ftStoi(value);
+  _limitConnZone = ++g_limitZoneCnt;
+}
+
+// limit_key $remote_addr | $http_<name>, the header as nginx names it
+void ServerBlock::setLimitKey(std::string value) {
+  if (value == "$remote_addr") {
+    _limitKey.clear();
+    return;
+  }
+  if (value.compare(0, 6, "$http_") != 0 || value.size() == 6)
+    throw std::runtime_error("limit_key: invalid value " + value);
+  _limitKey = value.substr(6);
+  std::replace(_limitKey.begin(), _limitKey.end(), '_', '-');
+}
+
 void ServerBlock::setKeyVal(std::string key, std::string value) {
   typedef void (ServerBlock::*funcptr)(std::string);
   std::map<std::string, funcptr> funcmap;
@@ -57,6 +376,27 @@ void ServerBlock::setKeyVal(std::string key, std::string value) {
   funcmap["server_name"] = &ServerBlock::setServerName;
   funcmap["client_max_body_size"] = &ServerBlock::setClientMaxBodySize;
   funcmap["autoindex"] = &ServerBlock::setAutoindex;
+  funcmap["autoindex_format"] = &ServerBlock::setAutoindexFormat;
+  funcmap["error_page"] = &ServerBlock::setErrorPage;
+  funcmap["gzip"] = &ServerBlock::setGzip;
+  funcmap["gzip_static"] = &ServerBlock::setGzipStatic;
+  funcmap["gzip_comp_level"] = &ServerBlock::setGzipCompLevel;
+  funcmap["gzip_min_length"] = &ServerBlock::setGzipMinLength;
+  funcmap["gzip_types"] = &ServerBlock::setGzipTypes;
+  funcmap["expires"] = &ServerBlock::setExpires;
+  funcmap["stub_status"] = &ServerBlock::setStubStatus;
+  funcmap["access_log"] = &ServerBlock::setAccessLog;
+  funcmap["http2"] = &ServerBlock::setHttp2;
+  funcmap["ssl_certificate"] = &ServerBlock::setSslCertificate;
+  funcmap["ssl_certificate_key"] = &ServerBlock::setSslCertificateKey;
+  funcmap["ssl_session_cache"] = &ServerBlock::setSslSessionCache;
+  funcmap["ssl_session_tickets"] = &ServerBlock::setSslSessionTickets;
+  funcmap["ssl_session_ticket_key"] = &ServerBlock::setSslSessionTicketKey;
+  funcmap["ssl_ktls"] = &ServerBlock::setSslKtls;
+  funcmap["proxy_keepalive"] = &ServerBlock::setProxyKeepalive;
+  funcmap["limit_req"] = &ServerBlock::setLimitReq;
+  funcmap["limit_conn"] = &ServerBlock::setLimitConn;
+  funcmap["limit_key"] = &ServerBlock::setLimitKey;
 
   if (funcmap.find(key) != funcmap.end())
     (this->*(funcmap[key]))(value);
@@ -74,6 +414,100 @@ const std::string &ServerBlock::getLimitExcept() const { return _limitExcept; }
 
 const std::string &ServerBlock::getAutoindex() const { return _autoindex; }
 
+const std::string &ServerBlock::getAutoindexFormat() const {
+  return _autoindexFormat;
+}
+
 const std::string &ServerBlock::getCgi() const { return _cgi; }
 
-const std::string &ServerBlock::getCgiRedir() const { return _cgiRedir; }
\ No newline at end of file
+const std::string &ServerBlock::getCgiRedir() const { return _cgiRedir; }
+
+const ErrorPage *ServerBlock::getErrorPage(int statusCode) const {
+  std::map<int, ErrorPage>::const_iterator it = _errorPages.find(statusCode);
+
+  if (it == _errorPages.end()) return NULL;
+  return &it->second;
+}
+
+const std::string &ServerBlock::getGzip() const { return _gzip; }
+
+const std::string &ServerBlock::getGzipStatic() const { return _gzipStatic; }
+
+int ServerBlock::getGzipCompLevel() const { return _gzipCompLevel; }
+
+size_t ServerBlock::getGzipMinLength() const { return _gzipMinLength; }
+
+bool ServerBlock::isGzipType(const std::string &mime) const {
+  std::stringstream ss(_gzipTypes);
+  std::string token;
+
+  while (ss >> token)
+    if (token == mime || token == "*") return true;
+  return false;
+}
+
+bool ServerBlock::isExpires() const { return _isExpires; }
+
+long ServerBlock::getExpires() const { return _expires; }
+
+const std::string &ServerBlock::getStubStatus() const { return _stubStatus; }
+
+BlockStats &ServerBlock::getStats() { return _stats; }
+
+Logger *ServerBlock::getAccessLog() const { return _accessLog; }
+
+const std::string &ServerBlock::getAccessLogFormat() const {
+  return _accessLogFormat;
+}
+
+const std::string &ServerBlock::getHttp2() const { return _http2; }
+
+bool ServerBlock::isSsl() const { return _isSsl; }
+
+const std::string &ServerBlock::getSslCertificate() const {
+  return _sslCertificate;
+}
+
+const std::string &ServerBlock::getSslCertificateKey() const {
+  return _sslCertificateKey;
+}
+
+size_t ServerBlock::getSslSessionCache() const { return _sslSessionCache; }
+
+const std::string &ServerBlock::getSslSessionTickets() const {
+  return _sslSessionTickets;
+}
+
+const std::string &ServerBlock::getSslSessionTicketKey() const {
+  return _sslSessionTicketKey;
+}
+
+const std::string &ServerBlock::getSslKtls() const { return _sslKtls; }
+
+const std::string &ServerBlock::getProxyPass() const { return _proxyPass; }
+
+const std::string &ServerBlock::getProxyUpstream() const {
+  return _proxyUpstream;
+}
+
+const std::string &ServerBlock::getProxyUri() const { return _proxyUri; }
+
+const struct sockaddr_in &ServerBlock::getProxyAddr() const {
+  return _proxyAddr;
+}
+
+size_t ServerBlock::getProxyKeepalive() const { return _proxyKeepalive; }
+
+size_t ServerBlock::getLimitRate() const { return _limitRate; }
+
+size_t ServerBlock::getLimitBurst() const { return _limitBurst; }
+
+bool ServerBlock::isLimitNodelay() const { return _isLimitNodelay; }
+
+size_t ServerBlock::getLimitConn() const { return _limitConn; }
+
+const std::string &ServerBlock::getLimitKey() const { return _limitKey; }
+
+int ServerBlock::getLimitReqZone() const { return _limitReqZone; }
+
+int ServerBlock::getLimitConnZone() const { return _limitConnZone; }
@@ -1,243 +1,1490 @@
 #include "../includes/ServerOperator.hpp"
 
 ServerOperator::ServerOperator(ServerMap &serverMap, LocationMap &locationMap)
-    : _serverMap(serverMap), _locationMap(locationMap) {}
+    : _serverMap(serverMap),
+      _locationMap(locationMap),
+      _maxClients(1024),
+      _clientCnt(0),
+      _acceptCnt(0),
+      _handledCnt(0),
+      _requestCnt(0),
+      _slowThreshold(0),
+      _capture(NULL),
+      _isRunning(true),
+      _memoryBudget(0),
+      _memoryUsed(0),
+      _heldMemory(0),
+      _rejectCnt(0),
+      _spillCnt(0),
+      _tlsHandshakeCnt(0),
+      _tlsResumeCnt(0),
+      _ktlsCnt(0),
+      _upstreamConnectCnt(0),
+      _upstreamReuseCnt(0) {
+  if (_serverMap.empty() == false) {
+    int workerConnections =
+        _serverMap.begin()->second->getSPSBList()->front()->getWorkerConnection();
+    if (workerConnections > 0) _maxClients = workerConnections;
+    // the connection table has no fd limit of its own, the process has
+    int rlimitNofile = _serverMap.begin()
+                           ->second->getSPSBList()
+                           ->front()
+                           ->getWorkerRlimitNofile();
+    struct rlimit limit;
+    if (rlimitNofile > 0 && getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+      limit.rlim_cur = rlimitNofile;
+      if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max)
+        limit.rlim_cur = limit.rlim_max;
+      if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+        Logger::log(LEVEL_WARN, "worker_rlimit_nofile: setrlimit() error");
+    }
+    _slowThreshold = _serverMap.begin()
+                         ->second->getSPSBList()
+                         ->front()
+                         ->getSlowHandlerThreshold() *
+                     1000;
+    const std::string &captureFile =
+        _serverMap.begin()->second->getSPSBList()->front()->getCaptureFile();
+    if (captureFile.empty() == false) _capture = new Capture(captureFile);
+    _memoryBudget =
+        _serverMap.begin()->second->getSPSBList()->front()->getMemoryBudget();
+    _limiter.setSize(
+        _serverMap.begin()->second->getSPSBList()->front()->getLimitZoneSize());
+    if (_filePool.start(_serverMap.begin()
+                            ->second->getSPSBList()
+                            ->front()
+                            ->getFileThreads()) == false)
+      Logger::log(LEVEL_WARN, "file_threads: not every thread started");
+  }
+}
 
-ServerOperator::~ServerOperator() {}
+ServerOperator::~ServerOperator() { delete _capture; }
 
 void ServerOperator::run() {
   Kqueue kq;
-  if (kq.init(_serverMap) == EXIT_FAILURE) return;
+  if (kq.init(_serverMap, _serverMap.begin()
+                              ->second->getSPSBList()
+                              ->front()
+                              ->getEventMethod()) == EXIT_FAILURE)
+    return;
+  // delivered as events instead. USR1 dumps the stats, USR2 reopens the logs,
+  // TERM and INT return from here so buffers and profiles are written out
+  int signals[] = {SIGUSR1, SIGUSR2, SIGTERM, SIGINT};
+  for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+    signal(signals[i], SIG_IGN);
+    kq.changeEvents(signals[i], EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0, NULL);
+  }
+  // a write to a client that is gone fails with EPIPE instead. with file
+  // threads the response often comes after the client has given up
+  signal(SIGPIPE, SIG_IGN);
+  if (_filePool.getFd() != -1)
+    kq.changeEvents(_filePool.getFd(), EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0,
+                    kq.openConn(_filePool.getFd(), FD_TASK));
 
   struct kevent *currEvent;
   int eventNb;
-  while (1) {
-    eventNb = kq.countEvents();
+  struct timespec flushTimeout = {LOG_FLUSH_INTERVAL, 0};
+  struct timespec delayTimeout;
+  while (_isRunning) {
+    _loopStats.changes.record(kq.getCheckListSize());
+    // wake up to write buffered log lines even when nothing happens
+    bool hasPending =
+        Logger::hasPending() || (_capture != NULL && _capture->hasPending());
+    eventNb = kq.countEvents(
+        getWaitTimeout(hasPending ? &flushTimeout : NULL, delayTimeout));
+    unsigned long loopStart = getMonotonicUsec();
     kq.clearCheckList();
+    updateCachedTime();
+    _heldMemory = kq.getHeldSize();
+    if (eventNb > 0) _loopStats.events.record(eventNb);
 
     for (int i = 0; i < eventNb; ++i) {
       currEvent = &(kq.getEventList())[i];
-      if (currEvent->flags & EV_ERROR) {
-        handleEventError(currEvent, kq);
-      } else if (currEvent->filter == EVFILT_READ) {
-        handleReadEvent(currEvent, kq);
-      } else if (currEvent->filter == EVFILT_WRITE) {
-        handleWriteEvent(currEvent, kq);
-      } else if (currEvent->filter == EVFILT_TIMER) {
-        handleRequestTimeOut(currEvent->ident, kq);
-      }
+      // taken before the handler, it may close the fd of the slot
+      e_handler type = getHandlerType(currEvent);
+      int clientSock = getEventClient(currEvent);
+      unsigned long start = getMonotonicUsec();
+      handleEvent(currEvent, kq);
+      unsigned long elapsed = getMonotonicUsec() - start;
+      _loopStats.handlers[type].record(elapsed);
+      if (_slowThreshold > 0 && elapsed >= _slowThreshold)
+        logSlowHandler(type, currEvent, clientSock, elapsed, kq);
     }
+    if (eventNb > 0) _loopStats.iteration.record(getMonotonicUsec() - loopStart);
+    runDelayed(kq);
+    resumeClients(kq);
+    Logger::flushAll(false);
+    if (_capture != NULL) _capture->flush(false);
   }
+  Logger::log(LEVEL_NOTICE, "shutting down");
+  Logger::flushAll(true);
+}
+
+static const char *getHandlerName(int type) {
+  const char *names[HANDLER_CNT] = {
+      "accept",    "client_read",   "client_write",   "cgi_read", "cgi_write",
+      "upstream_read", "upstream_write", "task",     "timer",    "other"};
+  return names[type];
+}
+
+void ServerOperator::handleEvent(struct kevent *event, Kqueue &kq) {
+  if (event->flags & EV_ERROR) {
+    handleEventError(event, kq);
+  } else if (event->filter == EVFILT_READ) {
+    handleReadEvent(event, kq);
+  } else if (event->filter == EVFILT_WRITE) {
+    handleWriteEvent(event, kq);
+  } else if (event->filter == EVFILT_TIMER) {
+    Connection *conn = static_cast<Connection *>(event->udata);
+    if (conn->type == FD_CLIENT) handleRequestTimeOut(*conn, kq);
+  } else if (event->filter == EVFILT_SIGNAL) {
+    if (event->ident == SIGUSR2)
+      Logger::reopenAll();
+    else if (event->ident == SIGUSR1)
+      dumpStats();
+    else
+      _isRunning = false;
+  }
+}
+
+e_handler ServerOperator::getHandlerType(struct kevent *event) {
+  if (event->flags & EV_ERROR) return HANDLER_OTHER;
+  if (event->filter == EVFILT_TIMER) return HANDLER_TIMER;
+  if (event->filter == EVFILT_SIGNAL) return HANDLER_OTHER;
+  e_fdGroup group = static_cast<Connection *>(event->udata)->type;
+  if (event->filter == EVFILT_READ) {
+    if (group == FD_SERVER) return HANDLER_ACCEPT;
+    if (group == FD_CLIENT) return HANDLER_CLIENT_READ;
+    if (group == FD_CGI) return HANDLER_CGI_READ;
+    if (group == FD_UPSTREAM) return HANDLER_UPSTREAM_READ;
+    if (group == FD_TASK) return HANDLER_TASK;
+  } else if (event->filter == EVFILT_WRITE) {
+    if (group == FD_CLIENT) return HANDLER_CLIENT_WRITE;
+    if (group == FD_CGI) return HANDLER_CGI_WRITE;
+    if (group == FD_UPSTREAM) return HANDLER_UPSTREAM_WRITE;
+  }
+  return HANDLER_OTHER;
+}
+
+// the client socket an event works for, -1 if none
+int ServerOperator::getEventClient(struct kevent *event) {
+  if (event->flags & EV_ERROR || event->filter == EVFILT_SIGNAL) return -1;
+  Connection *conn = static_cast<Connection *>(event->udata);
+  if (conn->type == FD_CLIENT) return conn->fd;
+  if (conn->type == FD_CGI || conn->type == FD_UPSTREAM) return conn->client;
+  return -1;
+}
+
+void ServerOperator::logSlowHandler(e_handler type, struct kevent *event,
+                                    int clientSock, unsigned long usec,
+                                    Kqueue &kq) {
+  Connection *client = kq.getConn(clientSock);
+  std::string uri = "-";
+
+  if (client != NULL && client->type == FD_CLIENT) {
+    if (client->queue.empty() == false) {
+      // the request of a running task belongs to its file thread
+      if (client->task == NULL)
+        uri = client->queue.back().first->getHeaderByKey("RawURI");
+    } else if (client->req->getHeaderByKey("RawURI") != "")
+      uri = client->req->getHeaderByKey("RawURI");
+  }
+  std::stringstream ss;
+  ss << "slow handler: " << usec / 1000 << "ms " << getHandlerName(type)
+     << " fd=" << event->ident << " client=" << clientSock << " uri=" << uri;
+  Logger::log(LEVEL_WARN, ss.str());
 }
 
 void ServerOperator::handleEventError(struct kevent *event, Kqueue &kq) {
-  if (_serverMap.find(event->ident) != _serverMap.end()) {
+  Connection *conn = static_cast<Connection *>(event->udata);
+
+  if (conn == NULL) return;
+  if (conn->type == FD_SERVER) {
     // std::cerr << "server socket error : " << event->ident << std::endl;
+    kq.closeConn(conn);
     close(event->ident);
     Server *newserver = new Server(_serverMap[event->ident]->getListenPort(),
                                    _serverMap[event->ident]->getSPSBList());
     delete _serverMap[event->ident];
     _serverMap.erase(event->ident);
     _serverMap[newserver->getSocket()] = newserver;
+  } else if (conn->type == FD_CLIENT) {
+    // std::cerr << "client socket error : " << event->ident << std::endl;
+    disconnectClient(*conn, kq);
+  } else if (conn->type == FD_UPSTREAM) {
+    if (conn->proxy != NULL)
+      failUpstream(*conn, kq);
+    else
+      closeUpstream(*conn, kq);
   }
-  // std::cerr << "client socket error : " << event->ident << std::endl;
-  disconnectClient(event->ident, kq);
 }
 
-void ServerOperator::handleRequestTimeOut(int clientSock, Kqueue &kq) {
-  kq.changeEvents(clientSock, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
-  Response res;
+void ServerOperator::handleRequestTimeOut(Connection &client, Kqueue &kq) {
+  // a handshake that did not finish has nobody to answer to
+  if (client.tls != NULL && client.tls->isDone() == false) {
+    disconnectClient(client, kq);
+    return;
+  }
+  // http2 says goodbye with GOAWAY, whatever of it the socket takes
+  if (client.h2 != NULL) {
+    client.h2->goAway(H2_NO_ERROR);
+    if (sockWrite(client.fd, client.tls, client.h2->getOutData(),
+                  client.h2->getOutSize()) == -1)
+      Logger::log(LEVEL_INFO, "GOAWAY is not sent to ", client.fd);
+    disconnectClient(client, kq);
+    return;
+  }
+  Response res(client.req->getLocBlock());
+  res.setConnection("close");
   res.setErrorRes(408);
-  res.sendResponse(clientSock);
-  disconnectClient(clientSock, kq);
+  res.sendResponse(client.fd, client.tls);
+  disconnectClient(client, kq);
 }
 
 void ServerOperator::handleReadEvent(struct kevent *event, Kqueue &kq) {
-  if (kq.getFdGroup(event->ident) == FD_SERVER) {
+  Connection *conn = static_cast<Connection *>(event->udata);
+
+  if (conn->type == FD_SERVER) {
     int clientSocket;
 
     sockaddr_in clientAddr;
-    socklen_t clientAddrLen = sizeof(clientAddr);
-    if ((clientSocket = accept(event->ident, (struct sockaddr *)&clientAddr,
-                               &clientAddrLen)) == -1) {
-      std::cerr << "Accept() Error" << std::endl;
+    if ((clientSocket = kq.accept(event->ident, &clientAddr)) == -1) {
+      Logger::log(LEVEL_ERROR, "accept() error");
+      return;
+    }
+    _acceptCnt++;
+    // make room by closing the least recently used keep-alive clients
+    while ((isOverBudget() || _clientCnt >= _maxClients) &&
+           reclaimIdleClient(kq))
+      ;
+    if (isOverBudget()) {
+      rejectClient(clientSocket, conn->server->getSslCtx() != NULL);
       return;
     }
-    std::cout << "accept new client: " << clientSocket << std::endl;
-    kq.setFdGroup(clientSocket, FD_CLIENT);
+    if (_clientCnt >= _maxClients) {
+      Logger::log(LEVEL_WARN, "worker_connections are not enough");
+      close(clientSocket);
+      return;
+    }
+    _handledCnt++;
+    _clientCnt++;
+    Logger::log(LEVEL_INFO, "accept new client: ", clientSocket);
+    Connection *client = kq.openConn(clientSocket, FD_CLIENT);
+    client->server = conn->server;
     std::string clientIp = ftInetNtoa(clientAddr.sin_addr);
-    _clientToServer[clientSocket] = event->ident;
 
-    fcntl(clientSocket, F_SETFL, O_NONBLOCK, FD_CLOEXEC);
+    // tls reads and writes the socket itself, it can not be attached
+    if (conn->server->getSslCtx() != NULL || kq.attach(clientSocket) == false)
+      fcntl(clientSocket, F_SETFL, O_NONBLOCK, FD_CLOEXEC);
 
     /* add event for client socket - add read && write event */
     kq.changeEvents(
         clientSocket, EVFILT_TIMER, EV_ADD | EV_ENABLE, 0,
-        _serverMap[event->ident]->getSPSBList()->front()->getKeepAliveTime() *
-            1000,
-        NULL);
-    kq.changeEvents(clientSocket, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-    _clients[clientSocket] = new Request();
-    _clients[clientSocket]->addHeader("ClientIP", clientIp);
-  } else if (kq.getFdGroup(event->ident) == FD_CLIENT) {
-    Request *req = _clients[event->ident];
-    /* read data from client */
-    static char buf[32768];  // reuse for every request
-    int n;
-
-    n = read(event->ident, buf, sizeof(buf));
+        conn->server->getSPSBList()->front()->getKeepAliveTime() * 1000,
+        client);
+    kq.changeEvents(clientSocket, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0,
+                    client);
+    client->req = new Request();
+    client->acceptTime = getMonotonicUsec();
+    client->req->addHeader("ClientIP", clientIp);
+    // a head and its file body, or tls records, go out one write each.
+    // nagle would hold all but the first until the client acks
+    int on = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (conn->server->getSslCtx() != NULL)
+      client->tls = new Tls(conn->server->getSslCtx(), clientSocket);
+    setIdle(*client);
+    if (_capture != NULL)
+      _capture->open(clientSocket, conn->server->getListenPort());
+  } else if (conn->type == FD_CLIENT) {
+    Request *req = conn->req;
+    size_t total = 0;
+    ssize_t n = BUFFER_CHUNK;
+
+    if (conn->tls != NULL && conn->tls->isDone() == false &&
+        handshakeTls(*conn, EVFILT_READ, kq) == false)
+      return;
+    // over memory_budget a body being read goes on in a temp file, other
+    // reads wait until responses free memory
+    if (isOverBudget() && req->spillBody()) {
+      _spillCnt++;
+      updateMemory(*conn);
+    }
+    if (isOverBudget() && req->getBodyFd() == -1) {
+      pauseClient(*conn, kq);
+      return;
+    }
+    // until the socket is drained, a short read means it is. a tls read
+    // gives one record, its socket is drained once it would block. the
+    // budget lets the other clients run, the rest is read on the next event
+    while ((n == BUFFER_CHUNK || (conn->tls != NULL && n > 0)) &&
+           total < READ_BUDGET && (total == 0 || isOverBudget() == false)) {
+      char *buf = req->prepareRaw(_bufferPool);
+      n = sockRead(event->ident, conn->tls, buf, BUFFER_CHUNK);
+      req->commitRaw(n > 0 ? n : 0);
+      updateMemory(*conn);
+      if (n <= 0) break;
+      if (_capture != NULL) _capture->data(event->ident, buf, n);
+      total += n;
+    }
     if (n == 0) {
-      disconnectClient(event->ident, kq);
-      return;
-    } else if (n == -1) {
-      return;
-    } else {
-      req->addRawContents(buf, n);
-      req->parsing(_serverMap[_clientToServer[event->ident]]->getSPSBList(),
-                   _locationMap);
-
-      if (req->isFullReq()) {
-        kq.changeEvents(event->ident, EVFILT_TIMER, EV_ENABLE, 0,
-                        _serverMap[_clientToServer[event->ident]]
-                                ->getSPSBList()
-                                ->front()
-                                ->getKeepAliveTime() *
-                            1000,
-                        NULL);
-        kq.changeEvents(event->ident, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-        kq.changeEvents(event->ident, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
-                        NULL);
-        return;
-      }
+      disconnectClient(*conn, kq);
+      return;
     }
-  } else if (kq.getFdGroup(event->ident) == FD_CGI) {
-    std::vector<int> udata = *static_cast<std::vector<int> *>(event->udata);
-    int clientFd = udata[0];
-    pid_t pid = udata[1];
-    Request *req = _clients[clientFd];
-    static char buf[32768];
-    int n;
-
-    n = read(event->ident, buf, sizeof(buf));
-    if (n == -1) {
-      return;
-    } else {
-      req->addRawContents(buf, n);
-      if (waitpid(pid, NULL, WNOHANG) == pid && n == 0) {
-        kq.eraseFdGroup(event->ident, FD_CGI);
-        close(event->ident);
-        Response *res = new Response();
-        res->convertCGI(req->getRawContents());
-        delete static_cast<std::vector<int> *>(event->udata);
-        kq.changeEvents(clientFd, EVFILT_TIMER, EV_ENABLE, 0,
-                        req->getLocBlock()->getKeepAliveTime() * 1000, res);
-        kq.changeEvents(clientFd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, res);
-      }
+    if (total == 0) {
+      if (req->isEmpty()) req->releaseRaw(_bufferPool);
+      updateMemory(*conn);
+      return;
+    }
+    unsetIdle(*conn);
+    if (conn->acceptTime != 0) {
+      req->setPhaseTime(PHASE_FIRST_BYTE,
+                        getMonotonicUsec() - conn->acceptTime);
+      conn->acceptTime = 0;
     }
+    parseRequests(*conn, kq);
+    // the next client of this batch can read into the same buffer
+    if (conn->type == FD_CLIENT && conn->req->isEmpty())
+      conn->req->releaseRaw(_bufferPool);
+    if (conn->type == FD_CLIENT) updateMemory(*conn);
+  } else if (conn->type == FD_CGI) {
+    if (conn->client == -1) {
+      closeCgiPipe(*conn, kq);
+      return;
+    }
+    Connection &client = *kq.getConn(conn->client);
+    Request *req = conn->cgiReq;
+    size_t total = 0;
+    ssize_t n = BUFFER_CHUNK;
+
+    while (n == BUFFER_CHUNK && total < READ_BUDGET) {
+      n = read(event->ident, req->prepareRaw(_bufferPool), BUFFER_CHUNK);
+      req->commitRaw(n > 0 ? n : 0);
+      if (n > 0) total += n;
+    }
+    updateMemory(client);
+    if (n == 0 && waitpid(conn->pid, NULL, WNOHANG) == conn->pid) {
+      Response *res = conn->cgiRes;
+      int peer = conn->peer;
+      closeCgiPipe(*conn, kq);
+      // the cgi is gone, a body it did not read is dropped
+      if (peer != -1) closeCgiPipe(*kq.getConn(peer), kq);
+      res->convertCGI(req->getRawContents());
+      req->releaseRaw(_bufferPool);
+      spillResponse(*res);
+      updateMemory(client);
+      req->endPhase(PHASE_CGI);
+      req->startPhase();
+      if (client.h2 != NULL) client.h2->setReady(res);
+      kq.changeEvents(client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+                      req->getLocBlock()->getKeepAliveTime() * 1000, &client);
+      kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
+                      &client);
+      // requests that arrived while the cgi was running
+      parseRequests(client, kq);
+    }
+  } else if (conn->type == FD_UPSTREAM) {
+    readUpstream(*conn, kq);
+  } else if (conn->type == FD_TASK) {
+    finishTasks(kq);
   }
 }
 
 void ServerOperator::handleWriteEvent(struct kevent *event, Kqueue &kq) {
-  if (kq.getFdGroup(event->ident) == FD_CGI) {
-    std::vector<int> &udata = *static_cast<std::vector<int> *>(event->udata);
-    int clientFd = udata[0];
-    Request *req = _clients[clientFd];
+  Connection *conn = static_cast<Connection *>(event->udata);
+
+  if (conn->type == FD_CGI) {
+    if (conn->client == -1) {
+      closeCgiPipe(*conn, kq);
+      return;
+    }
+    Request *req = conn->cgiReq;
 
-    size_t bodySize = req->getBody().size();
+    size_t bodySize = req->getBodySize();
     ssize_t bytesWritten = 0;
-    int &totalBytesWritten = udata[4];
-    size_t chunk = 32768;
-
-    if (totalBytesWritten + chunk > bodySize)
-      chunk = bodySize - totalBytesWritten;
-    bytesWritten =
-        write(event->ident,
-              req->getBody().substr(totalBytesWritten, chunk).c_str(), chunk);
+    char buf[BUFFER_CHUNK];
+    size_t chunk = sizeof(buf);
+
+    if (conn->written + chunk > bodySize) chunk = bodySize - conn->written;
+    if (req->getBodyFd() != -1) {
+      ssize_t n = pread(req->getBodyFd(), buf, chunk, conn->written);
+      bytesWritten = n == -1 ? -1 : write(event->ident, buf, n);
+    } else
+      bytesWritten =
+          write(event->ident, req->getBody().c_str() + conn->written, chunk);
     if (bytesWritten == -1) {
       // std::cerr << "write error" << std::endl;
       return;
     }
-    totalBytesWritten += bytesWritten;
+    conn->written += bytesWritten;
+
+    if (conn->written == bodySize) closeCgiPipe(*conn, kq);
+    return;
+  } else if (conn->type == FD_CLIENT) {
+    if (conn->tls != NULL && conn->tls->isDone() == false)
+      handshakeTls(*conn, EVFILT_WRITE, kq);
+    else if (conn->h2 != NULL)
+      sendFrames(*conn, kq);
+    else
+      sendResponses(*conn, kq);
+  } else if (conn->type == FD_UPSTREAM) {
+    sendUpstream(*conn, kq);
+  }
+}
+
+// closes a pipe of a cgi, its client and the other pipe stop pointing at it
+void ServerOperator::closeCgiPipe(Connection &pipe, Kqueue &kq) {
+  if (pipe.client != -1) {
+    std::vector<int> &pipes = kq.getConn(pipe.client)->cgiPipes;
+    pipes.erase(std::remove(pipes.begin(), pipes.end(), pipe.fd), pipes.end());
+  }
+  if (pipe.peer != -1) kq.getConn(pipe.peer)->peer = -1;
+  kq.closeConn(&pipe);
+  close(pipe.fd);
+}
+
+// proxy_pass: the request goes to an idle connection of the upstream or a
+// new one, the response comes back on its events. false if no connection
+// can be made, the response is 502 then
+bool ServerOperator::startProxy(Connection &client, Request &req,
+                                Response &res, Kqueue &kq) {
+  ServerBlock *locBlock = req.getLocBlock();
+  std::vector<int> &idle = _upstreamPool[locBlock->getProxyUpstream()];
+  bool isReused = idle.empty() == false;
+  int fd = isReused ? idle.back() : Proxy::connect(locBlock->getProxyAddr());
+  Connection *upstream;
+
+  if (fd == -1) {
+    Logger::log(LEVEL_ERROR,
+                "proxy_pass: connect() error " + locBlock->getProxyUpstream());
+    res.setErrorRes(502);
+    return false;
+  }
+  if (isReused) {
+    idle.pop_back();
+    upstream = kq.getConn(fd);
+    _upstreamReuseCnt++;
+  } else {
+    upstream = kq.openConn(fd, FD_UPSTREAM);
+    kq.changeEvents(fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, upstream);
+    _upstreamConnectCnt++;
+  }
+  upstream->client = client.fd;
+  upstream->proxy = new Proxy(req, res, client.tls != NULL, isReused);
+  client.upstreams.push_back(fd);
+  kq.changeEvents(fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, upstream);
+  return true;
+}
+
+// writes the request. a new connection gets writable once connect() is
+// done, a refused one fails the first write
+void ServerOperator::sendUpstream(Connection &upstream, Kqueue &kq) {
+  if (upstream.proxy->send(upstream.fd) == -1) {
+    failUpstream(upstream, kq);
+    return;
+  }
+  if (upstream.proxy->isSent())
+    kq.changeEvents(upstream.fd, EVFILT_WRITE, EV_DELETE, 0, 0, &upstream);
+}
+
+// the response, relayed to the client as it comes. reads stop while the
+// client is PROXY_BUFFER_MAX behind. an idle connection that gets readable
+// was closed by the upstream
+void ServerOperator::readUpstream(Connection &upstream, Kqueue &kq) {
+  if (upstream.proxy == NULL) {
+    closeUpstream(upstream, kq);
+    return;
+  }
+  Proxy &proxy = *upstream.proxy;
+  Connection &client = *kq.getConn(upstream.client);
+  Request &req = proxy.getRequest();
+  Response &res = proxy.getResponse();
+  bool hadHead = res.hasResult();
+  char buf[BUFFER_CHUNK];
+  size_t total = 0;
+  ssize_t n = BUFFER_CHUNK;
 
-    if (totalBytesWritten == static_cast<int>(req->getBody().size())) {
-      kq.eraseFdGroup(event->ident, FD_CGI);
-      close(event->ident);
+  while (n == BUFFER_CHUNK && total < READ_BUDGET && proxy.isEnd() == false &&
+         res.getRelaySize() < PROXY_BUFFER_MAX) {
+    n = read(upstream.fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    total += n;
+    if (proxy.receive(buf, n) == false) {
+      Logger::log(LEVEL_ERROR, "proxy_pass: invalid response from " +
+                                   req.getLocBlock()->getProxyUpstream());
+      failUpstream(upstream, kq);
+      return;
     }
+  }
+  if ((n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) &&
+      proxy.receiveEnd() == false) {
+    failUpstream(upstream, kq);
     return;
-  } else if (kq.getFdGroup(event->ident) == FD_CLIENT) {
-    Request *req = _clients[event->ident];
+  }
+  if (proxy.isEnd())
+    releaseUpstream(upstream, kq);
+  else if (res.getRelaySize() >= PROXY_BUFFER_MAX) {
+    proxy.setPaused(true);
+    kq.changeEvents(upstream.fd, EVFILT_READ, EV_DISABLE, 0, 0, &upstream);
+  }
+  if (hadHead == false && res.hasResult()) {
+    req.endPhase(PHASE_UPSTREAM);
+    req.startPhase();
+    relayHead(client, res, kq);
+    return;
+  }
+  updateMemory(client);
+  kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, &client);
+}
 
-    if (event->udata) {
-      Response *res = static_cast<Response *>(event->udata);
+// the response of an upstream has its head or its 502. like after a cgi it
+// gets sent and the requests that came behind it are parsed
+void ServerOperator::relayHead(Connection &client, Response &res,
+                               Kqueue &kq) {
+  if (client.h2 != NULL) client.h2->setReady(&res);
+  updateMemory(client);
+  kq.changeEvents(
+      client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+      client.server->getSPSBList()->front()->getKeepAliveTime() * 1000,
+      &client);
+  kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, &client);
+  parseRequests(client, kq);
+}
 
-      if (res->sendResponse(event->ident) == EXIT_FAILURE) {
-        // std::cerr << "client write error!" << std::endl;
-        delete res;
-        disconnectClient(event->ident, kq);
-      }
+// the upstream failed or sent no valid response. a pooled connection that
+// it closed while idle is replaced by another one if the request can be
+// sent again, else a response that has not started is 502 and one being
+// relayed is cut short
+void ServerOperator::failUpstream(Connection &upstream, Kqueue &kq) {
+  Proxy *proxy = upstream.proxy;
+  Connection &client = *kq.getConn(upstream.client);
+  Request &req = proxy->getRequest();
+  Response &res = proxy->getResponse();
+  bool isRetry = proxy->isRetryable();
 
-      if (res->isFullWrite() == true) {
-        delete res;
-        if (req->getStatus() == 413)
-          disconnectClient(event->ident, kq);
-        else {
-          kq.changeEvents(event->ident, EVFILT_TIMER, EV_ENABLE, 0,
-                          req->getLocBlock()->getKeepAliveTime() * 1000, NULL);
-          req->clear();
-          kq.changeEvents(event->ident, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-          kq.changeEvents(event->ident, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0,
-                          NULL);
-        }
-      }
+  closeUpstream(upstream, kq);
+  if (res.hasResult()) {
+    res.endRelay(false);
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
+                    &client);
+    return;
+  }
+  if (isRetry && startProxy(client, req, res, kq)) return;
+  if (res.hasResult() == false) {
+    Logger::log(LEVEL_ERROR, "proxy_pass: no response from " +
+                                 req.getLocBlock()->getProxyUpstream());
+    res.setErrorRes(502);
+  }
+  req.endPhase(PHASE_UPSTREAM);
+  req.startPhase();
+  relayHead(client, res, kq);
+}
+
+// a finished exchange. the connection waits in the pool of its upstream for
+// the next request if it can take one and the pool has room
+void ServerOperator::releaseUpstream(Connection &upstream, Kqueue &kq) {
+  ServerBlock *locBlock = upstream.proxy->getRequest().getLocBlock();
+  std::vector<int> &idle = _upstreamPool[locBlock->getProxyUpstream()];
+
+  if (upstream.proxy->isKeepAlive() == false ||
+      idle.size() >= locBlock->getProxyKeepalive()) {
+    closeUpstream(upstream, kq);
+    return;
+  }
+  std::vector<int> &fds = kq.getConn(upstream.client)->upstreams;
+  fds.erase(std::remove(fds.begin(), fds.end(), upstream.fd), fds.end());
+  upstream.client = -1;
+  delete upstream.proxy;
+  upstream.proxy = NULL;
+  idle.push_back(upstream.fd);
+}
+
+// closes an upstream socket, its client or the pool forgets it
+void ServerOperator::closeUpstream(Connection &upstream, Kqueue &kq) {
+  if (upstream.client != -1) {
+    std::vector<int> &fds = kq.getConn(upstream.client)->upstreams;
+    fds.erase(std::remove(fds.begin(), fds.end(), upstream.fd), fds.end());
+  } else if (upstream.proxy == NULL) {
+    std::map<std::string, std::vector<int> >::iterator it;
+    for (it = _upstreamPool.begin(); it != _upstreamPool.end(); it++)
+      it->second.erase(
+          std::remove(it->second.begin(), it->second.end(), upstream.fd),
+          it->second.end());
+  }
+  delete upstream.proxy;
+  upstream.proxy = NULL;
+  kq.closeConn(&upstream);
+  close(upstream.fd);
+}
+
+// a dropped response whose upstream is still relaying, a reset stream
+void ServerOperator::closeUpstreamOf(Connection &client, Response *res,
+                                     Kqueue &kq) {
+  for (size_t i = 0; i < client.upstreams.size(); i++) {
+    Connection &upstream = *kq.getConn(client.upstreams[i]);
+    if (&upstream.proxy->getResponse() == res) {
+      closeUpstream(upstream, kq);
       return;
-    } else {
-      Response *res = new Response();
-      ServerBlock *locBlock = req->getLocBlock();
-
-      if (req->getStatus() != 200) {
-        res->setErrorRes(req->getStatus());
-      } else {
-        Method *method;
-        const std::string &limit = locBlock->getLimitExcept();
-
-        if ((req->getMethod() == "GET") && (limit == "GET" || limit == ""))
-          method = new Get();
-        else if ((req->getMethod() == "POST") &&
-                 (limit == "POST" || limit == "")) {
-          method = new Post(kq, event->ident);
-        } else if (req->getMethod() == "DELETE" &&
-                   (limit == "DELETE" || limit == ""))
-          method = new Delete();
-        else {
-          method = new Method();
-        }
-        method->process(*req, *res);
-        delete method;
-      }
+    }
+  }
+}
+
+// upstreams stopped for a client that was behind read again once it has
+// sent half of what they relayed
+void ServerOperator::resumeUpstreams(Connection &client, Kqueue &kq) {
+  for (size_t i = 0; i < client.upstreams.size(); i++) {
+    Connection &upstream = *kq.getConn(client.upstreams[i]);
+    Proxy &proxy = *upstream.proxy;
+    if (proxy.isPaused() &&
+        proxy.getResponse().getRelaySize() < PROXY_BUFFER_MAX / 2) {
+      proxy.setPaused(false);
+      kq.changeEvents(upstream.fd, EVFILT_READ, EV_ENABLE, 0, 0, &upstream);
+    }
+  }
+}
+
+// a step of the tls handshake on a read or write event of the client. the
+// write filter is on while it waits for the socket to take its records.
+// true once it is done, false until then or if the client is gone
+bool ServerOperator::handshakeTls(Connection &client, int16_t filter,
+                                  Kqueue &kq) {
+  e_tlsState state = client.tls->handshake();
+
+  if (state == TLS_ERROR) {
+    Logger::log(LEVEL_INFO,
+                "tls handshake failed: " + Tls::popErrors() + " client ",
+                client.fd);
+    disconnectClient(client, kq);
+    return false;
+  }
+  if (state == TLS_WANT_WRITE && filter == EVFILT_READ)
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
+                    &client);
+  else if (state != TLS_WANT_WRITE && filter == EVFILT_WRITE)
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_DELETE, 0, 0, &client);
+  if (state != TLS_DONE) return false;
+  _tlsHandshakeCnt++;
+  if (client.tls->isResumed()) _tlsResumeCnt++;
+  if (client.tls->isKtlsSend()) _ktlsCnt++;
+  return true;
+}
+
+// it has its result, no file thread works on it and a relayed body is not
+// waiting for its upstream
+static bool isReady(Connection &client, Response *res) {
+  return (client.task == NULL || client.task->res != res) &&
+         res->hasResult() && res->isStalled() == false;
+}
+
+// parses every complete request in the read buffer, leftover bytes are kept
+// for the next request. stops while a cgi or task runs to keep the order.
+// with http2 on, a connection that starts with the preface or upgrades its
+// first request goes on as http2
+void ServerOperator::parseRequests(Connection &client, Kqueue &kq) {
+  SPSBList *sbList = client.server->getSPSBList();
+  ResponseQueue &queue = client.queue;
+  bool isQueued = false;
+
+  if (client.h2 == NULL && client.reqCount == 0 && queue.empty() &&
+      sbList->front()->getHttp2() == "on") {
+    int match = Http2::matchPreface(client.req->getRawContents());
+    if (match == 0) return;
+    if (match == 1) {
+      client.h2 = new Http2(client.req->getHeaderByKey("ClientIP"));
+      client.h2->start();
+    }
+  }
+  if (client.h2 != NULL) {
+    parseFrames(client, kq);
+    return;
+  }
+  while (isWaiting(client) == false && isClosing(client) == false) {
+    Request *req = client.req;
+
+    req->parsing(sbList, _locationMap, _limiter);
+    if (req->isFullReq() == false) break;
+
+    Request *next = new Request();
+    next->addHeader("ClientIP", req->getHeaderByKey("ClientIP"));
+    req->moveRawContents(*next);
+    client.req = next;
+    _requestCnt++;
+    if (queue.empty() && isHttp2Upgrade(client, *req) &&
+        upgradeHttp2(client, req, kq))
+      return;
+
+    Response *res = new Response(req->getLocBlock());
+    // the rest of the stream is unusable after 413 or a body not read
+    if (req->isKeepAlive() == false || req->getStatus() == 413 ||
+        req->isBodyLeft() ||
+        ++client.reqCount >= sbList->front()->getKeepAliveRequests())
+      res->setConnection("close");
+    else if (req->getHeaderByKey("protocol") == "HTTP/1.0")
+      res->setConnection("keep-alive");
+    queue.push_back(std::make_pair(req, res));
+    processRequest(client, *req, *res, kq);
+    if (client.task == NULL && res->hasResult()) spillResponse(*res);
+    isQueued = true;
+  }
+  if (isQueued == false) return;
+  updateMemory(client);
+  kq.changeEvents(client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+                  sbList->front()->getKeepAliveTime() * 1000, &client);
+  if (isReady(client, queue.front().second))
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
+                    &client);
+}
+
+// Upgrade: h2c on the first request of a port with http2 on, tls ones
+// choose h2 with ALPN instead
+bool ServerOperator::isHttp2Upgrade(Connection &client, Request &req) {
+  std::string upgrade = req.getHeaderByKey("Upgrade");
+
+  ftToupper(upgrade);
+  return client.reqCount == 0 && client.tls == NULL &&
+         client.server->getSPSBList()->front()->getHttp2() == "on" &&
+         req.getStatus() == 200 && upgrade.find("H2C") != std::string::npos &&
+         req.getHeaderByKey("HTTP2-Settings") != "";
+}
+
+// the request is answered as stream 1 after 101, the bytes after it are
+// frames. false if its settings are bad, it is answered over HTTP/1.1 then
+bool ServerOperator::upgradeHttp2(Connection &client, Request *req,
+                                  Kqueue &kq) {
+  Http2 *h2 = new Http2(req->getHeaderByKey("ClientIP"));
+
+  if (h2->upgrade(req) == false) {
+    delete h2;
+    return false;
+  }
+  client.h2 = h2;
+  client.reqCount++;
+  req->addHeader("protocol", "HTTP/2.0");
+  Response *res = new Response(req->getLocBlock());
+  h2->setResponse(1, res);
+  client.queue.push_back(std::make_pair(req, res));
+  processRequest(client, *req, *res, kq);
+  if (isReady(client, res)) {
+    spillResponse(*res);
+    h2->setReady(res);
+  }
+  parseFrames(client, kq);
+  return true;
+}
+
+// an http2 connection: the read buffer holds frames. a stream whose request
+// is complete is processed right away, its response is sent once ready
+// without waiting for the streams before it
+void ServerOperator::parseFrames(Connection &client, Kqueue &kq) {
+  Http2 &h2 = *client.h2;
+  SPSBList *sbList = client.server->getSPSBList();
+  const std::string &raw = client.req->getRawContents();
+  std::vector<uint32_t> ids;
+
+  client.req->consumeRaw(h2.receive(raw.data(), raw.size()));
+  h2.popUpdated(ids);
+  for (size_t i = 0; i < ids.size(); i++) {
+    Request *req = h2.getRequest(ids[i]);
+    if (req == NULL) continue;
+    req->parsing(sbList, _locationMap, _limiter);
+    if (req->isFullReq() == false) continue;
+    _requestCnt++;
+    Response *res = new Response(req->getLocBlock());
+    h2.setResponse(ids[i], res);
+    client.queue.push_back(std::make_pair(req, res));
+    processRequest(client, *req, *res, kq);
+    if (isReady(client, res)) {
+      spillResponse(*res);
+      h2.setReady(res);
+    }
+    if (++client.reqCount >= sbList->front()->getKeepAliveRequests())
+      h2.goAway(H2_NO_ERROR);
+  }
+  updateMemory(client);
+  if (h2.isDone()) {
+    disconnectClient(client, kq);
+    return;
+  }
+  kq.changeEvents(client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+                  sbList->front()->getKeepAliveTime() * 1000, &client);
+  if (h2.wantsWrite())
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
+                    &client);
+}
+
+// writes the frames of the ready streams. a response whose last frame is
+// queued is done, so is one the client reset
+void ServerOperator::sendFrames(Connection &client, Kqueue &kq) {
+  Http2 &h2 = *client.h2;
+  std::vector<Response *> finished;
+
+  h2.fill();
+  h2.popFinished(finished);
+  for (size_t i = 0; i < finished.size(); i++) {
+    ResponseQueue::iterator it = client.queue.begin();
+    while (it->second != finished[i]) it++;
+    closeUpstreamOf(client, finished[i], kq);
+    recordStats(*it->first, *it->second);
+    delete it->first;
+    delete it->second;
+    client.queue.erase(it);
+  }
+  if (h2.getOutSize() > 0) {
+    ssize_t bytesWritten =
+        sockWrite(client.fd, client.tls, h2.getOutData(), h2.getOutSize());
+    if (bytesWritten == -1) {
+      disconnectClient(client, kq);
+      return;
+    }
+    h2.addSent(bytesWritten);
+  }
+  resumeUpstreams(client, kq);
+  if (h2.isDone()) {
+    disconnectClient(client, kq);
+    return;
+  }
+  kq.changeEvents(
+      client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+      client.server->getSPSBList()->front()->getKeepAliveTime() * 1000,
+      &client);
+  if (h2.wantsWrite() == false)
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_DELETE, 0, 0, &client);
+  if (h2.isIdle() && client.req->isEmpty()) setIdle(client);
+  updateMemory(client);
+}
+
+void ServerOperator::processRequest(Connection &client, Request &req,
+                                    Response &res, Kqueue &kq) {
+  ServerBlock *locBlock = req.getLocBlock();
+
+  // held back by limit_req, it waits without a result like one of a cgi
+  if (req.getDelayUntil() > 0) {
+    _delayed.insert(std::make_pair(req.getDelayUntil(), client.fd));
+    return;
+  }
+  req.startPhase();
+  if (req.getStatus() != 200) {
+    res.setErrorRes(req.getStatus());
+    return;
+  }
+  if (locBlock->getStubStatus() != "off") {
+    makeStatusPage(res, locBlock->getStubStatus() == "prometheus", kq);
+    return;
+  }
+  Method *method;
+  const std::string &limit = locBlock->getLimitExcept();
+
+  if (locBlock->getProxyPass().empty() == false &&
+      (limit == req.getMethod() || limit == "")) {
+    startProxy(client, req, res, kq);
+    req.endPhase(PHASE_HANDLER);
+    req.startPhase();  // upstream or flush from here
+    return;
+  }
+
+  if ((req.getMethod() == "GET") && (limit == "GET" || limit == ""))
+    method = new Get();
+  else if ((req.getMethod() == "POST") && (limit == "POST" || limit == "")) {
+    method = new Post(kq, client.fd);
+  } else if (req.getMethod() == "DELETE" && (limit == "DELETE" || limit == ""))
+    method = new Delete();
+  else {
+    method = new Method();
+  }
+  // a client has one task at a time, more http2 streams run on the loop
+  if (method->isFileWork(req) && _filePool.getThreadCount() > 0 &&
+      client.task == NULL) {
+    MethodTask *task = new MethodTask;
+    task->method = method;
+    task->req = &req;
+    task->res = &res;
+    task->client = client.fd;
+    task->memory = req.getMemorySize() + res.getMemorySize();
+    if (_filePool.push(task)) {
+      client.task = task;
+      return;
+    }
+    delete task;
+  }
+  method->process(req, res);
+  delete method;
+  req.endPhase(PHASE_HANDLER);
+  req.startPhase();  // cgi or flush from here
+}
+
+// requests held back by limit_req whose time has come are handled, one per
+// entry. the client of an entry may be gone or another one by now
+void ServerOperator::runDelayed(Kqueue &kq) {
+  unsigned long now = getMonotonicUsec();
 
-      if (res->isInHeader("Content-Length") == false &&
-          req->getMethod() != "DELETE") {
-        kq.changeEvents(event->ident, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-        delete res;
-        return;
+  while (_delayed.empty() == false && _delayed.begin()->first <= now) {
+    Connection *client = kq.getConn(_delayed.begin()->second);
+    _delayed.erase(_delayed.begin());
+    if (client == NULL || client->type != FD_CLIENT) continue;
+    for (ResponseQueue::iterator it = client->queue.begin();
+         it != client->queue.end(); it++) {
+      Request &req = *it->first;
+      Response &res = *it->second;
+      if (req.getDelayUntil() == 0 || req.getDelayUntil() > now) continue;
+      req.clearDelay();
+      processRequest(*client, req, res, kq);
+      // a task, cgi or upstream sends it once it is done
+      if ((client->task == NULL || client->task->res != &res) &&
+          res.hasResult()) {
+        spillResponse(res);
+        relayHead(*client, res, kq);
       }
-      kq.changeEvents(event->ident, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-      kq.changeEvents(event->ident, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
-                      res);
+      break;
     }
   }
 }
 
-bool ServerOperator::isExistClient(int clientSock) {
-  if (_clients.find(clientSock) == _clients.end()) return false;
+// the wait for events, shorter if a request held back is due before it
+struct timespec *ServerOperator::getWaitTimeout(struct timespec *timeout,
+                                                struct timespec &buf) {
+  if (_delayed.empty()) return timeout;
+  unsigned long now = getMonotonicUsec();
+  unsigned long due = _delayed.begin()->first;
+  unsigned long wait = due > now ? (due - now + 999) / 1000 * 1000 : 0;
+
+  if (timeout != NULL &&
+      static_cast<unsigned long>(timeout->tv_sec) * 1000000 <= wait)
+    return timeout;
+  buf.tv_sec = wait / 1000000;
+  buf.tv_nsec = (wait % 1000000) * 1000;
+  return &buf;
+}
+
+// file thread: the handler and its blocking calls
+void MethodTask::run() {
+  method->process(*req, *res);
+  req->endPhase(PHASE_HANDLER);
+  req->startPhase();  // cgi or flush from here
+}
+
+// event loop: the tasks whose handler is done, their responses get sent
+void ServerOperator::finishTasks(Kqueue &kq) {
+  std::vector<FileTask *> tasks;
+
+  _filePool.popFinished(tasks);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    // the pool only runs MethodTasks
+    MethodTask *task = static_cast<MethodTask *>(tasks[i]);
+    delete task->method;
+    if (task->client == -1) {
+      delete task->req;
+      delete task->res;
+      delete task;
+      continue;
+    }
+    Connection &client = *kq.getConn(task->client);
+    Response *res = task->res;
+    client.task = NULL;
+    delete task;
+    if (res->hasResult()) spillResponse(*res);
+    if (client.h2 != NULL && res->hasResult()) client.h2->setReady(res);
+    updateMemory(client);
+    kq.changeEvents(
+        client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+        client.server->getSPSBList()->front()->getKeepAliveTime() * 1000,
+        &client);
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0,
+                    &client);
+    // requests that arrived while the task was running
+    parseRequests(client, kq);
+  }
+}
+
+// a response without result is waiting for its cgi output, one of a task
+// for its file thread
+bool ServerOperator::isWaiting(Connection &client) {
+  ResponseQueue &queue = client.queue;
+
+  if (client.task != NULL) return true;
+  return queue.empty() == false && queue.back().second->hasResult() == false;
+}
+
+// writes every ready response at the front of the queue with one writev.
+// a streamed body ends the batch, it is sent on its own
+void ServerOperator::sendResponses(Connection &client, Kqueue &kq) {
+  ResponseQueue &queue = client.queue;
+  struct iovec iov[MAX_IOV];
+  int iovCnt = 0;
+  ssize_t bytesWritten = 0;
+
+  for (ResponseQueue::iterator it = queue.begin();
+       it != queue.end() && iovCnt < MAX_IOV && isReady(client, it->second);
+       it++) {
+    if (it->second->getRemainSize() > 0) {
+      iov[iovCnt].iov_base = const_cast<char *>(it->second->getRemainData());
+      iov[iovCnt].iov_len = it->second->getRemainSize();
+      iovCnt++;
+    }
+    if (it->second->hasStreamBody()) break;
+  }
+  if (iovCnt > 0)
+    bytesWritten = sockWritev(client.fd, client.tls, iov, iovCnt);
+  else if (queue.empty() == false && isReady(client, queue.front().second) &&
+           queue.front().second->hasStreamBody()) {
+    if (queue.front().second->sendStreamBody(client.fd, client.tls) ==
+        EXIT_FAILURE)
+      bytesWritten = -1;
+  } else {
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_DELETE, 0, 0, &client);
+    return;
+  }
+  if (bytesWritten == -1) {
+    // std::cerr << "client write error!" << std::endl;
+    disconnectClient(client, kq);
+    return;
+  }
+  resumeUpstreams(client, kq);
+
+  size_t written = bytesWritten;
+  while (queue.empty() == false && isReady(client, queue.front().second)) {
+    Request *req = queue.front().first;
+    Response *res = queue.front().second;
+
+    written = res->addSendCnt(written);
+    if (res->isFullWrite() == false) {
+      updateMemory(client);
+      return;
+    }
+    recordStats(*req, *res);
+    bool isKeepAlive = res->isKeepAlive();
+    delete req;
+    delete res;
+    queue.pop_front();
+    if (isKeepAlive == false) {
+      disconnectClient(client, kq);
+      return;
+    }
+  }
+  kq.changeEvents(
+      client.fd, EVFILT_TIMER, EV_ENABLE, 0,
+      client.server->getSPSBList()->front()->getKeepAliveTime() * 1000,
+      &client);
+  if (queue.empty() || isReady(client, queue.front().second) == false)
+    kq.changeEvents(client.fd, EVFILT_WRITE, EV_DELETE, 0, 0, &client);
+  if (queue.empty() && client.req->isEmpty()) setIdle(client);
+  updateMemory(client);
+}
+
+// no more requests are parsed after a response that closes the connection
+bool ServerOperator::isClosing(Connection &client) {
+  ResponseQueue &queue = client.queue;
+
+  return queue.empty() == false && queue.back().second->isKeepAlive() == false;
+}
+
+// an idle client keeps no read buffer
+void ServerOperator::setIdle(Connection &client) {
+  unsetIdle(client);
+  client.req->releaseRaw(_bufferPool);
+  client.idlePos = _idleClients.insert(_idleClients.end(), &client);
+  client.isIdle = true;
+}
+
+void ServerOperator::unsetIdle(Connection &client) {
+  if (client.isIdle == false) return;
+  _idleClients.erase(client.idlePos);
+  client.isIdle = false;
+}
+
+// closes the least recently used idle client, false if there is none
+bool ServerOperator::reclaimIdleClient(Kqueue &kq) {
+  if (_idleClients.empty()) return false;
+  disconnectClient(*_idleClients.front(), kq);
   return true;
 }
 
-void ServerOperator::disconnectClient(int clientSock, Kqueue &kq) {
-  std::cout << "client disconnected: " << clientSock << std::endl;
-  kq.eraseFdGroup(clientSock, FD_CLIENT);
+void ServerOperator::disconnectClient(Connection &client, Kqueue &kq) {
+  if (client.type != FD_CLIENT) return;
+  Logger::log(LEVEL_INFO, "client disconnected: ", client.fd);
+  if (_capture != NULL) _capture->close(client.fd);
+  kq.changeEvents(client.fd, EVFILT_TIMER, EV_DELETE, 0, 0, &client);
+  // a running cgi finishes on its own, its pipes are closed on their events
+  for (size_t i = 0; i < client.cgiPipes.size(); i++)
+    kq.getConn(client.cgiPipes[i])->client = -1;
+  client.cgiPipes.clear();
+  // an upstream in the middle of a response can not be reused
+  for (size_t i = 0; i < client.upstreams.size(); i++) {
+    Connection &upstream = *kq.getConn(client.upstreams[i]);
+    upstream.client = -1;
+    closeUpstream(upstream, kq);
+  }
+  client.upstreams.clear();
+  unsetIdle(client);
+  kq.closeConn(&client);
+  delete client.tls;  // its close_notify goes out before the close
+  client.tls = NULL;
+  sockClose(client.fd);
+  client.req->releaseRaw(_bufferPool);
+  delete client.req;
+  client.req = NULL;
+  delete client.h2;
+  client.h2 = NULL;
+  ResponseQueue &queue = client.queue;
+  for (ResponseQueue::iterator it = queue.begin(); it != queue.end(); it++) {
+    // a running task frees its request and response once it is back
+    if (client.task != NULL && client.task->res == it->second) continue;
+    delete it->first;
+    delete it->second;
+  }
+  queue.clear();
+  if (client.task != NULL) client.task->client = -1;
+  client.task = NULL;
+  _memoryUsed -= client.memory;
+  client.memory = 0;
+  _clientCnt--;
+}
+
+bool ServerOperator::isOverBudget() const {
+  return _memoryBudget > 0 && _memoryUsed + _heldMemory >= _memoryBudget;
+}
+
+// counts the heap bytes the client holds now into the worker total
+void ServerOperator::updateMemory(Connection &client) {
+  size_t memory = client.req->getMemorySize();
+
+  if (client.h2 != NULL) memory += client.h2->getMemorySize();
+
+  for (ResponseQueue::iterator it = client.queue.begin();
+       it != client.queue.end(); it++) {
+    if (client.task != NULL && client.task->res == it->second)
+      memory += client.task->memory;  // its file thread may change it
+    else
+      memory += it->first->getMemorySize() + it->second->getMemorySize();
+  }
+  _memoryUsed = _memoryUsed - client.memory + memory;
+  client.memory = memory;
+}
+
+// over the budget a client is not read until responses free memory. its
+// timer keeps running, a client that stays paused gets 408
+void ServerOperator::pauseClient(Connection &client, Kqueue &kq) {
+  kq.changeEvents(client.fd, EVFILT_READ, EV_DISABLE, 0, 0, &client);
+  client.isPaused = true;
+  _pausedClients.push_back(client.fd);
+}
+
+void ServerOperator::resumeClients(Kqueue &kq) {
+  while (_pausedClients.empty() == false && isOverBudget() == false) {
+    Connection *client = kq.getConn(_pausedClients.front());
+    _pausedClients.pop_front();
+    if (client == NULL || client->type != FD_CLIENT ||
+        client->isPaused == false)
+      continue;
+    client->isPaused = false;
+    kq.changeEvents(client->fd, EVFILT_READ, EV_ENABLE, 0, 0, client);
+  }
+}
+
+// new connections over the budget get the prepared 503 page, ssl ones are
+// closed before their handshake
+void ServerOperator::rejectClient(int clientSock, bool isSsl) {
+  Response res;
+
+  Logger::log(LEVEL_WARN, "memory_budget is reached, 503 to ", clientSock);
+  res.setConnection("close");
+  res.setErrorRes(503);
+  if (isSsl == false) res.sendResponse(clientSock, NULL);
   close(clientSock);
-  delete _clients[clientSock];
-  _clients.erase(clientSock);
-  _clientToServer.erase(clientSock);
+  _rejectCnt++;
+}
+
+// a body that does not fit in the budget is sent from a temp file
+void ServerOperator::spillResponse(Response &res) {
+  if (_memoryBudget == 0 ||
+      _memoryUsed + _heldMemory + res.getMemorySize() < _memoryBudget)
+    return;
+  if (res.spillBody()) _spillCnt++;
+}
+
+// per server and location rows, metrics of a family are kept together
+void ServerOperator::writeBlockStats(std::stringstream &ss,
+                                     const std::vector<StatsRow> &rows,
+                                     bool isPrometheus) {
+  if (isPrometheus == false) {
+    ss << "server location requests bytes 1xx 2xx 3xx 4xx 5xx\n";
+    for (size_t i = 0; i < rows.size(); i++) {
+      ss << rows[i].server << " "
+         << (rows[i].location.empty() ? "-" : rows[i].location) << " "
+         << rows[i].stats->requests << " " << rows[i].stats->bytes;
+      for (size_t code = 1; code < 6; code++)
+        ss << " " << rows[i].stats->statusClass[code];
+      ss << "\n";
+    }
+    return;
+  }
+  std::vector<std::string> labels;
+  for (size_t i = 0; i < rows.size(); i++)
+    labels.push_back("server=\"" + rows[i].server + "\",location=\"" +
+                     rows[i].location + "\"");
+  ss << "# TYPE webserv_requests_total counter\n";
+  for (size_t i = 0; i < rows.size(); i++)
+    ss << "webserv_requests_total{" << labels[i] << "} "
+       << rows[i].stats->requests << "\n";
+  ss << "# TYPE webserv_sent_bytes_total counter\n";
+  for (size_t i = 0; i < rows.size(); i++)
+    ss << "webserv_sent_bytes_total{" << labels[i] << "} "
+       << rows[i].stats->bytes << "\n";
+  ss << "# TYPE webserv_responses_total counter\n";
+  for (size_t i = 0; i < rows.size(); i++)
+    for (size_t code = 1; code < 6; code++)
+      ss << "webserv_responses_total{" << labels[i] << ",status=\"" << code
+         << "xx\"} " << rows[i].stats->statusClass[code] << "\n";
+}
+
+void ServerOperator::collectStatsRows(std::vector<StatsRow> &rows) {
+  for (ServerMap::iterator it = _serverMap.begin(); it != _serverMap.end();
+       it++) {
+    SPSBList *sbList = it->second->getSPSBList();
+    for (SPSBList::iterator sb = sbList->begin(); sb != sbList->end(); sb++) {
+      StatsRow row = {
+          (*sb)->getServerName() + ":" + ftItos((*sb)->getListenPort()), "",
+          &(*sb)->getStats()};
+      rows.push_back(row);
+      if (_locationMap.find(*sb) == _locationMap.end()) continue;
+      LocationList *locList = _locationMap[*sb];
+      for (LocationList::iterator loc = locList->begin();
+           loc != locList->end(); loc++) {
+        row.location = (*loc)->getPath();
+        row.stats = &(*loc)->getStats();
+        rows.push_back(row);
+      }
+    }
+  }
+}
+
+// stub_status on: the nginx layout, then a row per server and location.
+// stub_status prometheus: the text exposition format
+void ServerOperator::makeStatusPage(Response &res, bool isPrometheus,
+                                    Kqueue &kq) {
+  size_t writing = 0;
+  size_t waiting = _idleClients.size();
+  std::vector<StatsRow> rows;
+  std::stringstream ss;
+
+  size_t paused = 0;
+  size_t maxMemory = 0;  // of one client
+  for (size_t fd = 0; fd < kq.getSlotCount(); fd++) {
+    Connection *conn = kq.getConn(fd);
+    if (conn == NULL || conn->type != FD_CLIENT) continue;
+    if (conn->queue.empty() == false) writing++;
+    if (conn->isPaused) paused++;
+    maxMemory = std::max(maxMemory, conn->memory);
+  }
+  size_t reading = _clientCnt - writing - waiting;
+
+  if (isPrometheus) {
+    ss << "# TYPE webserv_connections gauge\n"
+       << "webserv_connections{state=\"active\"} " << _clientCnt << "\n"
+       << "webserv_connections{state=\"reading\"} " << reading << "\n"
+       << "webserv_connections{state=\"writing\"} " << writing << "\n"
+       << "webserv_connections{state=\"waiting\"} " << waiting << "\n"
+       << "# TYPE webserv_connections_accepted_total counter\n"
+       << "webserv_connections_accepted_total " << _acceptCnt << "\n"
+       << "# TYPE webserv_connections_handled_total counter\n"
+       << "webserv_connections_handled_total " << _handledCnt << "\n"
+       << "# TYPE webserv_http_requests_total counter\n"
+       << "webserv_http_requests_total " << _requestCnt << "\n"
+       << "# TYPE webserv_memory_bytes gauge\n"
+       << "webserv_memory_bytes " << _memoryUsed + _heldMemory << "\n"
+       << "# TYPE webserv_memory_budget_bytes gauge\n"
+       << "webserv_memory_budget_bytes " << _memoryBudget << "\n"
+       << "# TYPE webserv_memory_connection_max_bytes gauge\n"
+       << "webserv_memory_connection_max_bytes " << maxMemory << "\n"
+       << "# TYPE webserv_memory_paused_connections gauge\n"
+       << "webserv_memory_paused_connections " << paused << "\n"
+       << "# TYPE webserv_memory_rejected_total counter\n"
+       << "webserv_memory_rejected_total " << _rejectCnt << "\n"
+       << "# TYPE webserv_memory_spilled_total counter\n"
+       << "webserv_memory_spilled_total " << _spillCnt << "\n"
+       << "# TYPE webserv_file_threads gauge\n"
+       << "webserv_file_threads " << _filePool.getThreadCount() << "\n"
+       << "# TYPE webserv_file_tasks gauge\n"
+       << "webserv_file_tasks " << _filePool.getInFlight() << "\n"
+       << "# TYPE webserv_ssl_handshakes_total counter\n"
+       << "webserv_ssl_handshakes_total " << _tlsHandshakeCnt << "\n"
+       << "# TYPE webserv_ssl_session_reuses_total counter\n"
+       << "webserv_ssl_session_reuses_total " << _tlsResumeCnt << "\n"
+       << "# TYPE webserv_ssl_ktls_total counter\n"
+       << "webserv_ssl_ktls_total " << _ktlsCnt << "\n"
+       << "# TYPE webserv_upstream_connects_total counter\n"
+       << "webserv_upstream_connects_total " << _upstreamConnectCnt << "\n"
+       << "# TYPE webserv_upstream_reuses_total counter\n"
+       << "webserv_upstream_reuses_total " << _upstreamReuseCnt << "\n"
+       << "# TYPE webserv_limit_rejected_total counter\n"
+       << "webserv_limit_rejected_total{limit=\"req\"} "
+       << _limiter.getReqRejectCnt() << "\n"
+       << "webserv_limit_rejected_total{limit=\"conn\"} "
+       << _limiter.getConnRejectCnt() << "\n"
+       << "# TYPE webserv_limit_delayed_total counter\n"
+       << "webserv_limit_delayed_total " << _limiter.getDelayCnt() << "\n"
+       << "# TYPE webserv_limit_keys gauge\n"
+       << "webserv_limit_keys " << _limiter.getKeyCnt() << "\n"
+       << "# TYPE webserv_limit_evicted_total counter\n"
+       << "webserv_limit_evicted_total " << _limiter.getEvictCnt() << "\n";
+  } else {
+    ss << "Active connections: " << _clientCnt << " \n"
+       << "server accepts handled requests\n"
+       << " " << _acceptCnt << " " << _handledCnt << " " << _requestCnt
+       << " \n"
+       << "Reading: " << reading << " Writing: " << writing
+       << " Waiting: " << waiting << " \n"
+       << "Memory: " << _memoryUsed + _heldMemory << " budget "
+       << _memoryBudget << " max " << maxMemory << " Paused: " << paused
+       << " Rejected: " << _rejectCnt << " Spilled: " << _spillCnt << " \n"
+       << "File threads: " << _filePool.getThreadCount()
+       << " Tasks: " << _filePool.getInFlight() << " \n"
+       << "SSL handshakes: " << _tlsHandshakeCnt
+       << " Reused: " << _tlsResumeCnt << " Ktls: " << _ktlsCnt << " \n"
+       << "Upstream connects: " << _upstreamConnectCnt
+       << " Reused: " << _upstreamReuseCnt << " \n"
+       << "Limited requests: " << _limiter.getReqRejectCnt()
+       << " Delayed: " << _limiter.getDelayCnt()
+       << " Connections: " << _limiter.getConnRejectCnt()
+       << " Keys: " << _limiter.getKeyCnt()
+       << " Evicted: " << _limiter.getEvictCnt() << " \n";
+  }
+  collectStatsRows(rows);
+  writeBlockStats(ss, rows, isPrometheus);
+
+  std::string body = ss.str();
+  if (isPrometheus)
+    res.setHeaders("Content-Type", "text/plain; version=0.0.4");
+  else
+    res.setHeaders("Content-Type", "text/plain");
+  res.setHeaders("Cache-Control", "no-cache");
+  res.setHeaders("Content-Length", ftUtos(body.size()));
+  res.setBody(body);
+  res.setStatusLine(200);
+  res.setResult();
+}
+
+// called once the response is fully written
+void ServerOperator::recordStats(Request &req, Response &res) {
+  if (req.getLocBlock() == NULL) return;
+  BlockStats &stats = req.getLocBlock()->getStats();
+
+  req.endPhase(PHASE_FLUSH);
+  stats.addResponse(res.getStatusCode(), res.getSentSize());
+  for (int i = 0; i < PHASE_CNT; i++)
+    if (req.getPhaseTime(i) >= 0) stats.phases[i].record(req.getPhaseTime(i));
+  writeAccessLog(req, res);
+}
+
+static const std::string &orDash(const std::string &value) {
+  static const std::string dash = "-";
+
+  return value.empty() ? dash : value;
+}
+
+void ServerOperator::writeAccessLog(Request &req, Response &res) {
+  Logger *log = req.getLocBlock()->getAccessLog();
+  if (log == NULL) return;
+  const LogFormat &format =
+      Logger::getFormat(req.getLocBlock()->getAccessLogFormat());
+  std::string line;
+  char buf[32];
+
+  for (LogFormat::const_iterator it = format.begin(); it != format.end();
+       it++) {
+    switch (it->var) {
+      case VAR_NONE:
+        line += it->text;
+        break;
+      case VAR_REMOTE_ADDR:
+        line += orDash(req.getHeaderByKey("ClientIP"));
+        break;
+      case VAR_TIME_LOCAL:
+        line += Logger::getTimeLocal();
+        break;
+      case VAR_REQUEST:
+        line += req.getHeaderByKey("Method") + " " + req.getHeaderByKey("URI") +
+                " " + req.getHeaderByKey("protocol");
+        break;
+      case VAR_METHOD:
+        line += orDash(req.getHeaderByKey("Method"));
+        break;
+      case VAR_URI:
+        line += orDash(req.getHeaderByKey("RawURI"));
+        break;
+      case VAR_HOST:
+        line += orDash(req.getHeaderByKey("Host"));
+        break;
+      case VAR_STATUS:
+        line += ftItos(res.getStatusCode());
+        break;
+      case VAR_BYTES_SENT:
+        line += ftUtos(res.getSentSize());
+        break;
+      case VAR_REQUEST_TIME: {
+        unsigned long msec = 0;
+        if (req.getArrival() != 0)
+          msec = (getMonotonicUsec() - req.getArrival()) / 1000;
+        snprintf(buf, sizeof(buf), "%lu.%03lu", msec / 1000, msec % 1000);
+        line += buf;
+        break;
+      }
+      case VAR_REFERER:
+        line += orDash(req.getHeaderByKey("Referer"));
+        break;
+      case VAR_USER_AGENT:
+        line += orDash(req.getHeaderByKey("User-Agent"));
+        break;
+    }
+  }
+  log->append(line);
+}
+
+void ServerOperator::writeHistogram(std::stringstream &ss,
+                                    const std::string &name,
+                                    const Histogram &hist) {
+  if (hist.getCount() == 0) return;
+  ss << name << " " << hist.getCount() << " " << hist.percentile(50) << " "
+     << hist.percentile(99) << " " << hist.percentile(99.9) << " "
+     << hist.getMax() << "\n";
+}
+
+// on SIGUSR1, appended to stats_file or written to stderr. times in usec
+void ServerOperator::dumpStats() {
+  std::vector<StatsRow> rows;
+  std::stringstream ss;
+
+  collectStatsRows(rows);
+  const char *loopNames[] = {"events", "changes", "iteration"};
+  Histogram *loopHists[] = {&_loopStats.events, &_loopStats.changes,
+                            &_loopStats.iteration};
+
+  ss << "# " << getCachedTime() << "\n"
+     << "# loop name count p50 p99 p999 max\n";
+  for (size_t i = 0; i < 3; i++)
+    writeHistogram(ss, std::string("loop ") + loopNames[i], *loopHists[i]);
+  for (int i = 0; i < HANDLER_CNT; i++)
+    writeHistogram(ss, std::string("handler ") + getHandlerName(i),
+                   _loopStats.handlers[i]);
+  ss << "# server location phase count p50 p99 p999 max\n";
+  for (size_t i = 0; i < rows.size(); i++) {
+    for (int phase = 0; phase < PHASE_CNT; phase++) {
+      writeHistogram(ss,
+                     rows[i].server + " " +
+                         (rows[i].location.empty() ? "-" : rows[i].location) +
+                         " " + BlockStats::getPhaseName(phase),
+                     rows[i].stats->phases[phase]);
+    }
+  }
+  const std::string &path =
+      _serverMap.begin()->second->getSPSBList()->front()->getStatsFile();
+  if (path.empty()) {
+    std::cerr << ss.str();
+    return;
+  }
+  std::ofstream file(path.c_str(), std::ios::app);
+  if (file.is_open() == false) {
+    Logger::log(LEVEL_ERROR, "stats_file: cannot open " + path);
+    return;
+  }
+  file << ss.str();
 }
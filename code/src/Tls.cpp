@@ -0,0 +1,301 @@
+#include "../includes/Tls.hpp"
+
+#include "../includes/Poller.hpp"
+#include "../includes/Server.hpp"
+
+Tls::Tls(SSL_CTX *ctx, int fd)
+    : _ssl(SSL_new(ctx)), _isDone(false), _isBroken(false), _isKtlsSend(false) {
+  if (_ssl == NULL) return;
+  SSL_set_fd(_ssl, fd);
+  SSL_set_accept_state(_ssl);
+}
+
+// close_notify goes out if the socket takes it right away
+Tls::~Tls() {
+  if (_ssl != NULL && _isDone && _isBroken == false) SSL_shutdown(_ssl);
+  ERR_clear_error();
+  SSL_free(_ssl);
+}
+
+// the context of a server block with a certificate, NULL if it does not
+// load. the session, ticket and ktls settings of the first server of a port
+// are used, SNI only switches the certificate
+SSL_CTX *Tls::createContext(ServerBlock &sb, Server *server) {
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+
+  if (ctx == NULL) return NULL;
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  // a record written in part is finished by the next write, its buffer may
+  // have moved by then. idle connections keep no record buffers
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_RELEASE_BUFFERS);
+  if (SSL_CTX_use_certificate_chain_file(
+          ctx, sb.getSslCertificate().c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, sb.getSslCertificateKey().c_str(),
+                                  SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    SSL_CTX_free(ctx);
+    return NULL;
+  }
+  SSL_CTX_set_session_id_context(
+      ctx, reinterpret_cast<const unsigned char *>(TLS_SESSION_ID),
+      sizeof(TLS_SESSION_ID) - 1);
+  if (sb.getSslSessionCache() > 0) {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, sb.getSslSessionCache());
+  } else
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+  if (sb.getSslSessionTickets() == "off")
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+  else if (sb.getSslSessionTicketKey().empty() == false &&
+           loadTicketKey(ctx, sb.getSslSessionTicketKey()) == false) {
+    SSL_CTX_free(ctx);
+    return NULL;
+  }
+#ifdef SSL_OP_ENABLE_KTLS
+  if (sb.getSslKtls() == "on") SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+  SSL_CTX_set_tlsext_servername_callback(ctx, selectServerName);
+  SSL_CTX_set_tlsext_servername_arg(ctx, server);
+  SSL_CTX_set_alpn_select_cb(ctx, selectAlpn, server);
+  return ctx;
+}
+
+// the same 80 bytes on every restart and every worker keep the tickets
+// valid, without a file each context makes its own
+bool Tls::loadTicketKey(SSL_CTX *ctx, const std::string &path) {
+  unsigned char key[TLS_TICKET_KEY_SIZE];
+  char extra;
+  int fd = open(path.c_str(), O_RDONLY);
+
+  if (fd == -1) return false;
+  bool isRead = ::read(fd, key, sizeof(key)) == sizeof(key) &&
+                ::read(fd, &extra, 1) == 0;
+  close(fd);
+  return isRead && SSL_CTX_set_tlsext_ticket_keys(ctx, key, sizeof(key)) == 1;
+}
+
+// the errors of the thread since the last call, oldest first
+std::string Tls::popErrors() {
+  std::string errors;
+  char buf[256];
+  unsigned long code;
+
+  while ((code = ERR_get_error()) != 0) {
+    ERR_error_string_n(code, buf, sizeof(buf));
+    if (errors.empty() == false) errors += ", ";
+    errors += buf;
+  }
+  return errors;
+}
+
+// SNI: the handshake goes on with the certificate of the server_name
+int Tls::selectServerName(SSL *ssl, int *alert, void *arg) {
+  const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+  (void)alert;
+  if (name == NULL) return SSL_TLSEXT_ERR_OK;
+  SSL_CTX *ctx = static_cast<Server *>(arg)->findSslCtx(name);
+  if (ctx != NULL && ctx != SSL_get_SSL_CTX(ssl)) SSL_set_SSL_CTX(ssl, ctx);
+  return SSL_TLSEXT_ERR_OK;
+}
+
+// ALPN: h2 on a port with http2 on, the preface follows the handshake
+int Tls::selectAlpn(SSL *ssl, const unsigned char **out,
+                    unsigned char *outLen, const unsigned char *in,
+                    unsigned int inLen, void *arg) {
+  static const unsigned char h2[] = "\x02h2\x08http/1.1";
+  static const unsigned char http1[] = "\x08http/1.1";
+  bool isHttp2 =
+      static_cast<Server *>(arg)->getSPSBList()->front()->getHttp2() == "on";
+
+  (void)ssl;
+  if (SSL_select_next_proto(const_cast<unsigned char **>(out), outLen,
+                            isHttp2 ? h2 : http1,
+                            isHttp2 ? sizeof(h2) - 1 : sizeof(http1) - 1, in,
+                            inLen) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+// the queue of the thread is left empty for the next connection
+bool Tls::isRetry(int ret) {
+  int error = SSL_get_error(_ssl, ret);
+
+  if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+    return true;
+  if (error != SSL_ERROR_ZERO_RETURN) _isBroken = true;
+  ERR_clear_error();
+  return false;
+}
+
+e_tlsState Tls::handshake() {
+  if (_ssl == NULL) return TLS_ERROR;
+  ERR_clear_error();
+  int ret = SSL_do_handshake(_ssl);
+  if (ret == 1) {
+    _isDone = true;
+#ifdef SSL_OP_ENABLE_KTLS
+    _isKtlsSend = BIO_get_ktls_send(SSL_get_wbio(_ssl)) > 0;
+#endif
+    return TLS_DONE;
+  }
+  int error = SSL_get_error(_ssl, ret);
+  if (error == SSL_ERROR_WANT_READ) return TLS_WANT_READ;
+  if (error == SSL_ERROR_WANT_WRITE) return TLS_WANT_WRITE;
+  _isBroken = true;  // the reason stays in the queue for popErrors()
+  return TLS_ERROR;
+}
+
+bool Tls::isDone() const { return _isDone; }
+
+bool Tls::isResumed() const { return SSL_session_reused(_ssl) == 1; }
+
+bool Tls::isKtlsSend() const { return _isKtlsSend; }
+
+ssize_t Tls::read(char *buf, size_t size) {
+  ERR_clear_error();
+  int n = SSL_read(_ssl, buf, size);
+  if (n > 0) return n;
+  if (isRetry(n) == false) return 0;
+  errno = EAGAIN;
+  return -1;
+}
+
+ssize_t Tls::write(const char *buf, size_t size) {
+  struct iovec iov;
+
+  iov.iov_base = const_cast<char *>(buf);
+  iov.iov_len = size;
+  return writev(&iov, 1);
+}
+
+// one record per SSL_write until the socket is full. small buffers are
+// gathered into one record like writev() puts them into one segment. a
+// retry starts at the same byte, so it hands in at least what the record
+// that did not fit was made of
+ssize_t Tls::writev(const struct iovec *iov, int iovCnt) {
+  char buf[TLS_RECORD_MAX];
+  size_t total = 0;
+  int idx = 0;
+  size_t pos = 0;  // in iov[idx]
+
+  ERR_clear_error();
+  while (idx < iovCnt) {
+    const char *data = static_cast<const char *>(iov[idx].iov_base) + pos;
+    size_t size = iov[idx].iov_len - pos;
+    if (size < sizeof(buf)) {
+      size = 0;
+      for (int i = idx; i < iovCnt && size < sizeof(buf); i++) {
+        size_t from = i == idx ? pos : 0;
+        size_t n = std::min(sizeof(buf) - size, iov[i].iov_len - from);
+        memcpy(buf + size, static_cast<const char *>(iov[i].iov_base) + from,
+               n);
+        size += n;
+      }
+      if (size == 0) break;
+      data = buf;
+    }
+    int n = SSL_write(_ssl, data, size);
+    if (n <= 0) return isRetry(n) || total > 0 ? total : -1;
+    total += n;
+    for (size_t left = n; left > 0;) {
+      size_t step = std::min(left, iov[idx].iov_len - pos);
+      pos += step;
+      left -= step;
+      if (pos == iov[idx].iov_len) {
+        idx++;
+        pos = 0;
+      }
+    }
+  }
+  return total;
+}
+
+// a file range, by the kernel with ktls, else read into records here
+ssize_t Tls::sendFile(int fileFd, off_t offset, size_t size) {
+  char buf[TLS_RECORD_MAX];
+  size_t total = 0;
+
+  ERR_clear_error();
+#ifdef SSL_OP_ENABLE_KTLS
+  if (_isKtlsSend) {
+    ossl_ssize_t n = SSL_sendfile(_ssl, fileFd, offset, size, 0);
+    if (n > 0) return n;
+    return isRetry(n) ? 0 : -1;
+  }
+#endif
+  while (total < size) {
+    ssize_t bytesRead = pread(fileFd, buf, std::min(size - total, sizeof(buf)),
+                              offset + total);
+    if (bytesRead <= 0) return total > 0 ? total : -1;
+    int n = SSL_write(_ssl, buf, bytesRead);
+    if (n <= 0) return isRetry(n) || total > 0 ? total : -1;
+    total += n;
+  }
+  return total;
+}
+
+ssize_t sockRead(int fd, Tls *tls, char *buf, size_t size) {
+  if (tls != NULL) return tls->read(buf, size);
+#ifdef HAS_RING_IO
+  if (UringPoller *ring = UringPoller::getRing(fd))
+    return ring->recv(fd, buf, size);
+#endif
+  return read(fd, buf, size);
+}
+
+ssize_t sockWrite(int fd, Tls *tls, const char *buf, size_t size) {
+  if (tls != NULL) return tls->write(buf, size);
+#ifdef HAS_RING_IO
+  if (UringPoller *ring = UringPoller::getRing(fd)) {
+    struct iovec iov = {const_cast<char *>(buf), size};
+    return ring->sendv(fd, &iov, 1);
+  }
+#endif
+  return write(fd, buf, size);
+}
+
+ssize_t sockWritev(int fd, Tls *tls, const struct iovec *iov, int iovCnt) {
+  if (tls != NULL) return tls->writev(iov, iovCnt);
+#ifdef HAS_RING_IO
+  if (UringPoller *ring = UringPoller::getRing(fd))
+    return ring->sendv(fd, iov, iovCnt);
+#endif
+  return writev(fd, iov, iovCnt);
+}
+
+ssize_t sockSendFile(int fd, Tls *tls, int fileFd, off_t offset, size_t size) {
+  if (tls != NULL) return tls->sendFile(fileFd, offset, size);
+#ifdef HAS_RING_IO
+  if (UringPoller *ring = UringPoller::getRing(fd))
+    return ring->sendFile(fd, fileFd, offset, size);
+#endif
+#ifdef __APPLE__
+  off_t len = size;
+  if (sendfile(fileFd, fd, offset, &len, NULL, 0) == -1 && len == 0) return -1;
+  return len;
+#else
+  return sendfile(fd, fileFd, &offset, size);
+#endif
+}
+
+// an attached socket is closed by the ring once its queued writes are out
+int sockClose(int fd) {
+#ifdef HAS_RING_IO
+  if (UringPoller *ring = UringPoller::getRing(fd)) {
+    ring->closeSocket(fd);
+    return 0;
+  }
+#endif
+  return close(fd);
+}
+
+// a file that sockSendFile() handed to the ring is closed after its reads
+int fileClose(int fileFd) {
+#ifdef HAS_RING_IO
+  if (UringPoller::fileClose(fileFd)) return 0;
+#endif
+  return close(fileFd);
+}
@@ -0,0 +1,846 @@
+#include "../includes/Poller.hpp"
+
+#ifdef HAS_IO_URING
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "../includes/Utils.hpp"
+
+#define IGNORE_TAG (~0ULL)  // user_data of a remove, cancel or close, its cqe
+                            // is dropped
+#define BUF_GROUP 0         // of the provided buffers
+
+// what a completion is for, the low bits of its user_data
+enum e_ringOp {
+  OP_POLL_READ,
+  OP_POLL_WRITE,
+  OP_RECV,
+  OP_ACCEPT,
+  OP_SEND,
+  OP_READ  // of a file piece of a stream
+};
+
+// the generation, fd and operation. a poll is OP_POLL_READ + its filter
+static uint64_t getUserData(uint32_t gen, int fd, int op) {
+  return (static_cast<uint64_t>(gen) << 32) |
+         (static_cast<uint64_t>(fd) << 3) | op;
+}
+
+static unsigned long getMonotonicMsec() { return getMonotonicUsec() / 1000; }
+
+#ifdef HAS_RING_IO
+UringPoller *UringPoller::_io = NULL;
+#endif
+
+UringPoller::UringPoller()
+    : _ringFd(-1),
+      _sqRing(NULL),
+      _cqRing(NULL),
+      _sqRingSize(0),
+      _cqRingSize(0),
+      _sqes(NULL),
+      _sqesSize(0)
+#ifdef HAS_RING_IO
+      ,
+      _bufRing(NULL),
+      _bufs(NULL),
+      _bufTail(0),
+      _freeBufs(0),
+      _outBytes(0)
+#endif
+{
+}
+
+UringPoller::~UringPoller() {
+  if (_sqes != NULL) munmap(_sqes, _sqesSize);
+  if (_cqRing != NULL && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+  if (_sqRing != NULL) munmap(_sqRing, _sqRingSize);
+  if (_ringFd != -1) close(_ringFd);
+#ifdef HAS_RING_IO
+  if (_io == this) _io = NULL;
+  if (_bufRing != NULL)
+    munmap(_bufRing, RING_BUFS * sizeof(struct io_uring_buf));
+  if (_bufs != NULL) munmap(_bufs, RING_BUFS * RING_BUF_SIZE);
+  for (size_t i = 0; i < _streams.size(); i++) delete _streams[i];
+#endif
+}
+
+static void *mapRing(int fd, size_t size, off_t offset) {
+  void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, offset);
+  return ring == MAP_FAILED ? NULL : ring;
+}
+
+// false if the kernel has no io_uring, forbids it or is older than 5.11
+bool UringPoller::init() {
+  struct io_uring_params params;
+
+  memset(&params, 0, sizeof(params));
+  _ringFd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (_ringFd == -1) return false;
+  fcntl(_ringFd, F_SETFD, FD_CLOEXEC);
+  if ((params.features & IORING_FEAT_EXT_ARG) == 0 ||
+      (params.features & IORING_FEAT_NODROP) == 0)
+    return false;
+  _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  _cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    _sqRingSize = std::max(_sqRingSize, _cqRingSize);
+    _cqRingSize = _sqRingSize;
+  }
+  _sqRing = mapRing(_ringFd, _sqRingSize, IORING_OFF_SQ_RING);
+  if (_sqRing == NULL) return false;
+  _cqRing = _sqRing;
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+    _cqRing = mapRing(_ringFd, _cqRingSize, IORING_OFF_CQ_RING);
+  if (_cqRing == NULL) return false;
+  _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  _sqes = static_cast<struct io_uring_sqe *>(
+      mapRing(_ringFd, _sqesSize, IORING_OFF_SQES));
+  if (_sqes == NULL) return false;
+
+  char *sq = static_cast<char *>(_sqRing);
+  char *cq = static_cast<char *>(_cqRing);
+  _sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  _sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  _sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  _sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  _cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  _cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  _cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+#ifdef HAS_RING_IO
+  // without them the sockets stay on polls
+  if (initBuffers() && probeRecv()) {
+    _io = this;
+    _loopThread = pthread_self();
+  }
+#endif
+  return true;
+}
+
+const char *UringPoller::getName() const {
+#ifdef HAS_RING_IO
+  if (_io == this) return "io_uring";
+#endif
+  return "io_uring (polls only)";
+}
+
+UringPoller::Arm &UringPoller::getArm(int fd) {
+  if (static_cast<size_t>(fd) >= _arms.size()) {
+    Arm off = {{false, false}, {0, 0}};
+    size_t size = std::max(static_cast<size_t>(fd) + 1, _arms.size() * 2);
+    _arms.resize(size, off);
+    _isDirty.resize(size, false);
+  }
+  return _arms[fd];
+}
+
+void UringPoller::markDirty(int fd) {
+  getArm(fd);
+  if (_isDirty[fd]) return;
+  _isDirty[fd] = true;
+  _dirty.push_back(fd);
+}
+
+// a zeroed sqe at the tail, submitted with the next enter(). a full queue
+// is handed to the kernel first
+struct io_uring_sqe *UringPoller::getSqe() {
+  unsigned tail = *_sqTail;
+
+  if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) > _sqMask)
+    enter(0, 0);
+  struct io_uring_sqe *sqe = &_sqes[tail & _sqMask];
+  memset(sqe, 0, sizeof(*sqe));
+  _sqArray[tail & _sqMask] = tail & _sqMask;
+  return sqe;
+}
+
+// queues a poll for every filter turned on and a removal for every filter
+// turned off since the last wait. a stream gets its ring operations instead
+void UringPoller::syncPolls() {
+  for (size_t j = 0; j < _dirty.size(); j++) {
+    int fd = _dirty[j];
+    Filters &filters = getFilters(fd);
+    Arm &arm = _arms[fd];
+    bool isPolled = true;
+#ifdef HAS_RING_IO
+    isPolled = isStream(fd) == false;
+#endif
+    _isDirty[fd] = false;
+    for (int i = 0; i < 2; i++) {
+      bool isOn = filters.isOn[i] && isPolled;
+      if (isOn == arm.isArmed[i]) continue;
+      struct io_uring_sqe *sqe = getSqe();
+      if (isOn) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = i == 0 ? POLLIN | POLLRDHUP : POLLOUT;
+        sqe->user_data = getUserData(arm.gen[i], fd, OP_POLL_READ + i);
+      } else {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = getUserData(arm.gen[i]++, fd, OP_POLL_READ + i);
+        sqe->user_data = IGNORE_TAG;
+      }
+      arm.isArmed[i] = isOn;
+      __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+    }
+#ifdef HAS_RING_IO
+    if (isPolled == false) syncStream(fd);
+#endif
+  }
+  _dirty.clear();
+}
+
+// submits the queued sqes and waits up to msec for minComplete cqes
+int UringPoller::enter(unsigned minComplete, int msec) {
+  unsigned toSubmit = *_sqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned flags = IORING_ENTER_EXT_ARG;
+
+  if (toSubmit == 0 && minComplete == 0) return 0;
+  memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  if (msec >= 0) {
+    ts.tv_sec = msec / 1000;
+    ts.tv_nsec = (msec % 1000) * 1000000L;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+  }
+  if (minComplete > 0) flags |= IORING_ENTER_GETEVENTS;
+  if (syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete, flags, &arg,
+              sizeof(arg)) == -1 &&
+      errno != ETIME && errno != EINTR)
+    return -1;
+  return 0;
+}
+
+int UringPoller::update(int fd) {
+  markDirty(fd);
+#ifdef HAS_RING_IO
+  if (isStream(fd)) markReady(fd);
+#endif
+  return 0;
+}
+
+// the event of a poll that fired, 0 if it is stale
+int UringPoller::reapPoll(const struct io_uring_cqe &cqe,
+                          struct kevent *event) {
+  uint32_t gen = cqe.user_data >> 32;
+  int fd = (cqe.user_data & 0xffffffff) >> 3;
+  int i = (cqe.user_data & 7) - OP_POLL_READ;
+
+  if (static_cast<size_t>(fd) >= _arms.size() || _arms[fd].gen[i] != gen ||
+      _arms[fd].isArmed[i] == false)
+    return 0;
+  _arms[fd].isArmed[i] = false;
+  markDirty(fd);  // polled again on the next wait while the filter is on
+  if (cqe.res == -ECANCELED) return 0;
+  EV_SET(event, fd, i == 0 ? EVFILT_READ : EVFILT_WRITE, 0, 0, 0,
+         _fds[fd].udata[i]);
+  if (cqe.res < 0) {
+    event->flags = EV_ERROR;
+    event->data = -cqe.res;
+  }
+  return 1;
+}
+
+// completions past size stay in the queue for the next wait. streams that
+// can fire already make it a look at the queue without waiting
+int UringPoller::wait(struct kevent *events, int size, int msec) {
+  bool isReady = false;
+
+  syncPolls();
+#ifdef HAS_RING_IO
+  isReady = hasReady();
+  if (_lingers.empty() == false) {
+    unsigned long now = getMonotonicMsec();
+    unsigned long end = _lingers.begin()->first;
+    long untilEnd = end > now ? static_cast<long>(end - now) : 0;
+    if (msec == -1 || untilEnd < msec) msec = untilEnd;
+  }
+#endif
+  bool isEmpty = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE) == *_cqHead;
+  if (enter(isEmpty && isReady == false ? 1 : 0, isReady ? 0 : msec) == -1)
+    return -1;
+
+  unsigned head = *_cqHead;
+  unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+  int cnt = 0;
+  for (; head != tail && cnt < size; head++) {
+    const struct io_uring_cqe &cqe = _cqes[head & _cqMask];
+    if (cqe.user_data == IGNORE_TAG) continue;
+    int op = cqe.user_data & 7;
+    if (op == OP_POLL_READ || op == OP_POLL_WRITE)
+      cnt += reapPoll(cqe, &events[cnt]);
+#ifdef HAS_RING_IO
+    else
+      reapStream(cqe);
+#endif
+  }
+  __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+#ifdef HAS_RING_IO
+  expireLingers();
+  cnt += collectReady(events + cnt, size - cnt);
+#endif
+  return cnt;
+}
+
+
+#ifdef HAS_RING_IO
+// the provided buffers, all of them in the ring. false if the kernel is
+// older than 5.19
+bool UringPoller::initBuffers() {
+  struct io_uring_buf_reg reg;
+
+  _bufRing = mmap(NULL, RING_BUFS * sizeof(struct io_uring_buf),
+                  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (_bufRing == MAP_FAILED) {
+    _bufRing = NULL;
+    return false;
+  }
+  void *bufs = mmap(NULL, RING_BUFS * RING_BUF_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs == MAP_FAILED) return false;
+  _bufs = static_cast<char *>(bufs);
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uintptr_t>(_bufRing);
+  reg.ring_entries = RING_BUFS;
+  reg.bgid = BUF_GROUP;
+  if (syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_PBUF_RING, &reg,
+              1) == -1)
+    return false;
+  for (int i = 0; i < RING_BUFS; i++) recycle(i);
+  return true;
+}
+
+// a multishot recv of a byte on a socket pair, linux 6.0 has it
+bool UringPoller::probeRecv() {
+  int pair[2];
+  bool isOk = false;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1)
+    return false;
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = pair[0];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP;
+  sqe->user_data = getUserData(0, pair[0], OP_RECV);
+  __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+  if (write(pair[1], "", 1) == 1) {
+    close(pair[1]);
+    pair[1] = -1;
+    enter(2, 1000);  // the byte, then the end
+  }
+  unsigned head = *_cqHead;
+  unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe &cqe = _cqes[head & _cqMask];
+    if ((cqe.flags & IORING_CQE_F_BUFFER) == 0) continue;
+    _freeBufs--;
+    recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE)) isOk = true;
+  }
+  __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+  close(pair[0]);
+  if (pair[1] != -1) close(pair[1]);
+  return isOk;
+}
+
+UringPoller::Stream &UringPoller::getStream(int fd) {
+  if (static_cast<size_t>(fd) >= _streams.size())
+    _streams.resize(std::max(static_cast<size_t>(fd) + 1, _streams.size() * 2),
+                    NULL);
+  if (_streams[fd] == NULL) {
+    Stream *stream = new Stream;
+    stream->isListener = false;
+    stream->isAttached = false;
+    stream->isClosing = false;
+    stream->gen = 0;
+    stream->isArmed = false;
+    stream->isCancelled = false;
+    stream->isEof = false;
+    stream->error = 0;
+    stream->outSize = 0;
+    stream->sent = 0;
+    stream->isSending = false;
+    stream->isReading = false;
+    stream->lingerEnd = 0;
+    _streams[fd] = stream;
+  }
+  return *_streams[fd];
+}
+
+bool UringPoller::isStream(int fd) const {
+  if (static_cast<size_t>(fd) >= _streams.size() || _streams[fd] == NULL)
+    return false;
+  return _streams[fd]->isListener || _streams[fd]->isAttached;
+}
+
+// a read filter fires while there is something to take, a write filter
+// while the queue has room
+bool UringPoller::isFiring(int fd, int i) const {
+  if (isStream(fd) == false || static_cast<size_t>(fd) >= _fds.size() ||
+      _fds[fd].isOn[i] == false)
+    return false;
+  const Stream &stream = *_streams[fd];
+  if (stream.isListener) return i == 0 && stream.accepted.empty() == false;
+  if (stream.isClosing) return false;
+  if (i == 0) return stream.in.empty() == false || stream.isEof;
+  return stream.error != 0 || getSpace(stream) > 0;
+}
+
+bool UringPoller::hasReady() const {
+  for (size_t j = 0; j < _ready.size(); j++)
+    if (isFiring(_ready[j], 0) || isFiring(_ready[j], 1)) return true;
+  return false;
+}
+
+void UringPoller::markReady(int fd) {
+  if (static_cast<size_t>(fd) >= _isReady.size())
+    _isReady.resize(std::max(static_cast<size_t>(fd) + 1, _isReady.size() * 2),
+                    false);
+  if (_isReady[fd]) return;
+  _isReady[fd] = true;
+  _ready.push_back(fd);
+}
+
+// the buffer goes back to the ring, recvs that ran out can start again.
+// the tail of the ring is the resv of its first entry, the flexible array
+// of io_uring_buf_ring does not start at 0 in c++
+void UringPoller::recycle(uint16_t bid) {
+  struct io_uring_buf *ring = static_cast<struct io_uring_buf *>(_bufRing);
+  struct io_uring_buf &buf = ring[_bufTail & (RING_BUFS - 1)];
+
+  buf.addr = reinterpret_cast<uintptr_t>(_bufs + bid * RING_BUF_SIZE);
+  buf.len = RING_BUF_SIZE;
+  buf.bid = bid;
+  _bufTail++;
+  __atomic_store_n(&ring[0].resv, _bufTail, __ATOMIC_RELEASE);
+  _freeBufs++;
+  for (size_t i = 0; i < _starved.size(); i++) markDirty(_starved[i]);
+  _starved.clear();
+}
+
+size_t UringPoller::getSpace(const Stream &stream) const {
+  size_t used = stream.outSize - stream.sent;
+  return used < RING_SEND_MAX ? RING_SEND_MAX - used : 0;
+}
+
+// the accept or recv runs while the read filter is on and the socket does
+// not hold too much. the front piece is sent while the first file piece is
+// read, a closing socket is closed once it is all out
+void UringPoller::syncStream(int fd) {
+  Stream &stream = *_streams[fd];
+  Filters &filters = getFilters(fd);
+  struct io_uring_sqe *sqe;
+
+  if (stream.isListener) {
+    if (filters.isOn[0] && stream.isArmed == false) {
+      sqe = getSqe();
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = fd;
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = SOCK_CLOEXEC;
+      sqe->user_data = getUserData(stream.gen, fd, OP_ACCEPT);
+      __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+      stream.isArmed = true;
+    } else if (filters.isOn[0] == false) {
+      // forgotten before its close, what it still accepts is closed
+      if (stream.isArmed) {
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = getUserData(stream.gen, fd, OP_ACCEPT);
+        sqe->user_data = IGNORE_TAG;
+        __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+      }
+      for (size_t i = 0; i < stream.accepted.size(); i++)
+        if (stream.accepted[i] >= 0) close(stream.accepted[i]);
+      stream.accepted.clear();
+      stream.isListener = false;
+      stream.isArmed = false;
+      stream.gen++;
+    }
+    return;
+  }
+  bool isWanted = filters.isOn[0] && stream.isClosing == false &&
+                  stream.isEof == false && stream.in.size() < RING_FD_BUFS;
+  if (isWanted && stream.isArmed == false) {
+    if (_freeBufs == 0) {
+      _starved.push_back(fd);
+    } else {
+      sqe = getSqe();
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = fd;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = BUF_GROUP;
+      sqe->user_data = getUserData(stream.gen, fd, OP_RECV);
+      __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+      stream.isArmed = true;
+      stream.isCancelled = false;
+    }
+  } else if (isWanted == false && stream.isArmed &&
+             stream.isCancelled == false) {
+    // what comes before it stops is still kept
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = getUserData(stream.gen, fd, OP_RECV);
+    sqe->user_data = IGNORE_TAG;
+    __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+    stream.isCancelled = true;
+  }
+  if (stream.isSending == false && stream.error == 0 &&
+      stream.out.empty() == false && stream.out.front().fileFd == -1) {
+    Piece &piece = stream.out.front();
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(piece.data.data() + stream.sent);
+    sqe->len = piece.data.size() - stream.sent;
+    // a head goes out with the file piece after it, not on its own
+    sqe->msg_flags = MSG_NOSIGNAL | (stream.out.size() > 1 ? MSG_MORE : 0);
+    sqe->user_data = getUserData(stream.gen, fd, OP_SEND);
+    __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+    stream.isSending = true;
+  }
+  for (size_t i = 0; i < stream.out.size() && stream.isReading == false &&
+                     stream.error == 0;
+       i++) {
+    Piece &piece = stream.out[i];
+    if (piece.fileFd == -1) continue;
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = piece.fileFd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&piece.data[piece.filled]);
+    sqe->len = piece.data.size() - piece.filled;
+    sqe->off = piece.offset;
+    sqe->user_data = getUserData(stream.gen, fd, OP_READ);
+    __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+    stream.isReading = true;
+  }
+  if (stream.isClosing && stream.isSending == false &&
+      stream.isReading == false &&
+      (stream.error != 0 || stream.out.empty()))
+    shut(fd);
+}
+
+// the close goes with the next wait, the fd is not taken again before. a
+// completion of the socket that comes later is stale
+void UringPoller::shut(int fd) {
+  Stream &stream = *_streams[fd];
+  struct io_uring_sqe *sqe = getSqe();
+
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  sqe->user_data = IGNORE_TAG;
+  __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+  if (stream.lingerEnd != 0)
+    _lingers.erase(std::make_pair(stream.lingerEnd, fd));
+  for (size_t i = 0; i < stream.in.size(); i++) recycle(stream.in[i].bid);
+  stream.in.clear();
+  for (size_t i = 0; i < stream.out.size(); i++)
+    if (stream.out[i].fileFd != -1) releaseFile(stream.out[i].fileFd);
+  std::deque<Piece>().swap(stream.out);
+  _outBytes -= stream.outSize;
+  stream.outSize = 0;
+  stream.isAttached = false;
+  stream.isClosing = false;
+  stream.gen++;
+  stream.isArmed = false;
+  stream.isCancelled = false;
+  stream.isEof = false;
+  stream.error = 0;
+  stream.sent = 0;
+  stream.lingerEnd = 0;
+}
+
+// the close goes with the next wait
+void UringPoller::closeFile(int fileFd) {
+  struct io_uring_sqe *sqe = getSqe();
+
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fileFd;
+  sqe->user_data = IGNORE_TAG;
+  __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+}
+
+// a piece is read or dropped, the file may be closed now
+void UringPoller::releaseFile(int fileFd) {
+  std::map<int, int>::iterator it = _fileRefs.find(fileFd);
+
+  if (it == _fileRefs.end() || --it->second > 0) return;
+  _fileRefs.erase(it);
+  if (_closingFiles.erase(fileFd) > 0) closeFile(fileFd);
+}
+
+// an accept, recv, send or file read came back. a buffer of a stale recv
+// goes back to the ring, a socket of a stale accept is closed
+void UringPoller::reapStream(const struct io_uring_cqe &cqe) {
+  uint32_t gen = cqe.user_data >> 32;
+  int fd = (cqe.user_data & 0xffffffff) >> 3;
+  int op = cqe.user_data & 7;
+  bool hasBuf = cqe.flags & IORING_CQE_F_BUFFER;
+  uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if (hasBuf) _freeBufs--;
+  if (isStream(fd) == false || _streams[fd]->gen != gen) {
+    if (hasBuf) recycle(bid);
+    if (op == OP_ACCEPT && cqe.res >= 0) close(cqe.res);
+    return;
+  }
+  Stream &stream = *_streams[fd];
+  bool isMore = cqe.flags & IORING_CQE_F_MORE;
+  if (op == OP_ACCEPT) {
+    if (cqe.res != -ECANCELED) stream.accepted.push_back(cqe.res);
+  } else if (op == OP_RECV) {
+    if (hasBuf) {
+      Chunk chunk = {bid, static_cast<uint32_t>(cqe.res), 0};
+      stream.in.push_back(chunk);
+    } else if (cqe.res == -ENOBUFS) {
+      _starved.push_back(fd);
+    } else if (cqe.res != -ECANCELED) {
+      stream.isEof = true;  // the end or an error, read() gives 0 for both
+    }
+  } else if (op == OP_SEND) {
+    stream.isSending = false;
+    if (cqe.res < 0) {
+      stream.error = -cqe.res;
+      stream.isEof = true;
+    } else if ((stream.sent += cqe.res) == stream.out.front().data.size()) {
+      stream.outSize -= stream.sent;
+      _outBytes -= stream.sent;
+      stream.sent = 0;
+      stream.out.pop_front();
+    }
+    markDirty(fd);
+  } else if (op == OP_READ) {
+    Piece *piece = NULL;
+    for (size_t i = 0; piece == NULL; i++)
+      if (stream.out[i].fileFd != -1) piece = &stream.out[i];
+    stream.isReading = false;
+    // the file got shorter than its head says, the connection is broken
+    if (cqe.res <= 0) {
+      stream.error = cqe.res < 0 ? -cqe.res : EIO;
+      stream.isEof = true;
+    } else {
+      piece->filled += cqe.res;
+      piece->offset += cqe.res;
+      if (piece->filled == piece->data.size()) {
+        releaseFile(piece->fileFd);
+        piece->fileFd = -1;
+      }
+    }
+    markDirty(fd);
+  }
+  if ((op == OP_ACCEPT || op == OP_RECV) && isMore == false) {
+    stream.isArmed = false;
+    markDirty(fd);
+  }
+  markReady(fd);
+}
+
+// a closing socket that could not send the rest in RING_LINGER is dropped
+void UringPoller::expireLingers() {
+  unsigned long now = getMonotonicMsec();
+
+  while (_lingers.empty() == false && _lingers.begin()->first <= now) {
+    int fd = _lingers.begin()->second;
+    Stream &stream = *_streams[fd];
+    _lingers.erase(_lingers.begin());
+    stream.lingerEnd = 0;
+    stream.error = ETIMEDOUT;
+    if (stream.isSending) {
+      struct io_uring_sqe *sqe = getSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = getUserData(stream.gen, fd, OP_SEND);
+      sqe->user_data = IGNORE_TAG;
+      __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+    }
+    markDirty(fd);
+  }
+}
+
+// the filters of the streams that fire. they stay in the list until they
+// do not, like level triggered polls
+int UringPoller::collectReady(struct kevent *events, int size) {
+  int cnt = 0;
+  size_t kept = 0;
+
+  for (size_t j = 0; j < _ready.size(); j++) {
+    int fd = _ready[j];
+    bool isKept = false;
+    for (int i = 0; i < 2; i++) {
+      if (isFiring(fd, i) == false) continue;
+      isKept = true;
+      if (cnt < size)
+        EV_SET(&events[cnt++], fd, i == 0 ? EVFILT_READ : EVFILT_WRITE, 0, 0,
+               0, _fds[fd].udata[i]);
+    }
+    if (isKept)
+      _ready[kept++] = fd;
+    else
+      _isReady[fd] = false;
+  }
+  _ready.resize(kept);
+  return cnt;
+}
+
+void UringPoller::listen(int fd) {
+  if (_io != this) return;
+  Stream &stream = getStream(fd);
+  stream.isListener = true;
+  stream.gen++;
+}
+
+// a socket the multishot accept took, its address asked from the kernel
+int UringPoller::accept(int fd, struct sockaddr_in *addr) {
+  if (isStream(fd) == false || _streams[fd]->isListener == false)
+    return Poller::accept(fd, addr);
+  std::deque<int> &accepted = _streams[fd]->accepted;
+  if (accepted.empty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  int client = accepted.front();
+  accepted.pop_front();
+  if (client < 0) {
+    errno = -client;
+    return -1;
+  }
+  socklen_t len = sizeof(*addr);
+  if (getpeername(client, reinterpret_cast<struct sockaddr *>(addr), &len) ==
+      -1)
+    memset(addr, 0, sizeof(*addr));
+  return client;
+}
+
+bool UringPoller::attach(int fd) {
+  if (_io != this) return false;
+  Stream &stream = getStream(fd);
+  stream.isAttached = true;
+  stream.gen++;
+  return true;
+}
+
+// the pieces of all streams and the ring buffers they hold
+size_t UringPoller::getHeldSize() const {
+  if (_io != this) return 0;
+  return _outBytes + (RING_BUFS - _freeBufs) * RING_BUF_SIZE;
+}
+
+// the ring of an attached socket that is not closed, NULL for the others
+UringPoller *UringPoller::getRing(int fd) {
+  if (_io == NULL || _io->isStream(fd) == false) return NULL;
+  const Stream &stream = *_io->_streams[fd];
+  return stream.isAttached && stream.isClosing == false ? _io : NULL;
+}
+
+// what the recvs left, 0 at the end or after an error, -1 if nothing came
+ssize_t UringPoller::recv(int fd, char *buf, size_t size) {
+  Stream &stream = *_streams[fd];
+  size_t total = 0;
+
+  while (total < size && stream.in.empty() == false) {
+    Chunk &chunk = stream.in.front();
+    size_t n = std::min(size - total, static_cast<size_t>(chunk.len -
+                                                          chunk.offset));
+    memcpy(buf + total, _bufs + chunk.bid * RING_BUF_SIZE + chunk.offset, n);
+    total += n;
+    chunk.offset += n;
+    if (chunk.offset < chunk.len) continue;
+    recycle(chunk.bid);
+    stream.in.pop_front();
+    if (stream.isArmed == false) markDirty(fd);
+  }
+  if (total > 0) return total;
+  if (stream.isEof) return 0;
+  errno = EAGAIN;
+  return -1;
+}
+
+// queued for the send of the next wait as far as there is room, 0 if none.
+// the piece in flight is not touched
+ssize_t UringPoller::sendv(int fd, const struct iovec *iov, int iovCnt) {
+  Stream &stream = *_streams[fd];
+  size_t space = getSpace(stream);
+  size_t total = 0;
+
+  if (stream.error != 0) {
+    errno = stream.error;
+    return -1;
+  }
+  for (int i = 0; i < iovCnt && total < space; i++) {
+    size_t n = std::min(iov[i].iov_len, space - total);
+    if (n == 0) continue;
+    if (stream.out.empty() || stream.out.back().fileFd != -1 ||
+        (stream.isSending && stream.out.size() == 1)) {
+      Piece piece = {"", 0, -1, 0};
+      stream.out.push_back(piece);
+    }
+    Piece &piece = stream.out.back();
+    piece.data.append(static_cast<const char *>(iov[i].iov_base), n);
+    piece.filled = piece.data.size();
+    total += n;
+  }
+  stream.outSize += total;
+  _outBytes += total;
+  if (total > 0) markDirty(fd);
+  return total;
+}
+
+// a file range as far as there is room, read by the ring in its turn. the
+// file is closed with fileClose()
+ssize_t UringPoller::sendFile(int fd, int fileFd, off_t offset, size_t size) {
+  Stream &stream = *_streams[fd];
+
+  if (stream.error != 0) {
+    errno = stream.error;
+    return -1;
+  }
+  size = std::min(size, getSpace(stream));
+  if (size == 0) return 0;
+  Piece piece = {std::string(size, '\0'), 0, fileFd, offset};
+  stream.out.push_back(piece);
+  stream.outSize += size;
+  _outBytes += size;
+  _fileRefs[fileFd]++;
+  markDirty(fd);
+  return size;
+}
+
+// after forget(). what is queued still goes out, for RING_LINGER at most
+void UringPoller::closeSocket(int fd) {
+  Stream &stream = *_streams[fd];
+
+  stream.isClosing = true;
+  if (stream.out.empty() == false) {
+    stream.lingerEnd = getMonotonicMsec() + RING_LINGER;
+    _lingers.insert(std::make_pair(stream.lingerEnd, fd));
+  }
+  markDirty(fd);
+}
+
+// false if it is not the loop thread or the ring is not used. a file that
+// pieces still read from is closed after them
+bool UringPoller::fileClose(int fileFd) {
+  if (_io == NULL || pthread_equal(_io->_loopThread, pthread_self()) == 0)
+    return false;
+  if (_io->_fileRefs.count(fileFd) > 0)
+    _io->_closingFiles.insert(fileFd);
+  else
+    _io->closeFile(fileFd);
+  return true;
+}
+#endif
+
+#endif
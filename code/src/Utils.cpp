@@ -57,6 +57,17 @@ std::string ftItos(int num) {
   return ret;
 }
 
+std::string ftUtos(size_t num) {
+  char buf[24];
+  int pos = sizeof(buf);
+
+  do {
+    buf[--pos] = num % 10 + '0';
+    num /= 10;
+  } while (num);
+  return std::string(buf + pos, sizeof(buf) - pos);
+}
+
 void ftToupper(std::string& str) {
   std::string res;
 
@@ -118,14 +129,91 @@ std::string ftInetNtoa(struct in_addr addr) {
   return ss.str();
 }
 
-std::string getCurrentTime() {
-  std::time_t t = std::time(NULL);
+std::string getCurrentTime() { return formatHttpTime(std::time(NULL)); }
+
+std::string formatHttpTime(std::time_t t) {
   /*시간을 tm구조로 변환해 줌*/
-  std::tm* timePtr = std::gmtime(&t);
+  std::tm tm;
+  gmtime_r(&t, &tm);
 
-  char buffer[1000];
+  char buffer[32];
   /*날짜/시간을 문자열로 변환*/
-  std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", timePtr);
+  std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
 
   return (std::string(buffer));
-}
\ No newline at end of file
+}
+
+static std::string g_cachedTime;
+static std::time_t g_cachedSecond = 0;
+
+/*called by the event loop, reformats only when the second has changed*/
+void updateCachedTime() {
+  std::time_t t = std::time(NULL);
+
+  if (t == g_cachedSecond) return;
+  g_cachedSecond = t;
+  g_cachedTime = getCurrentTime();
+}
+
+// a file thread formats its own copy, the loop's one changes under it
+struct ThreadTime {
+  std::string time;
+  std::time_t second;
+};
+
+static pthread_key_t g_threadTimeKey;
+static bool g_hasThreadTime = false;
+
+static void deleteThreadTime(void* time) {
+  delete static_cast<ThreadTime*>(time);
+}
+
+// called by FilePool before its threads start
+void initThreadTime() {
+  if (g_hasThreadTime) return;
+  pthread_key_create(&g_threadTimeKey, deleteThreadTime);
+  g_hasThreadTime = true;
+}
+
+// called by a file thread when it starts
+void useThreadTime() {
+  ThreadTime* time = new ThreadTime;
+  time->second = 0;
+  pthread_setspecific(g_threadTimeKey, time);
+}
+
+const std::string& getCachedTime() {
+  if (g_hasThreadTime) {
+    ThreadTime* time =
+        static_cast<ThreadTime*>(pthread_getspecific(g_threadTimeKey));
+    if (time != NULL) {
+      std::time_t t = std::time(NULL);
+      if (t != time->second) {
+        time->second = t;
+        time->time = formatHttpTime(t);
+      }
+      return time->time;
+    }
+  }
+  if (g_cachedSecond == 0) updateCachedTime();
+  return g_cachedTime;
+}
+
+// for durations, not affected by changes of the wall clock
+unsigned long getMonotonicUsec() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+// an unlinked temp file for bodies moved out of memory, -1 on error
+int openSpillFile() {
+  char path[] = SPILL_TEMPLATE;
+  int fd = mkstemp(path);
+
+  if (fd == -1) return -1;
+  unlink(path);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
@@ -10,6 +10,7 @@ int main(int ac, char **av) {
     return EXIT_FAILURE;
   }
   try {
+    ErrorPage::loadDefaults();
     RootBlock root;
     ConfigParser parser(av[1]);
     parser.parseBlocks(&root, ROOT);